@@ -24,52 +24,153 @@
  * SUCH DAMAGE.
  */
 
+#include <sys/mman.h>
+
 #include <cuse.h>
-#include <fs/cuse/cuse_ioctl.h>
 
-#define	WEBCAMD_USER_ALLOC_MAX 4096UL
-#define	WEBCAMD_USER_ALLOC_ADDR (CUSE_BUF_MAX_PTR - WEBCAMD_USER_ALLOC_MAX)
+/*
+ * The compat user space is a per-thread bump arena of anonymous
+ * mappings. It is reset after every compat IOCTL, READ and WRITE.
+ * Handed out pointers are real pointers. While a compat call is
+ * executing the peer only has 32-bit pointers, so placing the arena
+ * above 4 GBytes on 64-bit platforms keeps the two apart.
+ */
+#define	WEBCAMD_USER_ALLOC_MIN (16UL * 1024UL)	/* bytes */
+#define	WEBCAMD_USER_ALLOC_KEEP (256UL * 1024UL)	/* bytes */
+#define	WEBCAMD_USER_ALLOC_ALIGN 16UL
 
-#if ((CUSE_BUF_MAX_PTR - CUSE_BUF_MIN_PTR) / 2) < WEBCAMD_USER_ALLOC_MAX
-#error "The CUSE IOCTL allocation window is too small!"
-#endif
+struct tls_chunk {
+	struct tls_chunk *next;
+	unsigned long size;		/* usable bytes after header */
+	unsigned long offset;		/* bytes allocated */
+	unsigned long dirty;		/* bytes which may be non-zero */
+};
 
 struct tls_memory {
-	void *ptr;
-	unsigned long offset;
+	struct tls_chunk *first;
+	struct tls_chunk *last;
 };
 
 static __thread struct tls_memory linux_tls_memory = {};
+static pthread_key_t linux_tls_key;
+static pthread_once_t linux_tls_once = PTHREAD_ONCE_INIT;
 
-void *
-compat_alloc_user_space(unsigned long len)
+static struct tls_chunk *
+compat_chunk_alloc(unsigned long len)
 {
-	unsigned long rem;
+	struct tls_chunk *pc;
+	unsigned long size;
+	void *hint;
 	void *ptr;
 
-	if (in_compat_syscall() == 0 ||
-	    len > WEBCAMD_USER_ALLOC_MAX)
+	size = PAGE_ALIGN(len + sizeof(*pc));
+	if (size < len)
+		return (NULL);
+#ifdef __LP64__
+	hint = (void *)(1UL << 32);
+#else
+	hint = NULL;
+#endif
+	ptr = mmap(hint, size, PROT_READ | PROT_WRITE,
+	    MAP_PRIVATE | MAP_ANON, -1, 0);
+	if (ptr == MAP_FAILED)
 		return (NULL);
+#ifdef __LP64__
+	if ((uintptr_t)ptr < (1UL << 32)) {
+		munmap(ptr, size);
+		return (NULL);
+	}
+#endif
+	/* fresh anonymous memory is zero */
+	pc = ptr;
+	pc->next = NULL;
+	pc->size = size - sizeof(*pc);
+	pc->offset = 0;
+	pc->dirty = 0;
+	return (pc);
+}
 
-	if (linux_tls_memory.ptr == NULL) {
-		linux_tls_memory.ptr = malloc(WEBCAMD_USER_ALLOC_MAX);
-		linux_tls_memory.offset = 0;
-		if (linux_tls_memory.ptr == NULL)
-			return (NULL);
+static void
+compat_chunk_free(struct tls_chunk *pc)
+{
+	munmap(pc, pc->size + sizeof(*pc));
+}
+
+/*
+ * Unmap all chunks, including the one kept between calls, when a
+ * thread which used the arena exits.
+ */
+static void
+compat_tls_destroy(void *arg)
+{
+	struct tls_memory *ptm = arg;
+	struct tls_chunk *pc;
+	struct tls_chunk *next;
+
+	for (pc = ptm->first; pc != NULL; pc = next) {
+		next = pc->next;
+		compat_chunk_free(pc);
 	}
+	ptm->first = NULL;
+	ptm->last = NULL;
+}
 
-	rem = WEBCAMD_USER_ALLOC_MAX - linux_tls_memory.offset;
-	if (len > rem)
+static void
+compat_tls_init(void)
+{
+	pthread_key_create(&linux_tls_key, &compat_tls_destroy);
+}
+
+void *
+compat_alloc_user_space(unsigned long len)
+{
+	struct tls_chunk *pc;
+	unsigned long size;
+	uint8_t *ptr;
+
+	if (in_compat_syscall() == 0)
 		return (NULL);
 
-	/* zero memory */
-	memset((uint8_t *)linux_tls_memory.ptr + linux_tls_memory.offset, 0, len);
+	/* the length must not wrap to zero when aligned */
+	if (len > ULONG_MAX - (WEBCAMD_USER_ALLOC_ALIGN - 1))
+		return (NULL);
 
-	/* compute fake user-space pointer */
-	ptr = (void *)(linux_tls_memory.offset + WEBCAMD_USER_ALLOC_ADDR);
+	/*
+	 * A zero length request returns a valid pointer into the
+	 * arena, which must not be dereferenced. NULL would be seen
+	 * as a failure by the callers.
+	 */
+	len = ALIGN(len, WEBCAMD_USER_ALLOC_ALIGN);
 
-	/* allocate the memory */
-	linux_tls_memory.offset += len;
+	pc = linux_tls_memory.last;
+	if (pc == NULL || len > pc->size - pc->offset) {
+		size = WEBCAMD_USER_ALLOC_MIN;
+		if (pc != NULL && size < 2 * pc->size)
+			size = 2 * pc->size;
+		if (size < len)
+			size = len;
+		pc = compat_chunk_alloc(size);
+		if (pc == NULL)
+			return (NULL);
+		if (linux_tls_memory.last != NULL) {
+			linux_tls_memory.last->next = pc;
+		} else {
+			pthread_once(&linux_tls_once, &compat_tls_init);
+			pthread_setspecific(linux_tls_key, &linux_tls_memory);
+			linux_tls_memory.first = pc;
+		}
+		linux_tls_memory.last = pc;
+	}
+	ptr = (uint8_t *)(pc + 1) + pc->offset;
+
+	/* only memory used since the chunk was mapped needs zeroing */
+	if (pc->offset < pc->dirty) {
+		size = pc->dirty - pc->offset;
+		memset(ptr, 0, (size < len) ? size : len);
+	}
+	pc->offset += len;
+	if (pc->dirty < pc->offset)
+		pc->dirty = pc->offset;
 
 	return (ptr);
 }
@@ -77,40 +178,68 @@ compat_alloc_user_space(unsigned long len)
 void
 compat_free_all_user_space(void)
 {
+	struct tls_chunk *pc;
+	struct tls_chunk *next;
+	struct tls_chunk *keep;
 
-	free(linux_tls_memory.ptr);
-	linux_tls_memory.ptr = NULL;
+	/*
+	 * Keep the most recent, and thus largest, chunk unless it
+	 * has grown beyond the retention limit:
+	 */
+	keep = linux_tls_memory.last;
+	if (keep != NULL && keep->size > WEBCAMD_USER_ALLOC_KEEP)
+		keep = NULL;
+
+	for (pc = linux_tls_memory.first; pc != NULL; pc = next) {
+		next = pc->next;
+		if (pc != keep)
+			compat_chunk_free(pc);
+	}
+	if (keep != NULL) {
+		keep->next = NULL;
+		keep->offset = 0;
+	}
+	linux_tls_memory.first = keep;
+	linux_tls_memory.last = keep;
+}
+
+/*
+ * Returns true if the given range is fully inside the allocated part
+ * of one of the chunks belonging to the current thread.
+ */
+static bool
+compat_user_space_valid(const void *uptr, unsigned long len)
+{
+	struct tls_chunk *pc;
+	uintptr_t off;
+
+	for (pc = linux_tls_memory.first; pc != NULL; pc = pc->next) {
+		off = (uintptr_t)uptr - (uintptr_t)(pc + 1);
+		if (off <= pc->offset && len <= pc->offset - off)
+			return (true);
+	}
+	return (false);
 }
 
 int
 compat_copy_to_user(void *to, const void *from, unsigned long len)
 {
 
-	if (len > WEBCAMD_USER_ALLOC_MAX ||
-	    (uintptr_t)to < WEBCAMD_USER_ALLOC_ADDR ||
-	    ((uintptr_t)to + len) > (WEBCAMD_USER_ALLOC_ADDR + WEBCAMD_USER_ALLOC_MAX) ||
-	    linux_tls_memory.ptr == NULL)
+	if (!compat_user_space_valid(to, len))
 		return (-ERANGE);
 
-	memcpy((void *)((uintptr_t)linux_tls_memory.ptr +
-			(uintptr_t)to - WEBCAMD_USER_ALLOC_ADDR), from, len);
+	memcpy(to, from, len);
 	return (0);
-
 }
 
 int
 compat_copy_from_user(void *to, const void *from, unsigned long len)
 {
 
-	if (len > WEBCAMD_USER_ALLOC_MAX ||
-	    (uintptr_t)from < WEBCAMD_USER_ALLOC_ADDR ||
-	    ((uintptr_t)from + len) > (WEBCAMD_USER_ALLOC_ADDR + WEBCAMD_USER_ALLOC_MAX) ||
-	    linux_tls_memory.ptr == NULL)
+	if (!compat_user_space_valid(from, len))
 		return (-ERANGE);
 
-	memcpy(to,
-	       (const void *)((uintptr_t)linux_tls_memory.ptr +
-			      (uintptr_t)from - WEBCAMD_USER_ALLOC_ADDR), len);
+	memcpy(to, from, len);
 	return (0);
 }
 
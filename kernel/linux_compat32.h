@@ -88,7 +88,7 @@ extern bool in_compat_syscall(void);
 
 /*
  * Allocate zeroed memory which is automatically freed when the compat
- * IOCTL(2) handler returns:
+ * IOCTL(2) handler returns. There is no upper size limit:
  */
 extern void *compat_alloc_user_space(unsigned long len);
 
@@ -234,27 +234,26 @@
 #define	notice(fmt, ...) printk("NOTICE: " fmt "\n",## __VA_ARGS__)
 #define	kmem_cache_create(desc,size,align,arg,fn) ((struct kmem_cache *)(size))
 #define	kmem_cache_destroy(...) __nop
-#define	kmem_cache_free(ref,ptr) free(GP_DECONST(ptr))
+#define	kmem_cache_free(ref,ptr) kfree(ptr)
 #define	kmem_cache_alloc(ref,g) kmalloc((long)(ref), g)
 #define	kmem_cache_zalloc(ref,g) kmalloc((long)(ref), (g) | __GFP_ZERO)
 #define	kvmalloc(size,flags) kmalloc(size, flags)
 #define	kvmalloc_array(n,s,flags) kmalloc_array(n,s,flags)
 #define	kvzalloc(s,flags) kmalloc(s, (flags) | __GFP_ZERO)
-#define	kvfree(ptr) free(ptr)
+#define	kvfree(ptr) kfree(ptr)
 #define	kzalloc(s,opt) kmalloc(s, (opt) | __GFP_ZERO)
-#define	krealloc(p,s,opt) realloc(p, (s))
 #define	dma_alloc_coherent(d,s,h,g) kmalloc(s, (g) | __GFP_ZERO)
-#define	dma_free_coherent(d,s,v,h) free(GP_DECONST(v))
+#define	dma_free_coherent(d,s,v,h) kfree(v)
 #define	dma_map_single(...) 0
 #define	dma_unmap_single(...) __nop
 #define	dma_mapping_error(...) 0
 #define	dma_sync_single_for_device(...) __nop
-#define	vmalloc_32_user(s) malloc_vm(s)
-#define	vmalloc_user(s) malloc_vm(s)
+#define	vmalloc_32_user(s) malloc_vm_zero(s)
+#define	vmalloc_user(s) malloc_vm_zero(s)
 #define	vmalloc_32(s) malloc_vm(s)
 #define	vmalloc_to_page(x) ((struct page *)(x))	/* HACK */
 #define	vmalloc_to_pfn(x) ((unsigned long)(x))	/* HACK */
-#define	alloc_page(...) malloc_vm(PAGE_SIZE)
+#define	alloc_page(...) malloc_vm_zero(PAGE_SIZE)
 #define	page_address(x) ((void *)(x))	/* HACK */
 #define	virt_to_page(x) ((struct page *)(((uintptr_t)(x)) & PAGE_MASK))	/* HACK */
 #define	offset_in_page(x) (((uintptr_t)(x)) & (PAGE_SIZE - 1))
@@ -275,8 +274,7 @@
 #define	kobject_uevent(...) __nop
 #define	kobject_uevent_env(...) (int)0
 #define	vfree(ptr) free_vm(ptr)
-#define	kfree(ptr) free(GP_DECONST(ptr))
-#define	kfree_const(ptr) free(GP_DECONST(ptr))
+#define	kfree_const(ptr) kfree(ptr)
 #define	kstrdup(a,b) strdup(a)
 #define	kstrdup_const(a,b) strdup(a)
 #define	might_sleep(x) __nop
@@ -334,12 +332,14 @@
 #define	BIT_WORD(nr) ((nr) / BITS_PER_LONG)
 #define	BITS_PER_BYTE 8
 #define	for_each_set_bit(b, addr, size) \
-    for ((b) = 0; (b) < (size); (b)++) \
-	if ((addr)[(b) / BITS_PER_LONG] & BIT((b) % BITS_PER_LONG))
+    for ((b) = find_next_bit((addr), (size), 0); (b) < (size); \
+	 (b) = find_next_bit((addr), (size), (b) + 1))
 #define	for_each_set_bit_from(b, addr, size) \
-    for ( ; (b) < (size); (b)++) \
-	if ((addr)[(b) / BITS_PER_LONG] & BIT((b) % BITS_PER_LONG))
+    for ((b) = find_next_bit((addr), (size), (b)); (b) < (size); \
+	 (b) = find_next_bit((addr), (size), (b) + 1))
 #define	BITS_TO_LONGS(n) (((n) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+#define	BITMAP_FIRST_WORD_MASK(start) (~0UL << ((start) & (BITS_PER_LONG - 1)))
+#define	BITMAP_LAST_WORD_MASK(nbits) (~0UL >> (-(nbits) & (BITS_PER_LONG - 1)))
 #define	BIT(n) (1UL << (n))
 #define	BIT_ULL(n) (1ULL << (n))
 #define	KERNEL_VERSION(a,b,c) (((a) << 16) + ((b) << 8) + (c))
@@ -28,6 +28,28 @@
 
 #include <cuse.h>
 
+/*
+ * Open file handles and per operation counters, reported by the
+ * control socket. The counters are updated without the atomic lock.
+ */
+static TAILQ_HEAD(, cdev_handle) linux_file_head =
+    TAILQ_HEAD_INITIALIZER(linux_file_head);
+
+static struct {
+	uint64_t opens;
+	uint64_t closes;
+	uint64_t open_errors;
+	struct cdev_handle_stats ops;
+}	linux_file_totals;
+
+#define	linux_file_count(var, n) \
+	__atomic_fetch_add(&(var), (n), __ATOMIC_RELAXED)
+
+#define	linux_file_stat(handle, field, n) do {			\
+	linux_file_count((handle)->stats.field, (n));		\
+	linux_file_count(linux_file_totals.ops.field, (n));	\
+} while (0)
+
 struct cdev_handle *
 linux_open(int f_v4b, int fflags)
 {
@@ -36,11 +58,11 @@ linux_open(int f_v4b, int fflags)
 	int error;
 
 	if (cdev == NULL)
-		return (NULL);
+		goto failure;
 
 	handle = malloc(sizeof(*handle));
 	if (handle == NULL)
-		return (NULL);
+		goto failure;
 
 	memset(handle, 0, sizeof(*handle));
 
@@ -50,15 +72,23 @@ linux_open(int f_v4b, int fflags)
 	handle->fixed_file.f_path.dentry = &handle->fixed_dentry;
 	handle->fixed_inode.d_inode = cdev_get_mm(f_v4b);
 	handle->fixed_inode.i_cdev = cdev;
+	handle->open_jiffies = jiffies;
+	handle->f_v4b = f_v4b;
 
-	if (cdev->ops->open == NULL)
-		return (handle);
-
-	if ((error = -cdev->ops->open(&handle->fixed_inode, &handle->fixed_file))) {
+	if (cdev->ops->open != NULL &&
+	    (error = -cdev->ops->open(&handle->fixed_inode, &handle->fixed_file))) {
 		free(handle);
-		return (NULL);
+		goto failure;
 	}
+	atomic_lock();
+	TAILQ_INSERT_TAIL(&linux_file_head, handle, entry);
+	linux_file_totals.opens++;
+	atomic_unlock();
 	return (handle);
+
+failure:
+	linux_file_count(linux_file_totals.open_errors, 1);
+	return (NULL);
 }
 
 int
@@ -70,6 +100,11 @@ linux_close(struct cdev_handle *handle)
 	if (handle == NULL)
 		return (0);
 
+	atomic_lock();
+	TAILQ_REMOVE(&linux_file_head, handle, entry);
+	linux_file_totals.closes++;
+	atomic_unlock();
+
 	/* release all memory mapped regions */
 	for (i = 0; i != LINUX_VMA_MAX; i++) {
 		if (handle->fixed_vma[i].vm_buffer_address == NULL)
@@ -131,6 +166,9 @@ linux_ioctl(struct cdev_handle *handle, int fflags,
 	if (handle == NULL)
 		goto done;
 
+	linux_file_stat(handle, ioctls, 1);
+	handle->last_ioctl = cmd;
+
 	/*
 	 * Copy in the _IOWINT parameter and pass it as arg pointer
 	 * similar to what Linux is doing:
@@ -161,6 +199,8 @@ linux_ioctl(struct cdev_handle *handle, int fflags,
 		retval = handle->fixed_file.f_op->ioctl(&handle->fixed_inode,
 		    &handle->fixed_file, cmd, (long)arg);
 	}
+	if (retval < 0)
+		linux_file_stat(handle, errors, 1);
 done:
 	return (retval);
 }
@@ -176,6 +216,8 @@ linux_poll(struct cdev_handle *handle)
 	if (handle->fixed_file.f_op->poll == NULL)
 		return (POLLNVAL);
 
+	linux_file_stat(handle, polls, 1);
+
 	error = handle->fixed_file.f_op->poll(&handle->fixed_file, NULL);
 
 	return (error);
@@ -207,6 +249,12 @@ linux_read(struct cdev_handle *handle, int fflags, char *ptr, size_t len)
 		error = handle->fixed_file.f_op->read(&handle->fixed_file, ptr, len, &off);
 	}
 
+	linux_file_stat(handle, reads, 1);
+	if (error > 0)
+		linux_file_stat(handle, read_bytes, error);
+	else if (error < 0 && error != -EWOULDBLOCK)
+		linux_file_stat(handle, errors, 1);
+
 	return (error);
 }
 
@@ -236,6 +284,12 @@ linux_write(struct cdev_handle *handle, int fflags, char *ptr, size_t len)
 		error = handle->fixed_file.f_op->write(&handle->fixed_file, ptr, len, &off);
 	}
 
+	linux_file_stat(handle, writes, 1);
+	if (error > 0)
+		linux_file_stat(handle, write_bytes, error);
+	else if (error < 0 && error != -EWOULDBLOCK)
+		linux_file_stat(handle, errors, 1);
+
 	return (error);
 }
 
@@ -296,8 +350,11 @@ linux_mmap(struct cdev_handle *handle, int fflags,
 	handle->fixed_vma[i].vm_buffer_address = MAP_FAILED;
 	handle->fixed_vma[i].vm_flags = (VM_WRITE | VM_READ | VM_SHARED);
 
+	linux_file_stat(handle, mmaps, 1);
+
 	err = handle->fixed_file.f_op->mmap(&handle->fixed_file, &handle->fixed_vma[i]);
 	if (err) {
+		linux_file_stat(handle, errors, 1);
 		handle->fixed_vma[i].vm_buffer_address = MAP_FAILED;
 		return (MAP_FAILED);
 	}
@@ -364,3 +421,50 @@ compat_ptr_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	return file->f_op->unlocked_ioctl(file, cmd, (unsigned long)(uint32_t)(arg));
 }
 
+static void
+linux_file_stats_json_sub(FILE *fp, const struct cdev_handle_stats *st)
+{
+	fprintf(fp, "\"reads\":%ju,\"writes\":%ju,\"ioctls\":%ju,"
+	    "\"polls\":%ju,\"mmaps\":%ju,\"errors\":%ju,"
+	    "\"read_bytes\":%ju,\"write_bytes\":%ju",
+	    (uintmax_t)st->reads, (uintmax_t)st->writes,
+	    (uintmax_t)st->ioctls, (uintmax_t)st->polls,
+	    (uintmax_t)st->mmaps, (uintmax_t)st->errors,
+	    (uintmax_t)st->read_bytes, (uintmax_t)st->write_bytes);
+}
+
+void
+linux_file_stats_json(FILE *fp)
+{
+	struct cdev_handle *handle;
+	const char *sep = "";
+	uint64_t now = jiffies;
+
+	fprintf(fp, "[");
+	atomic_lock();
+	TAILQ_FOREACH(handle, &linux_file_head, entry) {
+		fprintf(fp, "%s{\"minor\":%d,\"flags\":%d,\"age_ms\":%ju,"
+		    "\"last_ioctl\":%u,", sep, handle->f_v4b,
+		    handle->fixed_file.f_flags,
+		    (uintmax_t)jiffies_to_msecs(now - handle->open_jiffies),
+		    handle->last_ioctl);
+		linux_file_stats_json_sub(fp, &handle->stats);
+		fprintf(fp, "}");
+		sep = ",";
+	}
+	atomic_unlock();
+	fprintf(fp, "]");
+}
+
+void
+linux_file_totals_json(FILE *fp)
+{
+	atomic_lock();
+	fprintf(fp, "{\"opens\":%ju,\"closes\":%ju,\"open_errors\":%ju,",
+	    (uintmax_t)linux_file_totals.opens,
+	    (uintmax_t)linux_file_totals.closes,
+	    (uintmax_t)linux_file_totals.open_errors);
+	linux_file_stats_json_sub(fp, &linux_file_totals.ops);
+	fprintf(fp, "}");
+	atomic_unlock();
+}
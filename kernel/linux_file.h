@@ -33,6 +33,8 @@ ssize_t	linux_read(struct cdev_handle *, int fflags, char *ptr, size_t len);
 ssize_t	linux_write(struct cdev_handle *, int fflags, char *ptr, size_t len);
 void   *linux_mmap(struct cdev_handle *, int fflags, uint8_t *addr, size_t len, off_t offset);
 int	linux_poll(struct cdev_handle *);
+void	linux_file_stats_json(FILE *);
+void	linux_file_totals_json(FILE *);
 int	linux_get_user_pages(unsigned long start, int npages, int write, int force, struct page **ppages, struct vm_area_struct **pvm);
 
 struct cdev_handle *get_current_cdev_handle(void);
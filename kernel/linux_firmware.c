@@ -23,26 +23,115 @@
  * SUCH DAMAGE.
  */
 
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_FIRMWARE_GZ
+#include <zlib.h>
+#endif
+#ifdef HAVE_FIRMWARE_XZ
+#include <lzma.h>
+#endif
+#ifdef HAVE_FIRMWARE_ZSTD
+#include <zstd.h>
+#endif
+
 extern char global_fw_prefix[];
 
 #define	FW_DECONST(ptr) ((void *)(long)(ptr))
 
+/*
+ * Firmware images are cached by name and shared between all users
+ * inside the daemon. The image itself is mapped read-only from the
+ * firmware file, so that the pages are shared with the file cache and
+ * with other daemons loading the same firmware. Images which are no
+ * longer referenced stay cached in least recently used order, until
+ * they exceed FW_CACHE_UNUSED_MAX bytes or the firmware requests are
+ * flushed.
+ */
+struct firmware_cache {
+	struct firmware fw;		/* must be first */
+	TAILQ_ENTRY(firmware_cache) entry;
+	size_t	map_size;
+	int	refs;
+	char	name[0];
+};
+
+TAILQ_HEAD(firmware_cache_head, firmware_cache);
+
+#define	FW_CACHE_UNUSED_MAX (16 * 1024 * 1024)
+
+static struct firmware_cache_head firmware_cache_head =
+    TAILQ_HEAD_INITIALIZER(firmware_cache_head);
+static size_t firmware_cache_unused;
+
+static void firmware_cache_evict(size_t, struct firmware_cache_head *);
+static void firmware_cache_free_list(struct firmware_cache_head *);
+
+#define	FW_LOADER_MAX 4
+
+/*
+ * Asynchronous firmware requests are executed by a small pool of
+ * loader threads, so that the probe of multiple sub-devices can
+ * overlap the firmware I/O.
+ */
 struct firmware_cb_arg {
-	const struct firmware *pfw;
+	TAILQ_ENTRY(firmware_cb_arg) entry;
+	struct device *device;
 	firmware_cb_t *pfunc;
 	void   *ctx;
+	char	name[0];
 };
 
-static int
-request_firmware_nowait_task(void *arg)
+static TAILQ_HEAD(, firmware_cb_arg) firmware_load_head =
+    TAILQ_HEAD_INITIALIZER(firmware_load_head);
+static pthread_cond_t firmware_load_cond;
+static pthread_cond_t firmware_flush_cond;
+static int firmware_load_threads;
+static int firmware_load_idle;
+static int firmware_load_busy;
+
+static void *
+firmware_load_exec(void *arg)
 {
-	struct firmware_cb_arg *pfcbarg = arg;
+	struct firmware_cb_arg *pfcbarg;
+	const struct firmware *fw;
 
-	(pfcbarg->pfunc) (pfcbarg->pfw, pfcbarg->ctx);
+	thread_stats_register("firmware");
 
-	free(pfcbarg);
+	atomic_lock();
+	while (1) {
+		pfcbarg = TAILQ_FIRST(&firmware_load_head);
+		if (pfcbarg != NULL) {
+			TAILQ_REMOVE(&firmware_load_head, pfcbarg, entry);
+			firmware_load_busy++;
+			atomic_unlock();
 
-	return (0);
+			if (request_firmware(&fw, pfcbarg->name,
+			    pfcbarg->device) != 0)
+				fw = NULL;
+
+			(pfcbarg->pfunc) (fw, pfcbarg->ctx);
+
+			free(pfcbarg);
+
+			atomic_lock();
+			firmware_load_busy--;
+			if (firmware_load_busy == 0 &&
+			    TAILQ_FIRST(&firmware_load_head) == NULL)
+				pthread_cond_broadcast(&firmware_flush_cond);
+		} else {
+			firmware_load_idle++;
+			atomic_pre_sleep();
+			pthread_cond_wait(&firmware_load_cond, atomic_get_lock());
+			atomic_post_sleep();
+			firmware_load_idle--;
+		}
+	}
+	atomic_unlock();
+
+	thread_stats_unregister();
+	return (NULL);
 }
 
 int
@@ -50,90 +139,552 @@ request_firmware_nowait(struct module *module, bool uevent,
     const char *name, struct device *device, gfp_t gfp, void *context,
     firmware_cb_t *pfunc)
 {
-	int error;
 	struct firmware_cb_arg *pfcbarg;
-	struct task_struct *task;
+	pthread_t dummy;
+	size_t len;
+	int error;
 
-	if (pfunc == NULL)
+	if (pfunc == NULL || name == NULL)
 		return (-EINVAL);
 
-	pfcbarg = malloc(sizeof(*pfcbarg));
+	len = strlen(name) + 1;
+
+	pfcbarg = malloc(sizeof(*pfcbarg) + len);
 	if (pfcbarg == NULL)
 		return (-ENOMEM);
 
-	pfcbarg->pfw = NULL;
+	pfcbarg->device = device;
 	pfcbarg->pfunc = pfunc;
 	pfcbarg->ctx = context;
+	memcpy(pfcbarg->name, name, len);
 
-	error = request_firmware(&pfcbarg->pfw, name, device);
-	if (error) {
-		free(pfcbarg);
-		return (error);
+	error = 0;
+
+	atomic_lock();
+	if (firmware_load_idle == 0 &&
+	    firmware_load_threads != FW_LOADER_MAX) {
+		if (pthread_create(&dummy, NULL, firmware_load_exec, NULL) == 0) {
+			pthread_detach(dummy);
+			firmware_load_threads++;
+		} else if (firmware_load_threads == 0) {
+			error = -ENOMEM;
+		}
 	}
-	task = kthread_run(&request_firmware_nowait_task,
-	    pfcbarg, "ASYNC FW LOAD");
+	if (error == 0) {
+		TAILQ_INSERT_TAIL(&firmware_load_head, pfcbarg, entry);
+		pthread_cond_signal(&firmware_load_cond);
+	}
+	atomic_unlock();
 
-	if (IS_ERR(task)) {
-		release_firmware(pfcbarg->pfw);
+	if (error != 0)
 		free(pfcbarg);
-		return (PTR_ERR(task));
+
+	return (error);
+}
+
+void
+flush_firmware_requests(void)
+{
+	struct firmware_cache_head head = TAILQ_HEAD_INITIALIZER(head);
+	uint32_t drops;
+
+	atomic_lock();
+	while (firmware_load_busy != 0 ||
+	    TAILQ_FIRST(&firmware_load_head) != NULL) {
+		drops = atomic_drop();
+		atomic_pre_sleep();
+		pthread_cond_wait(&firmware_flush_cond, atomic_get_lock());
+		atomic_post_sleep();
+		atomic_pickup(drops);
 	}
+	/* all pending loads are done, drop the unused images */
+	firmware_cache_evict(0, &head);
+	atomic_unlock();
+
+	firmware_cache_free_list(&head);
+}
+
+static int
+firmware_init(void)
+{
+	pthread_cond_init(&firmware_load_cond, NULL);
+	pthread_cond_init(&firmware_flush_cond, NULL);
 	return (0);
 }
 
-int
-request_firmware(const struct firmware **ppfw, const char *name,
-    struct device *device)
+module_init(firmware_init);
+
+static struct firmware_cache *
+firmware_cache_lookup(const char *name)
 {
-	struct firmware *fw;
-	ssize_t size;
-	char path[256];
-	int f;
+	struct firmware_cache *pfc;
 
-	*ppfw = NULL;
+	TAILQ_FOREACH(pfc, &firmware_cache_head, entry) {
+		if (strcmp(pfc->name, name) == 0)
+			return (pfc);
+	}
+	return (NULL);
+}
+
+static void
+firmware_cache_free(struct firmware_cache *pfc)
+{
+	if (pfc->map_size != 0)
+		munmap(FW_DECONST(pfc->fw.data), pfc->map_size);
+	free(pfc);
+}
+
+/*
+ * Get a reference to a cached image. The atomic lock must be held.
+ */
+static void
+firmware_cache_ref(struct firmware_cache *pfc)
+{
+	if (pfc->refs++ == 0)
+		firmware_cache_unused -= pfc->map_size;
+}
+
+/*
+ * Move the least recently used images without references to the
+ * given list, until the unused images take at most "limit" bytes.
+ * The atomic lock must be held. The images are freed by the caller
+ * after the lock is dropped.
+ */
+static void
+firmware_cache_evict(size_t limit, struct firmware_cache_head *phead)
+{
+	struct firmware_cache *pfc;
+	struct firmware_cache *pfc_next;
+
+	for (pfc = TAILQ_FIRST(&firmware_cache_head);
+	    pfc != NULL && firmware_cache_unused > limit; pfc = pfc_next) {
+		pfc_next = TAILQ_NEXT(pfc, entry);
+		if (pfc->refs != 0)
+			continue;
+		TAILQ_REMOVE(&firmware_cache_head, pfc, entry);
+		TAILQ_INSERT_TAIL(phead, pfc, entry);
+		firmware_cache_unused -= pfc->map_size;
+	}
+}
+
+static void
+firmware_cache_free_list(struct firmware_cache_head *phead)
+{
+	struct firmware_cache *pfc;
+
+	while ((pfc = TAILQ_FIRST(phead)) != NULL) {
+		TAILQ_REMOVE(phead, pfc, entry);
+		firmware_cache_free(pfc);
+	}
+}
+
+/*
+ * Compressed firmware images are decoded directly into an anonymous
+ * mapping, which then becomes the firmware data. When the decoded
+ * size is known from the compressed image, the buffer is allocated
+ * once. Else the buffer is grown as needed.
+ */
+struct firmware_buf {
+	uint8_t *ptr;
+	size_t	size;
+	size_t	used;
+};
 
-	fw = malloc(sizeof(*fw));
+typedef int (firmware_decode_t)(struct firmware_buf *, const uint8_t *, size_t);
 
-	memset(fw, 0, sizeof(*fw));
+#if defined(HAVE_FIRMWARE_GZ) || defined(HAVE_FIRMWARE_XZ) || \
+    defined(HAVE_FIRMWARE_ZSTD)
+static int
+firmware_buf_alloc(struct firmware_buf *pbuf, size_t size)
+{
+	void *ptr;
 
-	if (fw == NULL) {
+	/* allow the decoder to detect the end of the stream */
+	size++;
+
+	ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+	    MAP_PRIVATE | MAP_ANON, -1, 0);
+	if (ptr == MAP_FAILED)
 		return (-ENOMEM);
+
+	if (pbuf->ptr != NULL) {
+		memcpy(ptr, pbuf->ptr, pbuf->used);
+		munmap(pbuf->ptr, pbuf->size);
 	}
-	snprintf(path, sizeof(path), "%s/%s", global_fw_prefix, name);
+	pbuf->ptr = ptr;
+	pbuf->size = size;
+	return (0);
+}
 
-	f = open(path, O_RDONLY);
+static int
+firmware_buf_grow(struct firmware_buf *pbuf)
+{
+	return (firmware_buf_alloc(pbuf, 2 * pbuf->size));
+}
+#endif
 
-	printf("Loading firmware at '%s', f=%d\n", path, f);
+#ifdef HAVE_FIRMWARE_GZ
+static int
+firmware_decode_gz(struct firmware_buf *pbuf, const uint8_t *src, size_t len)
+{
+	z_stream zs;
+	size_t size;
+	int error;
+	int ret;
 
-	if (f < 0) {
-		free(fw);
+	if (len < 18)
 		return (-EINVAL);
+
+	/* the trailer contains the decoded size modulo 4GBytes */
+	size = src[len - 4] | (src[len - 3] << 8) |
+	    (src[len - 2] << 16) | ((size_t)src[len - 1] << 24);
+
+	error = firmware_buf_alloc(pbuf, size);
+	if (error)
+		return (error);
+
+	memset(&zs, 0, sizeof(zs));
+
+	if (inflateInit2(&zs, 15 + 16) != Z_OK)
+		return (-ENOMEM);
+
+	zs.next_in = FW_DECONST(src);
+	zs.avail_in = len;
+
+	while (1) {
+		zs.next_out = pbuf->ptr + pbuf->used;
+		zs.avail_out = pbuf->size - pbuf->used;
+
+		ret = inflate(&zs, Z_NO_FLUSH);
+
+		pbuf->used = pbuf->size - zs.avail_out;
+
+		if (ret == Z_STREAM_END) {
+			/* check for concatenated members */
+			if (zs.avail_in == 0)
+				break;
+			ret = inflateReset(&zs);
+		} else if (ret == Z_BUF_ERROR && zs.avail_out == 0) {
+			error = firmware_buf_grow(pbuf);
+			if (error)
+				break;
+			ret = Z_OK;
+		}
+		if (ret != Z_OK) {
+			error = -EINVAL;
+			break;
+		}
 	}
-	size = lseek(f, 0, SEEK_END);
-	if (size < 0) {
-		free(fw);
-		close(f);
+	inflateEnd(&zs);
+	return (error);
+}
+#endif
+
+#ifdef HAVE_FIRMWARE_XZ
+static int
+firmware_decode_xz(struct firmware_buf *pbuf, const uint8_t *src, size_t len)
+{
+	lzma_stream strm = LZMA_STREAM_INIT;
+	lzma_stream_flags flags;
+	lzma_index *idx;
+	uint64_t memlimit;
+	size_t size;
+	size_t pos;
+	int error;
+	lzma_ret ret;
+
+	if (len < (2 * LZMA_STREAM_HEADER_SIZE))
 		return (-EINVAL);
+
+	/* get the decoded size from the stream index, if possible */
+	size = 4 * len;
+
+	if (lzma_stream_footer_decode(&flags,
+	    src + len - LZMA_STREAM_HEADER_SIZE) == LZMA_OK &&
+	    flags.backward_size <= (len - (2 * LZMA_STREAM_HEADER_SIZE))) {
+		memlimit = UINT64_MAX;
+		pos = 0;
+		if (lzma_index_buffer_decode(&idx, &memlimit, NULL,
+		    src + len - LZMA_STREAM_HEADER_SIZE - flags.backward_size,
+		    &pos, flags.backward_size) == LZMA_OK) {
+			size = lzma_index_uncompressed_size(idx);
+			lzma_index_end(idx, NULL);
+		}
 	}
-	lseek(f, 0, SEEK_SET);
 
-	fw->size = size;
-	fw->data = malloc(size);
+	error = firmware_buf_alloc(pbuf, size);
+	if (error)
+		return (error);
 
-	if (fw->data == NULL) {
-		free(fw);
-		close(f);
+	if (lzma_stream_decoder(&strm, UINT64_MAX, LZMA_CONCATENATED) != LZMA_OK)
 		return (-ENOMEM);
+
+	strm.next_in = src;
+	strm.avail_in = len;
+
+	while (1) {
+		strm.next_out = pbuf->ptr + pbuf->used;
+		strm.avail_out = pbuf->size - pbuf->used;
+
+		ret = lzma_code(&strm, LZMA_FINISH);
+
+		pbuf->used = pbuf->size - strm.avail_out;
+
+		if (ret == LZMA_STREAM_END) {
+			break;
+		} else if (ret == LZMA_BUF_ERROR && strm.avail_out == 0) {
+			error = firmware_buf_grow(pbuf);
+			if (error)
+				break;
+		} else if (ret != LZMA_OK) {
+			error = -EINVAL;
+			break;
+		}
 	}
-	if (read(f, FW_DECONST(fw->data), fw->size) != fw->size) {
-		free(FW_DECONST(fw->data));
-		free(fw);
+	lzma_end(&strm);
+	return (error);
+}
+#endif
+
+#ifdef HAVE_FIRMWARE_ZSTD
+static int
+firmware_decode_zst(struct firmware_buf *pbuf, const uint8_t *src, size_t len)
+{
+	ZSTD_DStream *pds;
+	ZSTD_inBuffer in;
+	ZSTD_outBuffer out;
+	unsigned long long size;
+	size_t ret;
+	int error;
+
+	size = ZSTD_getFrameContentSize(src, len);
+	if (size == ZSTD_CONTENTSIZE_ERROR)
+		return (-EINVAL);
+	if (size == ZSTD_CONTENTSIZE_UNKNOWN)
+		size = 4 * len;
+
+	error = firmware_buf_alloc(pbuf, size);
+	if (error)
+		return (error);
+
+	pds = ZSTD_createDStream();
+	if (pds == NULL)
+		return (-ENOMEM);
+
+	in.src = src;
+	in.size = len;
+	in.pos = 0;
+
+	while (1) {
+		out.dst = pbuf->ptr;
+		out.size = pbuf->size;
+		out.pos = pbuf->used;
+
+		ret = ZSTD_decompressStream(pds, &out, &in);
+
+		pbuf->used = out.pos;
+
+		if (ZSTD_isError(ret)) {
+			error = -EINVAL;
+			break;
+		} else if (ret == 0 && in.pos == in.size) {
+			break;
+		} else if (out.pos == out.size) {
+			error = firmware_buf_grow(pbuf);
+			if (error)
+				break;
+		} else if (in.pos == in.size) {
+			/* truncated image */
+			error = -EINVAL;
+			break;
+		}
+	}
+	ZSTD_freeDStream(pds);
+	return (error);
+}
+#endif
+
+static const struct firmware_format {
+	const char *suffix;
+	firmware_decode_t *decode;
+} firmware_formats[] = {
+	{ "", NULL },
+#ifdef HAVE_FIRMWARE_ZSTD
+	{ ".zst", &firmware_decode_zst },
+#endif
+#ifdef HAVE_FIRMWARE_XZ
+	{ ".xz", &firmware_decode_xz },
+#endif
+#ifdef HAVE_FIRMWARE_GZ
+	{ ".gz", &firmware_decode_gz },
+#endif
+};
+
+static int
+firmware_cache_decode(struct firmware_cache *pfc, firmware_decode_t *decode,
+    const uint8_t *src, size_t len)
+{
+	struct firmware_buf buf = {};
+	int error;
+
+	error = decode(&buf, src, len);
+	if (error != 0) {
+		if (buf.ptr != NULL)
+			munmap(buf.ptr, buf.size);
+		return (error);
+	}
+	mprotect(buf.ptr, buf.size, PROT_READ);
+
+	pfc->fw.data = buf.ptr;
+	pfc->fw.size = buf.used;
+	pfc->map_size = buf.size;
+	return (0);
+}
+
+static int
+firmware_cache_map(struct firmware_cache *pfc, const char *path,
+    firmware_decode_t *decode)
+{
+	struct stat st;
+	void *ptr;
+	int error;
+	int f;
+
+	f = open(path, O_RDONLY);
+	if (f < 0)
+		return (-ENOENT);
+
+	if (fstat(f, &st) != 0 || !S_ISREG(st.st_mode)) {
 		close(f);
 		return (-EINVAL);
 	}
+	if (st.st_size != 0) {
+		/*
+		 * The mapping stays valid after the file descriptor
+		 * is closed. Firmware files are not expected to be
+		 * truncated while they are in use.
+		 */
+		ptr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, f, 0);
+		if (ptr == MAP_FAILED) {
+			close(f);
+			return (-ENOMEM);
+		}
+	} else {
+		ptr = NULL;
+	}
 	close(f);
 
-	*ppfw = fw;
+	if (decode == NULL) {
+		pfc->fw.data = ptr;
+		pfc->fw.size = st.st_size;
+		pfc->map_size = st.st_size;
+		error = 0;
+	} else {
+		error = firmware_cache_decode(pfc, decode, ptr, st.st_size);
+		if (ptr != NULL)
+			munmap(ptr, st.st_size);
+	}
+	if (error == 0)
+		printf("Loading firmware at '%s'\n", path);
+	else
+		printf("Cannot load firmware at '%s'\n", path);
+
+	return (error);
+}
+
+/*
+ * The firmware prefix can be a colon separated list of directories,
+ * which are searched in order. In each directory the uncompressed
+ * firmware is preferred over the compressed variants.
+ */
+static int
+firmware_cache_search(struct firmware_cache *pfc)
+{
+	const char *ptr;
+	const char *next;
+	char path[256];
+	unsigned int n;
+	int error;
+	int len;
+
+	error = -ENOENT;
+
+	for (ptr = global_fw_prefix; error == -ENOENT; ptr = next + 1) {
+		next = strchr(ptr, ':');
+		if (next == NULL)
+			next = ptr + strlen(ptr);
+		len = next - ptr;
+		for (n = 0; len != 0 && error == -ENOENT &&
+		    n != (sizeof(firmware_formats) / sizeof(firmware_formats[0])); n++) {
+			snprintf(path, sizeof(path), "%.*s/%s%s",
+			    len, ptr, pfc->name, firmware_formats[n].suffix);
+			error = firmware_cache_map(pfc, path,
+			    firmware_formats[n].decode);
+		}
+		if (*next == 0)
+			break;
+	}
+	if (error == -ENOENT) {
+		printf("Firmware '%s' not found in '%s'\n",
+		    pfc->name, global_fw_prefix);
+	}
+	return (error);
+}
+
+int
+request_firmware(const struct firmware **ppfw, const char *name,
+    struct device *device)
+{
+	struct firmware_cache *pfc;
+	struct firmware_cache *pfc_old;
+	size_t len;
+	int error;
+
+	*ppfw = NULL;
+
+	if (name == NULL)
+		return (-EINVAL);
+
+	atomic_lock();
+	pfc = firmware_cache_lookup(name);
+	if (pfc != NULL)
+		firmware_cache_ref(pfc);
+	atomic_unlock();
+
+	if (pfc != NULL) {
+		*ppfw = &pfc->fw;
+		return (0);
+	}
+	len = strlen(name) + 1;
+
+	pfc = malloc(sizeof(*pfc) + len);
+	if (pfc == NULL)
+		return (-ENOMEM);
+
+	memset(pfc, 0, sizeof(*pfc));
+	memcpy(pfc->name, name, len);
+	pfc->refs = 1;
+
+	error = firmware_cache_search(pfc);
+	if (error) {
+		free(pfc);
+		return (error);
+	}
+
+	/* check if somebody else loaded the same firmware meanwhile */
+	atomic_lock();
+	pfc_old = firmware_cache_lookup(name);
+	if (pfc_old != NULL)
+		firmware_cache_ref(pfc_old);
+	else
+		TAILQ_INSERT_TAIL(&firmware_cache_head, pfc, entry);
+	atomic_unlock();
+
+	if (pfc_old != NULL) {
+		firmware_cache_free(pfc);
+		pfc = pfc_old;
+	}
+	*ppfw = &pfc->fw;
 
 	return (0);
 }
@@ -141,11 +692,23 @@ request_firmware(const struct firmware **ppfw, const char *name,
 void
 release_firmware(const struct firmware *fw)
 {
+	struct firmware_cache_head head = TAILQ_HEAD_INITIALIZER(head);
+	struct firmware_cache *pfc;
+
 	if (fw == NULL)
 		return;
 
-	if (fw->data != NULL)
-		free(FW_DECONST(fw->data));
+	pfc = (struct firmware_cache *)FW_DECONST(fw);
+
+	atomic_lock();
+	if (--(pfc->refs) == 0) {
+		/* keep the image, most recently used last */
+		TAILQ_REMOVE(&firmware_cache_head, pfc, entry);
+		TAILQ_INSERT_TAIL(&firmware_cache_head, pfc, entry);
+		firmware_cache_unused += pfc->map_size;
+		firmware_cache_evict(FW_CACHE_UNUSED_MAX, &head);
+	}
+	atomic_unlock();
 
-	free(FW_DECONST(fw));
+	firmware_cache_free_list(&head);
 }
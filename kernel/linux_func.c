@@ -403,7 +403,7 @@ devm_kmalloc_array(struct device *dev,
 void
 devm_kfree(struct device *dev, void *ptr)
 {
-	free(ptr);
+	kfree(ptr);
 }
 
 int
@@ -590,159 +590,6 @@ atomic64_andnot(uint64_t data, atomic64_t *v)
 	atomic_unlock();
 }
 
-int
-test_bit(int nr, const void *addr)
-{
-	unsigned long mask = BIT_MASK(nr);
-	unsigned long *p = ((unsigned long *)addr) + BIT_WORD(nr);
-	int i;
-
-	atomic_lock();
-	i = (*p & mask) ? 1 : 0;
-	atomic_unlock();
-
-	return (i);
-}
-
-int
-test_and_set_bit(int nr, volatile unsigned long *addr)
-{
-	unsigned long mask = BIT_MASK(nr);
-	unsigned long *p = ((unsigned long *)addr) + BIT_WORD(nr);
-	unsigned long old;
-
-	atomic_lock();
-	old = *p;
-	*p = old | mask;
-	atomic_unlock();
-	return (old & mask) != 0;
-}
-
-int
-test_and_clear_bit(int nr, volatile unsigned long *addr)
-{
-	unsigned long mask = BIT_MASK(nr);
-	unsigned long *p = ((unsigned long *)addr) + BIT_WORD(nr);
-	unsigned long old;
-
-	atomic_lock();
-	old = *p;
-	*p = old & ~mask;
-	atomic_unlock();
-
-	return (old & mask) != 0;
-}
-
-void
-set_bit(int nr, volatile unsigned long *addr)
-{
-	unsigned long mask = BIT_MASK(nr);
-	unsigned long *p = ((unsigned long *)addr) + BIT_WORD(nr);
-
-	atomic_lock();
-	*p |= mask;
-	atomic_unlock();
-}
-
-void
-clear_bit(int nr, volatile unsigned long *addr)
-{
-	unsigned long mask = BIT_MASK(nr);
-	unsigned long *p = ((unsigned long *)addr) + BIT_WORD(nr);
-
-	atomic_lock();
-	*p &= ~mask;
-	atomic_unlock();
-}
-
-void
-change_bit(int nr, volatile unsigned long *addr)
-{
-	unsigned long mask = BIT_MASK(nr);
-	unsigned long *p = ((unsigned long *)addr) + BIT_WORD(nr);
-
-	atomic_lock();
-	*p ^= mask;
-	atomic_unlock();
-}
-
-uint8_t
-bitrev8(uint8_t a)
-{
-	a = ((a & 0x55) << 1) | ((a & 0xAA) >> 1);
-	a = ((a & 0x33) << 2) | ((a & 0xCC) >> 2);
-	a = ((a & 0x0F) << 4) | ((a & 0xF0) >> 4);
-	return (a);
-}
-
-uint16_t
-bitrev16(uint16_t a)
-{
-	a = ((a & 0x5555) << 1) | ((a & 0xAAAA) >> 1);
-	a = ((a & 0x3333) << 2) | ((a & 0xCCCC) >> 2);
-	a = ((a & 0x0F0F) << 4) | ((a & 0xF0F0) >> 4);
-	a = ((a & 0x00FF) << 8) | ((a & 0xFF00) >> 8);
-	return (a);
-}
-
-size_t
-memweight(const void *ptr, size_t bytes)
-{
-	size_t x;
-	size_t y;
-
-	for (x = y = 0; x != bytes; x++) {
-		y += hweight8(((uint8_t *)ptr)[x]);
-	}
-	return (y);
-}
-
-unsigned int
-hweight8(unsigned int w)
-{
-	unsigned int res = w - ((w >> 1) & 0x55);
-
-	res = (res & 0x33) + ((res >> 2) & 0x33);
-	return (res + (res >> 4)) & 0x0F;
-}
-
-unsigned int
-hweight16(unsigned int w)
-{
-	unsigned int res = w - ((w >> 1) & 0x5555);
-
-	res = (res & 0x3333) + ((res >> 2) & 0x3333);
-	res = (res + (res >> 4)) & 0x0F0F;
-	return (res + (res >> 8)) & 0x00FF;
-}
-
-unsigned int
-hweight32(unsigned int w)
-{
-	unsigned int res = w - ((w >> 1) & 0x55555555);
-
-	res = (res & 0x33333333) + ((res >> 2) & 0x33333333);
-	res = (res + (res >> 4)) & 0x0F0F0F0F;
-	res = res + (res >> 8);
-	return (res + (res >> 16)) & 0x000000FF;
-}
-
-unsigned long
-hweight64(uint64_t w)
-{
-	if (sizeof(long) == 4) {
-		return (hweight32((unsigned int)(w >> 32)) + hweight32((unsigned int)w));
-	} else {
-		uint64_t res = w - ((w >> 1) & 0x5555555555555555ul);
-
-		res = (res & 0x3333333333333333ul) + ((res >> 2) & 0x3333333333333333ul);
-		res = (res + (res >> 4)) & 0x0F0F0F0F0F0F0F0Ful;
-		res = res + (res >> 8);
-		res = res + (res >> 16);
-		return (res + (res >> 32)) & 0x00000000000000FFul;
-	}
-}
-
 struct cdev *
 cdev_alloc(void)
 {
@@ -770,6 +617,7 @@ done:
 
 static struct cdev *cdev_registry[F_V4B_MAX][SUB_MAX];
 static uint32_t cdev_mm[F_V4B_MAX][SUB_MAX];
+static uint16_t cdev_present[F_V4B_MAX][SUB_MAX];
 
 static int dvb_swap_fe;
 
@@ -779,11 +627,17 @@ static TAILQ_HEAD(, device_driver) device_driver_head = TAILQ_HEAD_INITIALIZER(d
 module_param_named(dvb_swap_fe, dvb_swap_fe, int, 0644);
 MODULE_PARM_DESC(dvb_swap_fe, "swap default DVB frontend, 0..3");
 
-static void
-cdev_set_device(dev_t mm, struct cdev *cdev)
+/*
+ * This function translates a device number into a registry slot.
+ * Returns zero on success, a positive value if the device number
+ * should be silently ignored and a negative value on error.
+ */
+static int
+cdev_get_slot(dev_t mm, uint8_t *pf_v4b, uint8_t *psubdev)
 {
 	uint8_t subdev;
 	uint8_t id;
+	uint8_t f_v4b;
 
 	switch (mm & 0xFFFF0000U) {
 	case MKDEV(INPUT_MAJOR, 0):
@@ -791,17 +645,15 @@ cdev_set_device(dev_t mm, struct cdev *cdev)
 		case EVDEV_MINOR_BASE:
 			subdev = mm & 0x3F;
 			if (subdev >= F_V4B_SUBDEV_MAX)
-				break;
-			cdev_registry[F_V4B_EVDEV][subdev] = cdev;
-			cdev_mm[F_V4B_EVDEV][subdev] = mm;
+				return (1);
+			f_v4b = F_V4B_EVDEV;
 			break;
 
 		case JOYDEV_MINOR_BASE:
 			subdev = mm & 0x3F;
 			if (subdev >= F_V4B_SUBDEV_MAX)
-				break;
-			cdev_registry[F_V4B_JOYDEV][subdev] = cdev;
-			cdev_mm[F_V4B_JOYDEV][subdev] = mm;
+				return (1);
+			f_v4b = F_V4B_JOYDEV;
 			break;
 		default:
 			subdev = 0;
@@ -812,25 +664,22 @@ cdev_set_device(dev_t mm, struct cdev *cdev)
 	case MKDEV(LIRC_MAJOR, 0):
 		subdev = mm & 0xFF;
 		if (subdev >= F_V4B_SUBDEV_MAX)
-			break;
-		cdev_registry[F_V4B_LIRC][subdev] = cdev;
-		cdev_mm[F_V4B_LIRC][subdev] = mm;
+			return (1);
+		f_v4b = F_V4B_LIRC;
 		break;
 
 	case MKDEV(ROCCAT_MAJOR, 0):
 		subdev = mm & 0xFF;
 		if (subdev >= F_V4B_SUBDEV_MAX)
-			break;
-		cdev_registry[F_V4B_ROCCAT][subdev] = cdev;
-		cdev_mm[F_V4B_ROCCAT][subdev] = mm;
+			return (1);
+		f_v4b = F_V4B_ROCCAT;
 		break;
 
 	case MKDEV(VIDEO_MAJOR, 0):
 		subdev = mm & 0xFF;
 		if (subdev >= F_V4B_SUBDEV_MAX)
 			goto error;
-		cdev_registry[F_V4B_VIDEO][subdev] = cdev;
-		cdev_mm[F_V4B_VIDEO][subdev] = mm;
+		f_v4b = F_V4B_VIDEO;
 		break;
 
 	case MKDEV(DVB_MAJOR, 0):
@@ -845,7 +694,7 @@ cdev_set_device(dev_t mm, struct cdev *cdev)
 #define DVB_DEVICE_OSD_MINOR 8
 		subdev = (mm >> 6) & 0x3FF;
 		if (subdev >= F_V4B_SUBDEV_MAX)
-			return;
+			return (1);
 
 		id = (mm >> 4) & 0x03;
 
@@ -861,53 +710,107 @@ cdev_set_device(dev_t mm, struct cdev *cdev)
 
 		switch (mm & 0xFFFF000FU) {
 		case MKDEV(DVB_MAJOR, DVB_DEVICE_AUDIO_MINOR):
-			cdev_registry[F_V4B_DVB_AUDIO][subdev] = cdev;
-			cdev_mm[F_V4B_DVB_AUDIO][subdev] = mm;
+			f_v4b = F_V4B_DVB_AUDIO;
 			break;
 		case MKDEV(DVB_MAJOR, DVB_DEVICE_CA_MINOR):
-			cdev_registry[F_V4B_DVB_CA][subdev] = cdev;
-			cdev_mm[F_V4B_DVB_CA][subdev] = mm;
+			f_v4b = F_V4B_DVB_CA;
 			break;
 		case MKDEV(DVB_MAJOR, DVB_DEVICE_DEMUX_MINOR):
-			cdev_registry[F_V4B_DVB_DEMUX][subdev] = cdev;
-			cdev_mm[F_V4B_DVB_DEMUX][subdev] = mm;
+			f_v4b = F_V4B_DVB_DEMUX;
 			break;
 		case MKDEV(DVB_MAJOR, DVB_DEVICE_DVR_MINOR):
-			cdev_registry[F_V4B_DVB_DVR][subdev] = cdev;
-			cdev_mm[F_V4B_DVB_DVR][subdev] = mm;
+			f_v4b = F_V4B_DVB_DVR;
 			break;
 		case MKDEV(DVB_MAJOR, DVB_DEVICE_FRONTEND_MINOR):
-			cdev_registry[F_V4B_DVB_FRONTEND][subdev] = cdev;
-			cdev_mm[F_V4B_DVB_FRONTEND][subdev] = mm;
+			f_v4b = F_V4B_DVB_FRONTEND;
 			break;
 		case MKDEV(DVB_MAJOR, DVB_DEVICE_OSD_MINOR):
-			cdev_registry[F_V4B_DVB_OSD][subdev] = cdev;
-			cdev_mm[F_V4B_DVB_OSD][subdev] = mm;
+			f_v4b = F_V4B_DVB_OSD;
 			break;
 		case MKDEV(DVB_MAJOR, DVB_DEVICE_SEC_MINOR):
-			cdev_registry[F_V4B_DVB_SEC][subdev] = cdev;
-			cdev_mm[F_V4B_DVB_SEC][subdev] = mm;
+			f_v4b = F_V4B_DVB_SEC;
 			break;
 		case MKDEV(DVB_MAJOR, DVB_DEVICE_VIDEO_MINOR):
-			cdev_registry[F_V4B_DVB_VIDEO][subdev] = cdev;
-			cdev_mm[F_V4B_DVB_VIDEO][subdev] = mm;
+			f_v4b = F_V4B_DVB_VIDEO;
 			break;
 		default:
-			break;		/* silently ignore */
+			return (1);	/* silently ignore */
 		}
 		break;
 	default:
 		subdev = 0;
 		goto error;
 	}
-	return;
+	*pf_v4b = f_v4b;
+	*psubdev = subdev;
+	return (0);
 
 error:
-	printf("Trying to register "
-	    "unknown device(0x%08jx) "
-	    "or subdevice(%d) too big.\n",
-	    (uintmax_t)mm, (int)subdev);
-	return;
+	*psubdev = subdev;
+	return (-1);
+}
+
+static void
+cdev_set_device(dev_t mm, struct cdev *cdev)
+{
+	uint8_t subdev;
+	uint8_t f_v4b;
+
+	switch (cdev_get_slot(mm, &f_v4b, &subdev)) {
+	case 0:
+		cdev_registry[f_v4b][subdev] = cdev;
+		cdev_mm[f_v4b][subdev] = mm;
+		break;
+	case 1:
+		break;
+	default:
+		printf("Trying to register "
+		    "unknown device(0x%08jx) "
+		    "or subdevice(%d) too big.\n",
+		    (uintmax_t)mm, (int)subdev);
+		break;
+	}
+}
+
+/*
+ * Some character devices, like DVB, register the whole minor number
+ * range at once. Keep track of which device numbers have actually
+ * been created, so that the unused minor numbers can be skipped
+ * without opening them.
+ */
+static void
+cdev_set_present(dev_t mm, int delta)
+{
+	uint8_t subdev;
+	uint8_t f_v4b;
+
+	if (mm == 0)
+		return;
+	if (cdev_get_slot(mm, &f_v4b, &subdev) != 0)
+		return;
+	if (delta > 0 || cdev_present[f_v4b][subdev] != 0)
+		cdev_present[f_v4b][subdev] += delta;
+}
+
+int
+cdev_is_present(unsigned int f_v4b)
+{
+	struct cdev *cdev;
+	unsigned int subunit;
+
+	cdev = cdev_get_device(f_v4b);
+	if (cdev == NULL)
+		return (0);
+
+	/* single device numbers are always registered per device */
+	if ((cdev->mm_end - cdev->mm_start) == 1)
+		return (1);
+
+	subunit = f_v4b % SUB_MAX;
+
+	f_v4b /= SUB_MAX;
+
+	return (cdev_present[f_v4b][subunit] != 0);
 }
 
 struct cdev *
@@ -1159,6 +1062,7 @@ device_add(struct device *dev)
 
 	if (dev->bus == NULL) {
 		get_device(dev);
+		cdev_set_present(dev->devt, 1);
 		return (0);
 	}
 	TAILQ_FOREACH(drv, &device_driver_head, entry) {
@@ -1176,6 +1080,7 @@ device_add(struct device *dev)
 				continue;
 		}
 		get_device(dev);
+		cdev_set_present(dev->devt, 1);
 		return (0);
 	}
 
@@ -1189,6 +1094,7 @@ device_del(struct device *dev)
 	if (dev->bus != NULL && dev->bus->remove != NULL) {
 		dev->bus->remove(dev);
 	}
+	cdev_set_present(dev->devt, -1);
 	dev->driver = NULL;
 	put_device(dev);
 }
@@ -1266,7 +1172,7 @@ device_enable_async_suspend(struct device *dev)
 void
 device_destroy(struct class *class, dev_t devt)
 {
-
+	cdev_set_present(devt, -1);
 }
 
 void
@@ -1287,539 +1193,12 @@ module_get(struct module *module)
 
 }
 
-void   *
-ERR_PTR(long error)
-{
-	return ((void *)error);
-}
-
-long
-PTR_ERR(const void *ptr)
-{
-	return ((long)ptr);
-}
-
-long
-IS_ERR(const void *ptr)
-{
-	return IS_ERR_VALUE((unsigned long)ptr);
-}
-
-int
-PTR_ERR_OR_ZERO(const void *ptr)
-{
-	if (IS_ERR(ptr))
-		return PTR_ERR(ptr);
-	else
-		return 0;
-}
-
-int
-__ffs(int x)
-{
-	return (~(x - 1) & x);
-}
-
-int
-__ffz(int x)
-{
-	return ((x + 1) & ~x);
-}
-
-int
-fls(int mask)
-{
-	int bit;
-
-	if (mask == 0)
-		return (0);
-	bit = 1;
-	if (mask & 0xFFFF0000U) {
-		bit += 16;
-		mask = (unsigned int)mask >> 16;
-	}
-	if (mask & 0xFF00U) {
-		bit += 8;
-		mask = (unsigned int)mask >> 8;
-	}
-	if (mask & 0xF0U) {
-		bit += 4;
-		mask = (unsigned int)mask >> 4;
-	}
-	if (mask & 0xCU) {
-		bit += 2;
-		mask = (unsigned int)mask >> 2;
-	}
-	if (mask & 0x2U) {
-		bit += 1;
-		mask = (unsigned int)mask >> 1;
-	}
-	return (bit);
-}
-
 static unsigned long
 __flsl(unsigned long mask)
 {
-	int bit;
-
 	if (mask == 0)
 		return (0);
-	bit = 1;
-#if (BITS_PER_LONG > 32)
-	if (mask & 0xFFFFFFFF00000000UL) {
-		bit += 32;
-		mask = (unsigned long)mask >> 32;
-	}
-#endif
-	if (mask & 0xFFFF0000UL) {
-		bit += 16;
-		mask = (unsigned long)mask >> 16;
-	}
-	if (mask & 0xFF00UL) {
-		bit += 8;
-		mask = (unsigned long)mask >> 8;
-	}
-	if (mask & 0xF0UL) {
-		bit += 4;
-		mask = (unsigned long)mask >> 4;
-	}
-	if (mask & 0xCUL) {
-		bit += 2;
-		mask = (unsigned long)mask >> 2;
-	}
-	if (mask & 0x2UL) {
-		bit += 1;
-		mask = (unsigned long)mask >> 1;
-	}
-	return (bit);
-}
-
-unsigned long
-find_next_bit(const unsigned long *addr, unsigned long size,
-    unsigned long offset)
-{
-	const unsigned long mm = BITS_PER_LONG - 1;
-	unsigned long mask = BIT_MASK(offset) - 1UL;
-
-	while (offset < size) {
-		mask = addr[BIT_WORD(offset)] & ~mask;
-		if (mask != 0) {
-			offset = (ffsl(mask) - 1) | (offset & ~mm);
-			break;
-		}
-		offset += ((~offset) & mm) + 1;
-	}
-	if (offset > size)
-		offset = size;
-	return (offset);
-}
-
-unsigned long
-find_next_zero_bit(const unsigned long *addr, unsigned long size,
-    unsigned long offset)
-{
-	const unsigned long mm = BITS_PER_LONG - 1;
-	unsigned long mask = BIT_MASK(offset) - 1UL;
-
-	while (offset < size) {
-		mask = (~addr[BIT_WORD(offset)]) & ~mask;
-		if (mask != 0) {
-			offset = (ffsl(mask) - 1) | (offset & ~mm);
-			break;
-		}
-		offset += ((~offset) & mm) + 1;
-	}
-	if (offset > size)
-		offset = size;
-	return (offset);
-}
-
-unsigned long *
-bitmap_alloc(unsigned int nbits, gfp_t flags)
-{
-	return (kmalloc_array(BITS_TO_LONGS(nbits), sizeof(long), flags));
-}
-
-unsigned long *
-bitmap_zalloc(unsigned int nbits, gfp_t flags)
-{
-	return (kmalloc_array(BITS_TO_LONGS(nbits), sizeof(long), flags | __GFP_ZERO));
-}
-
-void
-bitmap_free(unsigned long *ptr)
-{
-	free(ptr);
-}
-
-void
-bitmap_copy(unsigned long *dst, const unsigned long *src, unsigned int nbits)
-{
-	const size_t len = BITS_TO_LONGS(nbits) * sizeof(long);
-
-	memcpy(dst, src, len);
-}
-
-int
-bitmap_weight(const unsigned long *src, unsigned nbits)
-{
-	unsigned x;
-	unsigned y;
-
-	for (x = y = 0; x != nbits; x++) {
-		if (src[x / BITS_PER_LONG] & BIT_MASK(x))
-			y++;
-	}
-	return (y);
-}
-
-int
-bitmap_andnot(unsigned long *dst, const unsigned long *b1,
-    const unsigned long *b2, int nbits)
-{
-	int len = (nbits + BITS_PER_LONG - 1) / BITS_PER_LONG;
-	long retval = 0;
-	long temp;
-	int n;
-
-	for (n = 0; n != len; n++) {
-		temp = b1[n] & ~b2[n];
-		dst[n] = temp;
-		retval |= temp;
-	}
-	return (retval != 0);
-}
-
-int
-bitmap_and(unsigned long *dst, const unsigned long *b1,
-    const unsigned long *b2, int nbits)
-{
-	int len = (nbits + BITS_PER_LONG - 1) / BITS_PER_LONG;
-	long retval = 0;
-	long temp;
-	int n;
-
-	for (n = 0; n != len; n++) {
-		temp = b1[n] & b2[n];
-		dst[n] = temp;
-		retval |= temp;
-	}
-	return (retval != 0);
-}
-
-void
-bitmap_or(unsigned long *dst, const unsigned long *b1,
-    const unsigned long *b2, int nbits)
-{
-	int len = (nbits + BITS_PER_LONG - 1) / BITS_PER_LONG;
-	long temp;
-	int n;
-
-	for (n = 0; n != len; n++) {
-		temp = b1[n] | b2[n];
-		dst[n] = temp;
-	}
-}
-
-void
-bitmap_xor(unsigned long *dst, const unsigned long *b1,
-    const unsigned long *b2, int nbits)
-{
-	int len = (nbits + BITS_PER_LONG - 1) / BITS_PER_LONG;
-	long temp;
-	int n;
-
-	for (n = 0; n != len; n++) {
-		temp = b1[n] | b2[n];
-		dst[n] = temp;
-	}
-}
-
-void
-bitmap_fill(unsigned long *dst, unsigned int nbits)
-{
-  	const size_t len = BITS_TO_LONGS(nbits) * sizeof(long);
-
-	memset(dst, 255, len);
-}
-
-void
-bitmap_zero(unsigned long *dst, unsigned int nbits)
-{
-  	const size_t len = BITS_TO_LONGS(nbits) * sizeof(long);
-
-	memset(dst, 0, len);
-}
-
-int
-bitmap_subset(const unsigned long *pa, const unsigned long *pb, int nbits)
-{
-	int end = nbits / BITS_PER_LONG;
-	int x;
-
-	for (x = 0; x != end; x++) {
-		if (pa[x] & ~pb[x])
-			return (0);
-	}
-
-	x = nbits % BITS_PER_LONG;
-	if (x) {
-		if (pa[end] & ~pb[end] & ((1ULL << x) - 1ULL))
-			return (0);
-	}
-	return (1);
-}
-
-int
-bitmap_full(const unsigned long *bitmap, int bits)
-{
-	int k;
-	int lim = bits / BITS_PER_LONG;
-
-	for (k = 0; k < lim; ++k)
-		if (~bitmap[k])
-			return (0);
-
-	lim = bits % BITS_PER_LONG;
-	if (lim) {
-		if ((~bitmap[k]) & ((1ULL << lim) - 1ULL))
-			return (0);
-	}
-	return (1);
-}
-
-void
-bitmap_clear(unsigned long *map, int start, int nr)
-{
-	unsigned long *p = map + (start / BITS_PER_LONG);
-	int size = start + nr;
-	int rem = start % BITS_PER_LONG;
-	int bits_to_clear = BITS_PER_LONG - rem;
-	unsigned long mask_to_clear = ((1ULL << rem) - 1ULL);
-
-	while (nr - bits_to_clear >= 0) {
-		*p &= ~mask_to_clear;
-		nr -= bits_to_clear;
-		bits_to_clear = BITS_PER_LONG;
-		mask_to_clear = ~0UL;
-		p++;
-	}
-	if (nr) {
-		size = size % BITS_PER_LONG;
-		mask_to_clear &= ((1ULL << size) - 1ULL);
-		*p &= ~mask_to_clear;
-	}
-}
-
-void
-bitmap_shift_right(unsigned long *dst, const unsigned long *src, int n, int nbits)
-{
-	int x;
-	int y;
-
-	for (x = 0; x < (nbits - n); x++) {
-		y = x + n;
-		if (src[y / BITS_PER_LONG] & BIT_MASK(y))
-			dst[x / BITS_PER_LONG] |= BIT_MASK(x);
-		else
-			dst[x / BITS_PER_LONG] &= ~BIT_MASK(x);
-	}
-	for (; x < nbits; x++)
-		dst[x / BITS_PER_LONG] &= ~BIT_MASK(x);
-}
-
-void
-bitmap_shift_left(unsigned long *dst, const unsigned long *src, int n, int nbits)
-{
-	int x;
-	int y;
-
-	for (x = 0; x != n; x++)
-		dst[x / BITS_PER_LONG] &= ~BIT_MASK(x);
-
-	for (; x < nbits; x++) {
-		y = x - n;
-		if (src[y / BITS_PER_LONG] & BIT_MASK(y))
-			dst[x / BITS_PER_LONG] |= BIT_MASK(x);
-		else
-			dst[x / BITS_PER_LONG] &= ~BIT_MASK(x);
-	}
-}
-
-int
-bitmap_equal(const unsigned long *pa,
-    const unsigned long *pb, unsigned bits)
-{
-	unsigned k;
-	unsigned lim = bits / BITS_PER_LONG;
-
-	for (k = 0; k != lim; k++)
-		if (pa[k] != pb[k])
-			return (0);
-
-	bits %= BITS_PER_LONG;
-	for (lim = 0; lim != bits; lim++) {
-		if ((pa[k] ^ pb[k]) & BIT_MASK(lim))
-			return (0);
-	}
-	return (1);
-}
-
-int
-bitmap_empty(const unsigned long *pa, unsigned bits)
-{
-	unsigned k;
-	unsigned lim = bits / BITS_PER_LONG;
-
-	for (k = 0; k != lim; k++)
-		if (pa[k] != 0)
-			return (0);
-
-	bits %= BITS_PER_LONG;
-	for (lim = 0; lim != bits; lim++) {
-		if (pa[k] & BIT_MASK(lim))
-			return (0);
-	}
-	return (1);
-}
-
-int
-bitmap_intersects(const unsigned long *pa,
-    const unsigned long *pb, unsigned bits)
-{
-	unsigned k;
-	unsigned lim = bits / BITS_PER_LONG;
-
-	for (k = 0; k != lim; k++)
-		if (pa[k] & pb[k])
-			return (1);
-
-	bits %= BITS_PER_LONG;
-	for (lim = 0; lim != bits; lim++) {
-		if ((pa[k] & pb[k]) & BIT_MASK(lim))
-			return (1);
-	}
-	return (0);
-}
-
-/*
- * A fast, small, non-recursive O(nlog n) sort for the Linux kernel
- *
- * Jan 23 2005  Matt Mackall <mpm@selenic.com>
- */
-
-static void
-u32_swap(void *a, void *b, int size)
-{
-	u32 t = *(u32 *) a;
-
-	*(u32 *) a = *(u32 *) b;
-	*(u32 *) b = t;
-}
-
-static void
-generic_swap(void *a, void *b, int size)
-{
-	char t;
-
-	do {
-		t = *(char *)a;
-		*(char *)a++ = *(char *)b;
-		*(char *)b++ = t;
-	} while (--size > 0);
-}
-
-void
-sort(void *base, size_t num, size_t size,
-    int (*cmp) (const void *, const void *),
-    void (*swap_fn) (void *, void *, int size))
-{
-	/* pre-scale counters for performance */
-	int i = (num / 2 - 1) * size, n = num * size, c, r;
-
-	if (!swap_fn)
-		swap_fn = (size == 4 ? u32_swap : generic_swap);
-
-	/* heapify */
-	for (; i >= 0; i -= size) {
-		for (r = i; r * 2 + size < n; r = c) {
-			c = r * 2 + size;
-			if (c < n - size && cmp(base + c, base + c + size) < 0)
-				c += size;
-			if (cmp(base + r, base + c) >= 0)
-				break;
-			swap_fn(base + r, base + c, size);
-		}
-	}
-
-	/* sort */
-	for (i = n - size; i > 0; i -= size) {
-		swap_fn(base, base + i, size);
-		for (r = 0; r * 2 + size < i; r = c) {
-			c = r * 2 + size;
-			if (c < i - size && cmp(base + c, base + c + size) < 0)
-				c += size;
-			if (cmp(base + r, base + c) >= 0)
-				break;
-			swap_fn(base + r, base + c, size);
-		}
-	}
-}
-
-/* standard CRC computation */
-
-u32
-crc32_le(u32 crc, unsigned char const *p, size_t len)
-{
-	uint8_t i;
-
-	while (len--) {
-		crc ^= *p++;
-		for (i = 0; i != 8; i++)
-			crc = (crc >> 1) ^ ((crc & 1) ? CRCPOLY_LE : 0);
-	}
-	return crc;
-}
-
-u32
-crc32_be(u32 crc, unsigned char const *p, size_t len)
-{
-	uint8_t i;
-
-	while (len--) {
-		crc ^= *p++ << 24;
-		for (i = 0; i != 8; i++)
-			crc =
-			    (crc << 1) ^ ((crc & 0x80000000) ? CRCPOLY_BE : 0);
-	}
-	return crc;
-}
-
-void   *
-kcalloc(size_t n, size_t size, gfp_t flags)
-{
-	return (kmalloc_array(n, size, flags | __GFP_ZERO));
-}
-
-void   *
-kmalloc(size_t n, gfp_t flags)
-{
-	if (flags & __GFP_ZERO)
-		return (calloc(1, n));	/* memory must be zeroed */
-	else
-		return (malloc(n));
-}
-
-void   *
-kmalloc_array(size_t n, size_t s, gfp_t flags)
-{
-	size_t total = n * s;
-	void *ptr;
-
-	if (total != 0 && (total / n) != s)
-		return (NULL);
-	else
-		return (kmalloc(total, flags));
+	return (BITS_PER_LONG - __builtin_clzl(mask));
 }
 
 void   *
@@ -1831,12 +1210,7 @@ vmalloc(size_t size)
 void   *
 vzalloc(size_t size)
 {
-	void *ptr = malloc_vm(size);
-
-	if (ptr != NULL)
-		memset(ptr, 0, size);
-
-	return (ptr);
+	return (malloc_vm_zero(size));
 }
 
 long
@@ -3603,7 +2977,7 @@ dma_free_noncontiguous(struct device *dev, size_t len, struct sg_table *sgt, enu
 {
 	if (sgt == NULL)
 		return;
-	free((void *)(long)sgt->sgl->dma_address);
+	kfree((void *)(long)sgt->sgl->dma_address);
 	free(sgt);
 }
 
@@ -3612,4 +2986,3 @@ dma_vmap_noncontiguous(struct device *dev, size_t len, struct sg_table *sgt)
 {
 	return ((void *)(long)sgt->sgl->dma_address);
 }
-
@@ -211,6 +211,8 @@ int	fls (int mask);
 unsigned long find_next_bit(const unsigned long *addr, unsigned long size, unsigned long offset);
 unsigned long find_next_zero_bit(const unsigned long *addr, unsigned long size, unsigned long offset);
 void	sort(void *base, size_t num, size_t size, int (*cmp) (const void *, const void *), void (*swap) (void *, void *, int size));
+void	crc32_init(void);
+int	crc32_le_hw_select(int);
 u32	crc32_le(u32 crc, unsigned char const *p, size_t len);
 u32	crc32_be(u32 crc, unsigned char const *p, size_t len);
 void   *vmalloc(size_t size);
@@ -218,6 +220,10 @@ void   *vzalloc(size_t size);
 void   *kcalloc(size_t, size_t, gfp_t);
 void   *kmalloc(size_t, gfp_t);
 void   *kmalloc_array(size_t, size_t, gfp_t);
+void	kfree(const void *);
+void   *krealloc(const void *, size_t, gfp_t);
+size_t	ksize(const void *);
+void	kmalloc_stats(FILE *);
 
 long	__get_free_page(int);
 void	free_page(long);
@@ -334,13 +340,26 @@ struct class *class_create(struct module *owner, const char *name);
 void	cdev_init(struct cdev *cdev, const struct file_operations *fops);
 struct cdev *cdev_get_device(unsigned int f_v4b);
 uint32_t cdev_get_mm(unsigned int f_v4b);
+int	cdev_is_present(unsigned int f_v4b);
 int	usb_register_dev(struct usb_interface *, struct usb_class_driver *);
 void	usb_deregister_dev(struct usb_interface *, struct usb_class_driver *);
 struct usb_interface *usb_find_interface(struct usb_driver *, int);
 
 int	is_vmalloc_addr(void *);
 void   *malloc_vm(size_t);
+void   *malloc_vm_zero(size_t);
 void	free_vm(void *);
+void	malloc_vm_stats(FILE *);
+
+struct i2c_adapter;
+int	i2c_coalesce_enable(struct i2c_adapter *, u16, u8, u16);
+int	i2c_regcache_enable(struct i2c_adapter *, u16, u8, u16);
+void	i2c_regcache_uncached(struct i2c_adapter *, u16, u16, u16);
+void	i2c_regcache_invalidate(struct i2c_adapter *, u16);
+void	i2c_stats(FILE *);
+
+void	json_print_string(FILE *, const char *);
+
 int	pidfile_create(int bus, int addr, int index);
 
 void   *kmemdup(const void *src, size_t len, gfp_t gfp);
@@ -35,17 +35,101 @@ struct device_type i2c_client_type;
 #define	I2C_ADDR_OFFSET_TEN_BIT	0xa000
 #define	I2C_ADDR_OFFSET_SLAVE	0x1000
 
-int
-i2c_transfer(struct i2c_adapter *adap, struct i2c_msg *msgs, int num)
+/*
+ * Per adapter state used for statistics, write coalescing and the
+ * register cache. Write coalescing and the register cache are opt-in
+ * per slave address and assume the slave auto-increments its register
+ * pointer on multi-byte transfers, using a one or two byte, big
+ * endian register address at the start of every write.
+ */
+#define	I2C_COALESCE_MAX 64		/* bytes */
+#define	I2C_COALESCE_DELAY 1		/* jiffies */
+
+struct i2c_dev_cfg {
+	TAILQ_ENTRY(i2c_dev_cfg) entry;
+	u16	addr;
+	u8	reg_bytes;
+	u16	coalesce_max;		/* zero means no coalescing */
+	u16	nregs;			/* zero means no register cache */
+	unsigned long *valid;
+	unsigned long *uncached;
+	u8     *value;
+};
+
+struct i2c_adapter_priv {
+	TAILQ_ENTRY(i2c_adapter_priv) entry;
+	TAILQ_HEAD(, i2c_dev_cfg) cfg_head;
+	struct i2c_adapter *adap;
+	struct delayed_work flush_work;
+	struct i2c_dev_cfg *pend_cfg;
+	unsigned pend_reg;		/* next register of pending write */
+	int	pend_len;
+	int	pend_error;
+	u8	pend_buf[I2C_COALESCE_MAX];
+
+	/* statistics, protected by the bus lock */
+	unsigned long xfers;
+	unsigned long msgs;
+	unsigned long bytes;
+	unsigned long errors;
+	unsigned long retries;
+	unsigned long merged;
+	unsigned long hits;
+	uint64_t usecs;
+	uint64_t usecs_max;
+};
+
+static TAILQ_HEAD(, i2c_adapter_priv) i2c_priv_head =
+    TAILQ_HEAD_INITIALIZER(i2c_priv_head);
+
+static struct i2c_adapter_priv *
+i2c_adapter_priv_find(struct i2c_adapter *adap)
+{
+	struct i2c_adapter_priv *priv;
+
+	atomic_lock();
+	TAILQ_FOREACH(priv, &i2c_priv_head, entry) {
+		if (priv->adap == adap)
+			break;
+	}
+	atomic_unlock();
+	return (priv);
+}
+
+static struct i2c_dev_cfg *
+i2c_dev_cfg_find(struct i2c_adapter_priv *priv, u16 addr)
+{
+	struct i2c_dev_cfg *cfg;
+
+	TAILQ_FOREACH(cfg, &priv->cfg_head, entry) {
+		if (cfg->addr == addr)
+			break;
+	}
+	return (cfg);
+}
+
+static unsigned
+i2c_dev_cfg_reg(const struct i2c_dev_cfg *cfg, const u8 *buf)
 {
+	if (cfg->reg_bytes == 2)
+		return ((buf[0] << 8) | buf[1]);
+	return (buf[0]);
+}
+
+static int
+i2c_xfer_sub(struct i2c_adapter *adap, struct i2c_adapter_priv *priv,
+    struct i2c_msg *msgs, int num)
+{
+	struct timespec ts[2];
 	unsigned long end_jiffies;
+	uint64_t usecs;
 	int ret;
 	int try;
+	int x;
 
-	if (adap->algo->master_xfer == NULL)
-		return (-EOPNOTSUPP);
+	if (priv != NULL)
+		clock_gettime(CLOCK_MONOTONIC, ts);
 
-	i2c_lock_bus(adap, I2C_LOCK_SEGMENT);
 	end_jiffies = jiffies + adap->timeout;
 	for (ret = 0, try = 0; try <= adap->retries; try++) {
 		ret = adap->algo->master_xfer(adap, msgs, num);
@@ -54,6 +138,177 @@ i2c_transfer(struct i2c_adapter *adap, struct i2c_msg *msgs, int num)
 		if (time_after(jiffies, end_jiffies))
 			break;
 	}
+
+	if (priv != NULL) {
+		clock_gettime(CLOCK_MONOTONIC, ts + 1);
+		usecs = (ts[1].tv_sec - ts[0].tv_sec) * 1000000LL +
+		    (ts[1].tv_nsec - ts[0].tv_nsec) / 1000LL;
+
+		priv->xfers++;
+		priv->msgs += num;
+		for (x = 0; x != num; x++)
+			priv->bytes += msgs[x].len;
+		if (ret < 0)
+			priv->errors++;
+		if (try > adap->retries)
+			try = adap->retries;
+		priv->retries += try;
+		priv->usecs += usecs;
+		if (priv->usecs_max < usecs)
+			priv->usecs_max = usecs;
+	}
+	return (ret);
+}
+
+static void
+i2c_regcache_store(struct i2c_dev_cfg *cfg, unsigned reg,
+    const u8 *buf, unsigned len)
+{
+	for (; len != 0 && reg < cfg->nregs; len--, reg++, buf++) {
+		if (test_bit(reg, cfg->uncached))
+			continue;
+		cfg->value[reg] = *buf;
+		set_bit(reg, cfg->valid);
+	}
+}
+
+static void
+i2c_regcache_drop(struct i2c_dev_cfg *cfg)
+{
+	if (cfg->nregs != 0)
+		bitmap_zero(cfg->valid, cfg->nregs);
+}
+
+/*
+ * Update the register cache after a successful transfer.
+ */
+static void
+i2c_regcache_update(struct i2c_dev_cfg *cfg, struct i2c_msg *msgs, int num)
+{
+	unsigned rb = cfg->reg_bytes;
+	int x;
+
+	if (cfg->nregs == 0)
+		return;
+
+	for (x = 0; x != num; x++) {
+		if (msgs[x].addr != cfg->addr || (msgs[x].flags & I2C_M_RD))
+			continue;
+		if (msgs[x].len > rb) {
+			i2c_regcache_store(cfg, i2c_dev_cfg_reg(cfg, msgs[x].buf),
+			    msgs[x].buf + rb, msgs[x].len - rb);
+		} else if (msgs[x].len == rb && x + 1 != num &&
+		    msgs[x + 1].addr == cfg->addr &&
+		    (msgs[x + 1].flags & I2C_M_RD)) {
+			i2c_regcache_store(cfg, i2c_dev_cfg_reg(cfg, msgs[x].buf),
+			    msgs[x + 1].buf, msgs[x + 1].len);
+			x++;
+		}
+	}
+}
+
+static void
+i2c_coalesce_flush(struct i2c_adapter_priv *priv)
+{
+	struct i2c_msg msg;
+	int ret;
+
+	if (priv->pend_cfg == NULL)
+		return;
+
+	msg.addr = priv->pend_cfg->addr;
+	msg.flags = 0;
+	msg.len = priv->pend_len;
+	msg.buf = priv->pend_buf;
+
+	ret = i2c_xfer_sub(priv->adap, priv, &msg, 1);
+	if (ret != 1) {
+		/* report the error on the next coalesced write */
+		priv->pend_error = (ret < 0) ? ret : -EIO;
+		i2c_regcache_drop(priv->pend_cfg);
+	}
+	priv->pend_cfg = NULL;
+	priv->pend_len = 0;
+}
+
+static void
+i2c_coalesce_work(struct work_struct *work)
+{
+	struct i2c_adapter_priv *priv =
+	    container_of(to_delayed_work(work), struct i2c_adapter_priv, flush_work);
+
+	i2c_lock_bus(priv->adap, I2C_LOCK_SEGMENT);
+	i2c_coalesce_flush(priv);
+	i2c_unlock_bus(priv->adap, I2C_LOCK_SEGMENT);
+}
+
+/*
+ * Try to complete a transfer to a configured slave without accessing
+ * the bus. Returns zero if the transfer must be executed.
+ */
+static int
+i2c_dev_cfg_xfer(struct i2c_adapter_priv *priv, struct i2c_dev_cfg *cfg,
+    struct i2c_msg *msgs, int num)
+{
+	unsigned rb = cfg->reg_bytes;
+	unsigned reg;
+	unsigned len;
+	int error;
+
+	if (num == 2 && cfg->nregs != 0 &&
+	    msgs[0].flags == 0 && msgs[0].len == rb &&
+	    msgs[1].addr == cfg->addr && msgs[1].flags == I2C_M_RD) {
+		reg = i2c_dev_cfg_reg(cfg, msgs[0].buf);
+		len = msgs[1].len;
+		if (len == 0 || reg + len > cfg->nregs ||
+		    find_next_zero_bit(cfg->valid, reg + len, reg) < reg + len ||
+		    find_next_bit(cfg->uncached, reg + len, reg) < reg + len)
+			return (0);
+		memcpy(msgs[1].buf, cfg->value + reg, len);
+		priv->hits++;
+		return (2);
+	}
+
+	if (num != 1 || cfg->coalesce_max == 0 ||
+	    msgs[0].flags != 0 || msgs[0].len <= rb)
+		return (0);
+
+	reg = i2c_dev_cfg_reg(cfg, msgs[0].buf);
+	len = msgs[0].len - rb;
+
+	if (priv->pend_cfg == cfg && priv->pend_reg == reg &&
+	    priv->pend_len + len <= cfg->coalesce_max) {
+		memcpy(priv->pend_buf + priv->pend_len, msgs[0].buf + rb, len);
+		priv->pend_len += len;
+		priv->pend_reg += len;
+		priv->merged++;
+	} else {
+		i2c_coalesce_flush(priv);
+		if (msgs[0].len > cfg->coalesce_max)
+			return (0);
+		memcpy(priv->pend_buf, msgs[0].buf, msgs[0].len);
+		priv->pend_len = msgs[0].len;
+		priv->pend_reg = reg + len;
+		priv->pend_cfg = cfg;
+		schedule_delayed_work(&priv->flush_work, I2C_COALESCE_DELAY);
+	}
+	i2c_regcache_update(cfg, msgs, 1);
+
+	error = priv->pend_error;
+	priv->pend_error = 0;
+	return (error ? error : 1);
+}
+
+int
+i2c_transfer(struct i2c_adapter *adap, struct i2c_msg *msgs, int num)
+{
+	int ret;
+
+	if (adap->algo->master_xfer == NULL)
+		return (-EOPNOTSUPP);
+
+	i2c_lock_bus(adap, I2C_LOCK_SEGMENT);
+	ret = __i2c_transfer(adap, msgs, num);
 	i2c_unlock_bus(adap, I2C_LOCK_SEGMENT);
 
 	return (ret);
@@ -62,21 +317,200 @@ i2c_transfer(struct i2c_adapter *adap, struct i2c_msg *msgs, int num)
 int
 __i2c_transfer(struct i2c_adapter *adap, struct i2c_msg *msgs, int num)
 {
-	unsigned long end_jiffies;
+	struct i2c_adapter_priv *priv;
+	struct i2c_dev_cfg *cfg;
 	int ret;
-	int try;
 
-	end_jiffies = jiffies + adap->timeout;
-	for (ret = 0, try = 0; try <= adap->retries; try++) {
-		ret = adap->algo->master_xfer(adap, msgs, num);
-		if (ret != -EAGAIN)
-			break;
-		if (time_after(jiffies, end_jiffies))
-			break;
+	if (adap->algo->master_xfer == NULL)
+		return (-EOPNOTSUPP);
+
+	priv = i2c_adapter_priv_find(adap);
+	if (priv == NULL)
+		return (i2c_xfer_sub(adap, NULL, msgs, num));
+
+	cfg = (num > 0) ? i2c_dev_cfg_find(priv, msgs[0].addr) : NULL;
+	if (cfg != NULL) {
+		ret = i2c_dev_cfg_xfer(priv, cfg, msgs, num);
+		if (ret != 0)
+			return (ret);
 	}
+
+	/* keep the bus order */
+	i2c_coalesce_flush(priv);
+
+	ret = i2c_xfer_sub(adap, priv, msgs, num);
+	if (cfg != NULL && ret == num)
+		i2c_regcache_update(cfg, msgs, num);
 	return (ret);
 }
 
+static struct i2c_dev_cfg *
+i2c_dev_cfg_get(struct i2c_adapter_priv *priv, u16 addr, u8 reg_bytes)
+{
+	struct i2c_dev_cfg *cfg;
+
+	cfg = i2c_dev_cfg_find(priv, addr);
+	if (cfg != NULL)
+		return ((cfg->reg_bytes == reg_bytes) ? cfg : NULL);
+
+	cfg = kzalloc(sizeof(*cfg), GFP_KERNEL);
+	if (cfg == NULL)
+		return (NULL);
+	cfg->addr = addr;
+	cfg->reg_bytes = reg_bytes;
+	TAILQ_INSERT_TAIL(&priv->cfg_head, cfg, entry);
+	return (cfg);
+}
+
+/*
+ * Merge consecutive register writes to the given slave into a single
+ * transfer of up to "max_len" bytes. Pending writes are flushed
+ * before any other transfer on the adapter and after one jiffy.
+ */
+int
+i2c_coalesce_enable(struct i2c_adapter *adap, u16 addr, u8 reg_bytes,
+    u16 max_len)
+{
+	struct i2c_adapter_priv *priv;
+	struct i2c_dev_cfg *cfg;
+
+	if (reg_bytes < 1 || reg_bytes > 2 || max_len <= reg_bytes)
+		return (-EINVAL);
+	if (max_len > I2C_COALESCE_MAX)
+		max_len = I2C_COALESCE_MAX;
+
+	priv = i2c_adapter_priv_find(adap);
+	if (priv == NULL)
+		return (-ENODEV);
+
+	i2c_lock_bus(adap, I2C_LOCK_SEGMENT);
+	cfg = i2c_dev_cfg_get(priv, addr, reg_bytes);
+	if (cfg != NULL)
+		cfg->coalesce_max = max_len;
+	i2c_unlock_bus(adap, I2C_LOCK_SEGMENT);
+
+	return ((cfg != NULL) ? 0 : -EINVAL);
+}
+
+/*
+ * Cache the first "nregs" registers of the given slave. Register
+ * reads are served from the cache once the registers have been read
+ * or written. Status registers must be marked uncached.
+ */
+int
+i2c_regcache_enable(struct i2c_adapter *adap, u16 addr, u8 reg_bytes,
+    u16 nregs)
+{
+	struct i2c_adapter_priv *priv;
+	struct i2c_dev_cfg *cfg;
+	int error = 0;
+
+	if (reg_bytes < 1 || reg_bytes > 2 || nregs == 0)
+		return (-EINVAL);
+
+	priv = i2c_adapter_priv_find(adap);
+	if (priv == NULL)
+		return (-ENODEV);
+
+	i2c_lock_bus(adap, I2C_LOCK_SEGMENT);
+	cfg = i2c_dev_cfg_get(priv, addr, reg_bytes);
+	if (cfg == NULL || cfg->nregs != 0) {
+		error = -EINVAL;
+		goto done;
+	}
+	cfg->valid = bitmap_zalloc(nregs, GFP_KERNEL);
+	cfg->uncached = bitmap_zalloc(nregs, GFP_KERNEL);
+	cfg->value = kzalloc(nregs, GFP_KERNEL);
+	if (cfg->valid == NULL || cfg->uncached == NULL || cfg->value == NULL) {
+		bitmap_free(cfg->valid);
+		bitmap_free(cfg->uncached);
+		kfree(cfg->value);
+		cfg->valid = NULL;
+		cfg->uncached = NULL;
+		cfg->value = NULL;
+		error = -ENOMEM;
+		goto done;
+	}
+	cfg->nregs = nregs;
+done:
+	i2c_unlock_bus(adap, I2C_LOCK_SEGMENT);
+	return (error);
+}
+
+void
+i2c_regcache_uncached(struct i2c_adapter *adap, u16 addr,
+    u16 first, u16 last)
+{
+	struct i2c_adapter_priv *priv;
+	struct i2c_dev_cfg *cfg;
+
+	priv = i2c_adapter_priv_find(adap);
+	if (priv == NULL)
+		return;
+
+	i2c_lock_bus(adap, I2C_LOCK_SEGMENT);
+	cfg = i2c_dev_cfg_find(priv, addr);
+	for (; cfg != NULL && first <= last && first < cfg->nregs; first++) {
+		set_bit(first, cfg->uncached);
+		clear_bit(first, cfg->valid);
+	}
+	i2c_unlock_bus(adap, I2C_LOCK_SEGMENT);
+}
+
+/*
+ * The native SMBus path does not pass through __i2c_transfer(), and
+ * the SMBus command byte does not map onto the register address of
+ * every slave. Drop the cached registers of the slave on any SMBus
+ * write. Must be called with the bus locked.
+ */
+static void
+i2c_regcache_smbus(struct i2c_adapter_priv *priv, u16 addr, char read_write)
+{
+	struct i2c_dev_cfg *cfg;
+
+	if (read_write != I2C_SMBUS_WRITE)
+		return;
+	cfg = i2c_dev_cfg_find(priv, addr);
+	if (cfg != NULL)
+		i2c_regcache_drop(cfg);
+}
+
+void
+i2c_regcache_invalidate(struct i2c_adapter *adap, u16 addr)
+{
+	struct i2c_adapter_priv *priv;
+	struct i2c_dev_cfg *cfg;
+
+	priv = i2c_adapter_priv_find(adap);
+	if (priv == NULL)
+		return;
+
+	i2c_lock_bus(adap, I2C_LOCK_SEGMENT);
+	cfg = i2c_dev_cfg_find(priv, addr);
+	if (cfg != NULL)
+		i2c_regcache_drop(cfg);
+	i2c_unlock_bus(adap, I2C_LOCK_SEGMENT);
+}
+
+void
+i2c_stats(FILE *fp)
+{
+	struct i2c_adapter_priv *priv;
+
+	atomic_lock();
+	TAILQ_FOREACH(priv, &i2c_priv_head, entry) {
+		fprintf(fp, "%s: %lu transfers, %lu messages, %lu bytes, "
+		    "%lu errors, %lu retries, %lu writes merged, "
+		    "%lu cache hits, %ju us average, %ju us max\n",
+		    dev_name(&priv->adap->dev), priv->xfers, priv->msgs,
+		    priv->bytes, priv->errors, priv->retries, priv->merged,
+		    priv->hits, (uintmax_t)(priv->xfers ?
+		    priv->usecs / priv->xfers : 0),
+		    (uintmax_t)priv->usecs_max);
+	}
+	atomic_unlock();
+}
+
 int
 i2c_register_driver(struct module *mod, struct i2c_driver *drv)
 {
@@ -115,6 +549,9 @@ i2c_adapter_unlock_bus(struct i2c_adapter *adapter,
 static int
 i2c_register_adapter(struct i2c_adapter *adap)
 {
+	struct i2c_adapter_priv *priv;
+	int error;
+
 	if (!adap->lock_bus) {
 		adap->lock_bus = i2c_adapter_lock_bus;
 		adap->trylock_bus = i2c_adapter_trylock_bus;
@@ -129,7 +566,24 @@ i2c_register_adapter(struct i2c_adapter *adap)
 	dev_set_name(&adap->dev, "i2c-%d", adap->nr);
 	adap->dev.type = &i2c_adapter_type;
 
-	return (device_register(&adap->dev));
+	priv = kzalloc(sizeof(*priv), GFP_KERNEL);
+	if (priv != NULL) {
+		priv->adap = adap;
+		TAILQ_INIT(&priv->cfg_head);
+		INIT_DELAYED_WORK(&priv->flush_work, &i2c_coalesce_work);
+		atomic_lock();
+		TAILQ_INSERT_TAIL(&i2c_priv_head, priv, entry);
+		atomic_unlock();
+	}
+
+	error = device_register(&adap->dev);
+	if (error != 0 && priv != NULL) {
+		atomic_lock();
+		TAILQ_REMOVE(&i2c_priv_head, priv, entry);
+		atomic_unlock();
+		kfree(priv);
+	}
+	return (error);
 }
 
 static int
@@ -176,7 +630,31 @@ i2c_add_adapter(struct i2c_adapter *adapter)
 void
 i2c_del_adapter(struct i2c_adapter *adapter)
 {
+	struct i2c_adapter_priv *priv;
+	struct i2c_dev_cfg *cfg;
+
+	priv = i2c_adapter_priv_find(adapter);
+	if (priv == NULL)
+		return;
+
+	atomic_lock();
+	TAILQ_REMOVE(&i2c_priv_head, priv, entry);
+	atomic_unlock();
 
+	cancel_delayed_work_sync(&priv->flush_work);
+
+	i2c_lock_bus(adapter, I2C_LOCK_SEGMENT);
+	i2c_coalesce_flush(priv);
+	i2c_unlock_bus(adapter, I2C_LOCK_SEGMENT);
+
+	while ((cfg = TAILQ_FIRST(&priv->cfg_head)) != NULL) {
+		TAILQ_REMOVE(&priv->cfg_head, cfg, entry);
+		bitmap_free(cfg->valid);
+		bitmap_free(cfg->uncached);
+		kfree(cfg->value);
+		kfree(cfg);
+	}
+	kfree(priv);
 }
 
 struct i2c_client *
@@ -750,8 +1228,15 @@ i2c_smbus_xfer(struct i2c_adapter *adapter, u16 addr, unsigned short flags,
 	flags &= I2C_M_TEN | I2C_CLIENT_PEC | I2C_CLIENT_SCCB;
 
 	if (adapter->algo->smbus_xfer) {
+		struct i2c_adapter_priv *priv;
+
 		i2c_lock_bus(adapter, I2C_LOCK_SEGMENT);
 
+		/* keep the bus order */
+		priv = i2c_adapter_priv_find(adapter);
+		if (priv != NULL)
+			i2c_coalesce_flush(priv);
+
 		orig_jiffies = jiffies;
 		for (res = 0, try = 0; try <= adapter->retries; try++) {
 			res = adapter->algo->smbus_xfer(adapter, addr, flags,
@@ -763,6 +1248,8 @@ i2c_smbus_xfer(struct i2c_adapter *adapter, u16 addr, unsigned short flags,
 			    orig_jiffies + adapter->timeout))
 				break;
 		}
+		if (priv != NULL)
+			i2c_regcache_smbus(priv, addr, read_write);
 		i2c_unlock_bus(adapter, I2C_LOCK_SEGMENT);
 
 		if (res != -EOPNOTSUPP || !adapter->algo->master_xfer)
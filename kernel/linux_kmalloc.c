@@ -0,0 +1,573 @@
+/*-
+ * Copyright (c) 2010 Hans Petter Selasky. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Size-class allocator behind kmalloc() and kfree().
+ *
+ * Small objects are carved out of a single reserved address range,
+ * which is split into 64 KByte chunks. Each chunk serves exactly one
+ * power of two size class, so the class of any object is found from
+ * its address alone. Every thread keeps a private free list and a
+ * bump range of never used, and thus zeroed, memory per class. The
+ * global free lists are only touched when a thread cache runs dry or
+ * overflows. Allocations above the largest class and allocations
+ * made after the arena is exhausted are passed to malloc(). kfree()
+ * accepts any pointer returned by malloc() as well.
+ */
+
+#include <sys/mman.h>
+
+#define	KMALLOC_CHUNK_SHIFT 16
+#define	KMALLOC_CHUNK_SIZE (1UL << KMALLOC_CHUNK_SHIFT)
+#ifdef __LP64__
+#define	KMALLOC_ARENA_SIZE (1UL << 32)
+#else
+#define	KMALLOC_ARENA_SIZE (1UL << 28)
+#endif
+#define	KMALLOC_CHUNK_MAX (KMALLOC_ARENA_SIZE >> KMALLOC_CHUNK_SHIFT)
+#define	KMALLOC_CLASS_SHIFT 4		/* 16 bytes */
+#define	KMALLOC_CLASS_MAX 10		/* 16 .. 8192 bytes */
+#define	KMALLOC_CLASS_NONE 0xFF
+#define	KMALLOC_SIZE_MAX (1UL << (KMALLOC_CLASS_SHIFT + KMALLOC_CLASS_MAX - 1))
+#define	KMALLOC_CACHE_MAX 64		/* objects per thread and class */
+
+#ifdef HAVE_KMALLOC_DEBUG
+#define	KMALLOC_MAGIC_LIVE 0x6b6d616cU
+#define	KMALLOC_MAGIC_FREE 0x6b667265U
+#define	KMALLOC_REDZONE 16
+#define	KMALLOC_REDZONE_BYTE 0xA5
+#define	KMALLOC_POISON_BYTE 0x6B
+
+struct kmalloc_debug {
+	TAILQ_ENTRY(kmalloc_debug) entry;
+	const void *caller;
+	size_t	size;
+	uint32_t magic;
+} __aligned(16);
+
+#define	KMALLOC_OVERHEAD (sizeof(struct kmalloc_debug) + KMALLOC_REDZONE)
+
+static TAILQ_HEAD(, kmalloc_debug) kmalloc_live =
+    TAILQ_HEAD_INITIALIZER(kmalloc_live);
+#else
+#define	KMALLOC_OVERHEAD 0
+#endif
+
+struct kmalloc_object {
+	struct kmalloc_object *next;
+};
+
+struct kmalloc_cache {
+	struct kmalloc_object *head;
+	uint8_t *bump;
+	uint8_t *bump_end;
+	unsigned long count;
+	unsigned long allocs;
+	unsigned long frees;
+};
+
+struct kmalloc_thread {
+	TAILQ_ENTRY(kmalloc_thread) entry;
+	struct kmalloc_cache cache[KMALLOC_CLASS_MAX];
+};
+
+struct kmalloc_class {
+	struct kmalloc_object *head;
+	unsigned long count;
+	unsigned long chunks;
+	unsigned long allocs;		/* from exited threads */
+	unsigned long frees;		/* from exited threads */
+};
+
+static pthread_mutex_t kmalloc_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t kmalloc_once = PTHREAD_ONCE_INIT;
+static pthread_key_t kmalloc_key;
+static TAILQ_HEAD(, kmalloc_thread) kmalloc_threads =
+    TAILQ_HEAD_INITIALIZER(kmalloc_threads);
+static struct kmalloc_class kmalloc_class[KMALLOC_CLASS_MAX];
+static uint8_t *kmalloc_base;
+static unsigned long kmalloc_chunks;
+static uint8_t kmalloc_chunk_class[KMALLOC_CHUNK_MAX];
+static unsigned long kmalloc_large_allocs;
+static unsigned long kmalloc_large_frees;
+static __thread struct kmalloc_thread *kmalloc_self;
+
+#define	kmalloc_inc(p) \
+	__atomic_store_n(p, __atomic_load_n(p, __ATOMIC_RELAXED) + 1, __ATOMIC_RELAXED)
+
+static void kmalloc_thread_exit(void *);
+
+static void
+kmalloc_init(void)
+{
+	void *ptr;
+
+	ptr = mmap(NULL, KMALLOC_ARENA_SIZE, PROT_NONE,
+	    MAP_PRIVATE | MAP_ANON, -1, 0);
+	if (ptr != MAP_FAILED)
+		kmalloc_base = ptr;
+
+	memset(kmalloc_chunk_class, KMALLOC_CLASS_NONE,
+	    sizeof(kmalloc_chunk_class));
+
+	pthread_key_create(&kmalloc_key, &kmalloc_thread_exit);
+}
+
+static inline unsigned
+kmalloc_size_to_class(size_t size)
+{
+	if (size <= (1UL << KMALLOC_CLASS_SHIFT))
+		return (0);
+	return (BITS_PER_LONG - __builtin_clzl(size - 1) - KMALLOC_CLASS_SHIFT);
+}
+
+static inline size_t
+kmalloc_class_size(unsigned class)
+{
+	return (1UL << (class + KMALLOC_CLASS_SHIFT));
+}
+
+static inline unsigned
+kmalloc_ptr_to_class(const void *ptr)
+{
+	uintptr_t off = (uintptr_t)ptr - (uintptr_t)kmalloc_base;
+
+	if (kmalloc_base == NULL || off >= KMALLOC_ARENA_SIZE)
+		return (KMALLOC_CLASS_NONE);
+	return (kmalloc_chunk_class[off >> KMALLOC_CHUNK_SHIFT]);
+}
+
+static struct kmalloc_thread *
+kmalloc_thread_get(void)
+{
+	struct kmalloc_thread *pkt;
+
+	pthread_once(&kmalloc_once, &kmalloc_init);
+
+	pkt = calloc(1, sizeof(*pkt));
+	if (pkt == NULL)
+		return (NULL);
+
+	pthread_mutex_lock(&kmalloc_mtx);
+	TAILQ_INSERT_TAIL(&kmalloc_threads, pkt, entry);
+	pthread_mutex_unlock(&kmalloc_mtx);
+
+	pthread_setspecific(kmalloc_key, pkt);
+	kmalloc_self = pkt;
+	return (pkt);
+}
+
+/*
+ * Give all cached objects and the unused part of the bump ranges
+ * back to the global free lists. Called when a thread exits.
+ */
+static void
+kmalloc_thread_exit(void *arg)
+{
+	struct kmalloc_thread *pkt = arg;
+	struct kmalloc_cache *pc;
+	struct kmalloc_object *obj;
+	size_t size;
+	unsigned x;
+
+	pthread_mutex_lock(&kmalloc_mtx);
+	for (x = 0; x != KMALLOC_CLASS_MAX; x++) {
+		pc = &pkt->cache[x];
+		size = kmalloc_class_size(x);
+
+		while ((obj = pc->head) != NULL) {
+			pc->head = obj->next;
+			obj->next = kmalloc_class[x].head;
+			kmalloc_class[x].head = obj;
+			kmalloc_class[x].count++;
+		}
+		while (pc->bump != pc->bump_end) {
+			obj = (struct kmalloc_object *)pc->bump;
+			pc->bump += size;
+			obj->next = kmalloc_class[x].head;
+			kmalloc_class[x].head = obj;
+			kmalloc_class[x].count++;
+		}
+		kmalloc_class[x].allocs += pc->allocs;
+		kmalloc_class[x].frees += pc->frees;
+	}
+	TAILQ_REMOVE(&kmalloc_threads, pkt, entry);
+	pthread_mutex_unlock(&kmalloc_mtx);
+
+	if (kmalloc_self == pkt)
+		kmalloc_self = NULL;
+	free(pkt);
+}
+
+/*
+ * Refill a thread cache, first from the global free list and then
+ * by carving a new chunk. Returns zero on success.
+ */
+static int
+kmalloc_refill(struct kmalloc_cache *pc, unsigned class)
+{
+	struct kmalloc_class *pcl = &kmalloc_class[class];
+	struct kmalloc_object *obj;
+	unsigned long chunk;
+	unsigned n;
+
+	pthread_mutex_lock(&kmalloc_mtx);
+	if (pcl->head != NULL) {
+		for (n = 0; n != KMALLOC_CACHE_MAX / 2 &&
+		    (obj = pcl->head) != NULL; n++) {
+			pcl->head = obj->next;
+			obj->next = pc->head;
+			pc->head = obj;
+		}
+		pcl->count -= n;
+		pc->count += n;
+		pthread_mutex_unlock(&kmalloc_mtx);
+		return (0);
+	}
+	if (kmalloc_base == NULL || kmalloc_chunks == KMALLOC_CHUNK_MAX) {
+		pthread_mutex_unlock(&kmalloc_mtx);
+		return (ENOMEM);
+	}
+	chunk = kmalloc_chunks;
+	if (mprotect(kmalloc_base + (chunk << KMALLOC_CHUNK_SHIFT),
+	    KMALLOC_CHUNK_SIZE, PROT_READ | PROT_WRITE) != 0) {
+		pthread_mutex_unlock(&kmalloc_mtx);
+		return (ENOMEM);
+	}
+	kmalloc_chunks++;
+	pcl->chunks++;
+	kmalloc_chunk_class[chunk] = class;
+	pthread_mutex_unlock(&kmalloc_mtx);
+
+	pc->bump = kmalloc_base + (chunk << KMALLOC_CHUNK_SHIFT);
+	pc->bump_end = pc->bump + KMALLOC_CHUNK_SIZE;
+	return (0);
+}
+
+/*
+ * Move half of an overflowing thread cache to the global free list.
+ */
+static void
+kmalloc_drain(struct kmalloc_cache *pc, unsigned class)
+{
+	struct kmalloc_class *pcl = &kmalloc_class[class];
+	struct kmalloc_object *first;
+	struct kmalloc_object *last;
+	unsigned n;
+
+	first = last = pc->head;
+	for (n = 1; n != KMALLOC_CACHE_MAX / 2; n++)
+		last = last->next;
+	pc->head = last->next;
+	pc->count -= n;
+
+	pthread_mutex_lock(&kmalloc_mtx);
+	last->next = pcl->head;
+	pcl->head = first;
+	pcl->count += n;
+	pthread_mutex_unlock(&kmalloc_mtx);
+}
+
+static void *
+kmalloc_arena(size_t size, gfp_t flags)
+{
+	struct kmalloc_thread *pkt;
+	struct kmalloc_cache *pc;
+	struct kmalloc_object *obj;
+	unsigned class;
+
+	pkt = kmalloc_self;
+	if (__predict_false(pkt == NULL)) {
+		pkt = kmalloc_thread_get();
+		if (pkt == NULL)
+			return (NULL);
+	}
+	class = kmalloc_size_to_class(size);
+	pc = &pkt->cache[class];
+
+	if (pc->head == NULL && pc->bump == pc->bump_end &&
+	    kmalloc_refill(pc, class) != 0)
+		return (NULL);
+
+	kmalloc_inc(&pc->allocs);
+
+	if ((obj = pc->head) != NULL) {
+		pc->head = obj->next;
+		pc->count--;
+		if (flags & __GFP_ZERO)
+			memset(obj, 0, size);
+		return (obj);
+	}
+	/* memory in the bump range has never been used and is zero */
+	obj = (struct kmalloc_object *)pc->bump;
+	pc->bump += kmalloc_class_size(class);
+	return (obj);
+}
+
+static void
+kfree_arena(void *ptr, unsigned class)
+{
+	struct kmalloc_thread *pkt;
+	struct kmalloc_cache *pc;
+	struct kmalloc_object *obj = ptr;
+
+	pkt = kmalloc_self;
+	if (__predict_false(pkt == NULL)) {
+		pkt = kmalloc_thread_get();
+		if (pkt == NULL) {
+			/* leak rather than corrupt */
+			return;
+		}
+	}
+	pc = &pkt->cache[class];
+
+	kmalloc_inc(&pc->frees);
+
+	obj->next = pc->head;
+	pc->head = obj;
+	if (++(pc->count) > KMALLOC_CACHE_MAX)
+		kmalloc_drain(pc, class);
+}
+
+#ifdef HAVE_KMALLOC_DEBUG
+static void *
+kmalloc_debug_alloc(size_t size, gfp_t flags, const void *caller)
+{
+	struct kmalloc_debug *pkd;
+
+	pkd = kmalloc_arena(size + KMALLOC_OVERHEAD, flags);
+	if (pkd == NULL)
+		return (NULL);
+	pkd->caller = caller;
+	pkd->size = size;
+	pkd->magic = KMALLOC_MAGIC_LIVE;
+	memset((uint8_t *)(pkd + 1) + size, KMALLOC_REDZONE_BYTE,
+	    KMALLOC_REDZONE);
+
+	pthread_mutex_lock(&kmalloc_mtx);
+	TAILQ_INSERT_TAIL(&kmalloc_live, pkd, entry);
+	pthread_mutex_unlock(&kmalloc_mtx);
+
+	return (pkd + 1);
+}
+
+static void
+kmalloc_debug_free(void *ptr, unsigned class, const void *caller)
+{
+	struct kmalloc_debug *pkd = (struct kmalloc_debug *)ptr - 1;
+	const uint8_t *rz;
+	unsigned x;
+
+	if (pkd->magic != KMALLOC_MAGIC_LIVE) {
+		syslog(LOG_ERR, "kfree: %s of %p by %p\n",
+		    (pkd->magic == KMALLOC_MAGIC_FREE) ?
+		    "double free" : "invalid free", ptr, caller);
+		return;
+	}
+	rz = (const uint8_t *)ptr + pkd->size;
+	for (x = 0; x != KMALLOC_REDZONE; x++) {
+		if (rz[x] != KMALLOC_REDZONE_BYTE) {
+			syslog(LOG_ERR, "kfree: redzone of %p (%zu bytes) "
+			    "allocated by %p overwritten\n",
+			    ptr, pkd->size, pkd->caller);
+			break;
+		}
+	}
+	pthread_mutex_lock(&kmalloc_mtx);
+	TAILQ_REMOVE(&kmalloc_live, pkd, entry);
+	pthread_mutex_unlock(&kmalloc_mtx);
+
+	pkd->magic = KMALLOC_MAGIC_FREE;
+	pkd->caller = caller;
+	memset(ptr, KMALLOC_POISON_BYTE, pkd->size + KMALLOC_REDZONE);
+
+	kfree_arena(pkd, class);
+}
+#endif
+
+void   *
+kmalloc(size_t size, gfp_t flags)
+{
+	void *ptr;
+
+	if (size <= KMALLOC_SIZE_MAX - KMALLOC_OVERHEAD) {
+#ifdef HAVE_KMALLOC_DEBUG
+		ptr = kmalloc_debug_alloc(size, flags,
+		    __builtin_return_address(0));
+#else
+		ptr = kmalloc_arena(size, flags);
+#endif
+		if (__predict_true(ptr != NULL))
+			return (ptr);
+	}
+	__atomic_fetch_add(&kmalloc_large_allocs, 1, __ATOMIC_RELAXED);
+
+	if (flags & __GFP_ZERO)
+		return (calloc(1, size));	/* memory must be zeroed */
+	else
+		return (malloc(size));
+}
+
+void
+kfree(const void *ptr)
+{
+	unsigned class;
+
+	if (ptr == NULL)
+		return;
+
+	class = kmalloc_ptr_to_class(ptr);
+	if (class == KMALLOC_CLASS_NONE) {
+		__atomic_fetch_add(&kmalloc_large_frees, 1, __ATOMIC_RELAXED);
+		free(GP_DECONST(ptr));
+		return;
+	}
+#ifdef HAVE_KMALLOC_DEBUG
+	kmalloc_debug_free(GP_DECONST(ptr), class,
+	    __builtin_return_address(0));
+#else
+	kfree_arena(GP_DECONST(ptr), class);
+#endif
+}
+
+size_t
+ksize(const void *ptr)
+{
+	unsigned class;
+
+	if (ptr == NULL)
+		return (0);
+	class = kmalloc_ptr_to_class(ptr);
+	if (class == KMALLOC_CLASS_NONE)
+		return (0);		/* unknown */
+#ifdef HAVE_KMALLOC_DEBUG
+	return (((const struct kmalloc_debug *)ptr - 1)->size);
+#else
+	return (kmalloc_class_size(class));
+#endif
+}
+
+void   *
+krealloc(const void *ptr, size_t size, gfp_t flags)
+{
+	size_t old;
+	void *dst;
+
+	if (ptr == NULL)
+		return (kmalloc(size, flags));
+
+	if (kmalloc_ptr_to_class(ptr) == KMALLOC_CLASS_NONE)
+		return (realloc(GP_DECONST(ptr), size));
+
+	old = ksize(ptr);
+	if (size <= old) {
+#ifdef HAVE_KMALLOC_DEBUG
+		if (size != old)
+			goto copy;
+#endif
+		return (GP_DECONST(ptr));
+	}
+#ifdef HAVE_KMALLOC_DEBUG
+copy:
+#endif
+	dst = kmalloc(size, flags);
+	if (dst == NULL)
+		return (NULL);
+	memcpy(dst, ptr, (size < old) ? size : old);
+	if ((flags & __GFP_ZERO) && size > old)
+		memset((uint8_t *)dst + old, 0, size - old);
+	kfree(ptr);
+	return (dst);
+}
+
+void   *
+kcalloc(size_t n, size_t size, gfp_t flags)
+{
+	return (kmalloc_array(n, size, flags | __GFP_ZERO));
+}
+
+void   *
+kmalloc_array(size_t n, size_t s, gfp_t flags)
+{
+	size_t total = n * s;
+
+	if (total != 0 && (total / n) != s)
+		return (NULL);
+	else
+		return (kmalloc(total, flags));
+}
+
+/*
+ * Print per size class statistics and, when compiled with
+ * HAVE_KMALLOC_DEBUG, all live allocations.
+ */
+void
+kmalloc_stats(FILE *fp)
+{
+	struct kmalloc_thread *pkt;
+	unsigned long allocs;
+	unsigned long frees;
+	unsigned long cached;
+	unsigned x;
+
+	pthread_mutex_lock(&kmalloc_mtx);
+	fprintf(fp, "kmalloc: %lu of %lu chunks in use\n",
+	    kmalloc_chunks, (unsigned long)KMALLOC_CHUNK_MAX);
+	fprintf(fp, "kmalloc: %8s %12s %12s %10s %10s %8s\n",
+	    "size", "allocs", "frees", "in-use", "cached", "chunks");
+
+	for (x = 0; x != KMALLOC_CLASS_MAX; x++) {
+		allocs = kmalloc_class[x].allocs;
+		frees = kmalloc_class[x].frees;
+		cached = kmalloc_class[x].count;
+
+		TAILQ_FOREACH(pkt, &kmalloc_threads, entry) {
+			allocs += __atomic_load_n(&pkt->cache[x].allocs,
+			    __ATOMIC_RELAXED);
+			frees += __atomic_load_n(&pkt->cache[x].frees,
+			    __ATOMIC_RELAXED);
+			cached += __atomic_load_n(&pkt->cache[x].count,
+			    __ATOMIC_RELAXED);
+		}
+		if (allocs == 0 && kmalloc_class[x].chunks == 0)
+			continue;
+		fprintf(fp, "kmalloc: %8zu %12lu %12lu %10ld %10lu %8lu\n",
+		    kmalloc_class_size(x), allocs, frees,
+		    (long)(allocs - frees), cached, kmalloc_class[x].chunks);
+	}
+	fprintf(fp, "kmalloc: %8s %12lu %12lu\n", "large",
+	    __atomic_load_n(&kmalloc_large_allocs, __ATOMIC_RELAXED),
+	    __atomic_load_n(&kmalloc_large_frees, __ATOMIC_RELAXED));
+
+#ifdef HAVE_KMALLOC_DEBUG
+	struct kmalloc_debug *pkd;
+
+	TAILQ_FOREACH(pkd, &kmalloc_live, entry) {
+		fprintf(fp, "kmalloc: live %p size %zu caller %p\n",
+		    (void *)(pkd + 1), pkd->size, pkd->caller);
+	}
+#endif
+	pthread_mutex_unlock(&kmalloc_mtx);
+}
@@ -0,0 +1,1102 @@
+/*-
+ * Copyright (c) 2009-2021 Hans Petter Selasky. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Generic helpers from the Linux kernel library, which do not depend
+ * on the media tree and can be linked by tools/kernel_bench.
+ *
+ * NOTE: Some functions in this file derive directly from the Linux kernel
+ * sources and are covered by the GPLv2.
+ */
+
+#if defined(__amd64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#endif
+
+int
+test_bit(int nr, const void *addr)
+{
+	unsigned long mask = BIT_MASK(nr);
+	unsigned long *p = ((unsigned long *)addr) + BIT_WORD(nr);
+	int i;
+
+	atomic_lock();
+	i = (*p & mask) ? 1 : 0;
+	atomic_unlock();
+
+	return (i);
+}
+
+int
+test_and_set_bit(int nr, volatile unsigned long *addr)
+{
+	unsigned long mask = BIT_MASK(nr);
+	unsigned long *p = ((unsigned long *)addr) + BIT_WORD(nr);
+	unsigned long old;
+
+	atomic_lock();
+	old = *p;
+	*p = old | mask;
+	atomic_unlock();
+	return (old & mask) != 0;
+}
+
+int
+test_and_clear_bit(int nr, volatile unsigned long *addr)
+{
+	unsigned long mask = BIT_MASK(nr);
+	unsigned long *p = ((unsigned long *)addr) + BIT_WORD(nr);
+	unsigned long old;
+
+	atomic_lock();
+	old = *p;
+	*p = old & ~mask;
+	atomic_unlock();
+
+	return (old & mask) != 0;
+}
+
+void
+set_bit(int nr, volatile unsigned long *addr)
+{
+	unsigned long mask = BIT_MASK(nr);
+	unsigned long *p = ((unsigned long *)addr) + BIT_WORD(nr);
+
+	atomic_lock();
+	*p |= mask;
+	atomic_unlock();
+}
+
+void
+clear_bit(int nr, volatile unsigned long *addr)
+{
+	unsigned long mask = BIT_MASK(nr);
+	unsigned long *p = ((unsigned long *)addr) + BIT_WORD(nr);
+
+	atomic_lock();
+	*p &= ~mask;
+	atomic_unlock();
+}
+
+void
+change_bit(int nr, volatile unsigned long *addr)
+{
+	unsigned long mask = BIT_MASK(nr);
+	unsigned long *p = ((unsigned long *)addr) + BIT_WORD(nr);
+
+	atomic_lock();
+	*p ^= mask;
+	atomic_unlock();
+}
+
+uint8_t
+bitrev8(uint8_t a)
+{
+	a = ((a & 0x55) << 1) | ((a & 0xAA) >> 1);
+	a = ((a & 0x33) << 2) | ((a & 0xCC) >> 2);
+	a = ((a & 0x0F) << 4) | ((a & 0xF0) >> 4);
+	return (a);
+}
+
+uint16_t
+bitrev16(uint16_t a)
+{
+	a = ((a & 0x5555) << 1) | ((a & 0xAAAA) >> 1);
+	a = ((a & 0x3333) << 2) | ((a & 0xCCCC) >> 2);
+	a = ((a & 0x0F0F) << 4) | ((a & 0xF0F0) >> 4);
+	a = ((a & 0x00FF) << 8) | ((a & 0xFF00) >> 8);
+	return (a);
+}
+
+size_t
+memweight(const void *ptr, size_t bytes)
+{
+	const uint8_t *p = ptr;
+	unsigned long temp;
+	size_t y = 0;
+
+	for (; bytes >= sizeof(long); bytes -= sizeof(long)) {
+		memcpy(&temp, p, sizeof(long));
+		y += __builtin_popcountl(temp);
+		p += sizeof(long);
+	}
+	while (bytes--)
+		y += __builtin_popcount(*p++);
+	return (y);
+}
+
+unsigned int
+hweight8(unsigned int w)
+{
+	return (__builtin_popcount(w & 0xFF));
+}
+
+unsigned int
+hweight16(unsigned int w)
+{
+	return (__builtin_popcount(w & 0xFFFF));
+}
+
+unsigned int
+hweight32(unsigned int w)
+{
+	return (__builtin_popcount(w));
+}
+
+unsigned long
+hweight64(uint64_t w)
+{
+	return (__builtin_popcountll(w));
+}
+
+void   *
+ERR_PTR(long error)
+{
+	return ((void *)error);
+}
+
+long
+PTR_ERR(const void *ptr)
+{
+	return ((long)ptr);
+}
+
+long
+IS_ERR(const void *ptr)
+{
+	return IS_ERR_VALUE((unsigned long)ptr);
+}
+
+int
+PTR_ERR_OR_ZERO(const void *ptr)
+{
+	if (IS_ERR(ptr))
+		return PTR_ERR(ptr);
+	else
+		return 0;
+}
+
+int
+__ffs(int x)
+{
+	if (x == 0)
+		return (0);
+	return (__builtin_ctz(x));
+}
+
+int
+__ffz(int x)
+{
+	if (~x == 0)
+		return (0);
+	return (__builtin_ctz(~x));
+}
+
+int
+fls(int mask)
+{
+	if (mask == 0)
+		return (0);
+	return (32 - __builtin_clz(mask));
+}
+
+unsigned long
+find_next_bit(const unsigned long *addr, unsigned long size,
+    unsigned long offset)
+{
+	unsigned long temp;
+
+	if (offset >= size)
+		return (size);
+	temp = addr[BIT_WORD(offset)] & BITMAP_FIRST_WORD_MASK(offset);
+	offset &= ~(unsigned long)(BITS_PER_LONG - 1);
+	while (temp == 0) {
+		offset += BITS_PER_LONG;
+		if (offset >= size)
+			return (size);
+		temp = addr[BIT_WORD(offset)];
+	}
+	offset += __builtin_ctzl(temp);
+	if (offset > size)
+		offset = size;
+	return (offset);
+}
+
+unsigned long
+find_next_zero_bit(const unsigned long *addr, unsigned long size,
+    unsigned long offset)
+{
+	unsigned long temp;
+
+	if (offset >= size)
+		return (size);
+	temp = ~addr[BIT_WORD(offset)] & BITMAP_FIRST_WORD_MASK(offset);
+	offset &= ~(unsigned long)(BITS_PER_LONG - 1);
+	while (temp == 0) {
+		offset += BITS_PER_LONG;
+		if (offset >= size)
+			return (size);
+		temp = ~addr[BIT_WORD(offset)];
+	}
+	offset += __builtin_ctzl(temp);
+	if (offset > size)
+		offset = size;
+	return (offset);
+}
+
+unsigned long *
+bitmap_alloc(unsigned int nbits, gfp_t flags)
+{
+	return (kmalloc_array(BITS_TO_LONGS(nbits), sizeof(long), flags));
+}
+
+unsigned long *
+bitmap_zalloc(unsigned int nbits, gfp_t flags)
+{
+	return (kmalloc_array(BITS_TO_LONGS(nbits), sizeof(long), flags | __GFP_ZERO));
+}
+
+void
+bitmap_free(unsigned long *ptr)
+{
+	kfree(ptr);
+}
+
+void
+bitmap_copy(unsigned long *dst, const unsigned long *src, unsigned int nbits)
+{
+	const size_t len = BITS_TO_LONGS(nbits) * sizeof(long);
+
+	memcpy(dst, src, len);
+}
+
+int
+bitmap_weight(const unsigned long *src, unsigned nbits)
+{
+	unsigned end = nbits / BITS_PER_LONG;
+	unsigned x;
+	unsigned y;
+
+	for (x = y = 0; x != end; x++)
+		y += __builtin_popcountl(src[x]);
+
+	if (nbits % BITS_PER_LONG)
+		y += __builtin_popcountl(src[x] & BITMAP_LAST_WORD_MASK(nbits));
+	return (y);
+}
+
+int
+bitmap_andnot(unsigned long *dst, const unsigned long *b1,
+    const unsigned long *b2, int nbits)
+{
+	int len = (nbits + BITS_PER_LONG - 1) / BITS_PER_LONG;
+	long retval = 0;
+	long temp;
+	int n;
+
+	for (n = 0; n != len; n++) {
+		temp = b1[n] & ~b2[n];
+		if (n == len - 1)
+			temp &= BITMAP_LAST_WORD_MASK(nbits);
+		dst[n] = temp;
+		retval |= temp;
+	}
+	return (retval != 0);
+}
+
+int
+bitmap_and(unsigned long *dst, const unsigned long *b1,
+    const unsigned long *b2, int nbits)
+{
+	int len = (nbits + BITS_PER_LONG - 1) / BITS_PER_LONG;
+	long retval = 0;
+	long temp;
+	int n;
+
+	for (n = 0; n != len; n++) {
+		temp = b1[n] & b2[n];
+		if (n == len - 1)
+			temp &= BITMAP_LAST_WORD_MASK(nbits);
+		dst[n] = temp;
+		retval |= temp;
+	}
+	return (retval != 0);
+}
+
+void
+bitmap_or(unsigned long *dst, const unsigned long *b1,
+    const unsigned long *b2, int nbits)
+{
+	int len = (nbits + BITS_PER_LONG - 1) / BITS_PER_LONG;
+	long temp;
+	int n;
+
+	for (n = 0; n != len; n++) {
+		temp = b1[n] | b2[n];
+		dst[n] = temp;
+	}
+}
+
+void
+bitmap_xor(unsigned long *dst, const unsigned long *b1,
+    const unsigned long *b2, int nbits)
+{
+	int len = (nbits + BITS_PER_LONG - 1) / BITS_PER_LONG;
+	long temp;
+	int n;
+
+	for (n = 0; n != len; n++) {
+		temp = b1[n] ^ b2[n];
+		dst[n] = temp;
+	}
+}
+
+void
+bitmap_fill(unsigned long *dst, unsigned int nbits)
+{
+  	const size_t len = BITS_TO_LONGS(nbits) * sizeof(long);
+
+	memset(dst, 255, len);
+}
+
+void
+bitmap_zero(unsigned long *dst, unsigned int nbits)
+{
+  	const size_t len = BITS_TO_LONGS(nbits) * sizeof(long);
+
+	memset(dst, 0, len);
+}
+
+int
+bitmap_subset(const unsigned long *pa, const unsigned long *pb, int nbits)
+{
+	int end = nbits / BITS_PER_LONG;
+	int x;
+
+	for (x = 0; x != end; x++) {
+		if (pa[x] & ~pb[x])
+			return (0);
+	}
+
+	x = nbits % BITS_PER_LONG;
+	if (x) {
+		if (pa[end] & ~pb[end] & ((1ULL << x) - 1ULL))
+			return (0);
+	}
+	return (1);
+}
+
+int
+bitmap_full(const unsigned long *bitmap, int bits)
+{
+	int k;
+	int lim = bits / BITS_PER_LONG;
+
+	for (k = 0; k < lim; ++k)
+		if (~bitmap[k])
+			return (0);
+
+	lim = bits % BITS_PER_LONG;
+	if (lim) {
+		if ((~bitmap[k]) & ((1ULL << lim) - 1ULL))
+			return (0);
+	}
+	return (1);
+}
+
+void
+bitmap_clear(unsigned long *map, int start, int nr)
+{
+	unsigned long *p = map + BIT_WORD(start);
+	const int size = start + nr;
+	int bits_to_clear = BITS_PER_LONG - (start % BITS_PER_LONG);
+	unsigned long mask_to_clear = BITMAP_FIRST_WORD_MASK(start);
+
+	while (nr - bits_to_clear >= 0) {
+		*p &= ~mask_to_clear;
+		nr -= bits_to_clear;
+		bits_to_clear = BITS_PER_LONG;
+		mask_to_clear = ~0UL;
+		p++;
+	}
+	if (nr) {
+		mask_to_clear &= BITMAP_LAST_WORD_MASK(size);
+		*p &= ~mask_to_clear;
+	}
+}
+
+void
+bitmap_shift_right(unsigned long *dst, const unsigned long *src, int n, int nbits)
+{
+	const unsigned long mask = BITMAP_LAST_WORD_MASK(nbits);
+	const unsigned lim = BITS_TO_LONGS(nbits);
+	const unsigned off = n / BITS_PER_LONG;
+	const unsigned rem = n % BITS_PER_LONG;
+	unsigned long lower;
+	unsigned long upper;
+	unsigned k;
+
+	if (off >= lim) {
+		memset(dst, 0, lim * sizeof(long));
+		return;
+	}
+	for (k = 0; off + k < lim; k++) {
+		if (rem == 0 || off + k + 1 >= lim) {
+			upper = 0;
+		} else {
+			upper = src[off + k + 1];
+			if (off + k + 1 == lim - 1)
+				upper &= mask;
+			upper <<= (BITS_PER_LONG - rem);
+		}
+		lower = src[off + k];
+		if (off + k == lim - 1)
+			lower &= mask;
+		lower >>= rem;
+		dst[k] = lower | upper;
+	}
+	memset(dst + lim - off, 0, off * sizeof(long));
+}
+
+void
+bitmap_shift_left(unsigned long *dst, const unsigned long *src, int n, int nbits)
+{
+	const unsigned lim = BITS_TO_LONGS(nbits);
+	const unsigned off = n / BITS_PER_LONG;
+	const unsigned rem = n % BITS_PER_LONG;
+	unsigned long lower;
+	unsigned long upper;
+	int k;
+
+	if (off >= lim) {
+		memset(dst, 0, lim * sizeof(long));
+		return;
+	}
+	for (k = lim - off - 1; k >= 0; k--) {
+		if (rem != 0 && k > 0)
+			lower = src[k - 1] >> (BITS_PER_LONG - rem);
+		else
+			lower = 0;
+		upper = src[k] << rem;
+		dst[k + off] = lower | upper;
+	}
+	memset(dst, 0, off * sizeof(long));
+}
+
+int
+bitmap_equal(const unsigned long *pa,
+    const unsigned long *pb, unsigned bits)
+{
+	unsigned k;
+	unsigned lim = bits / BITS_PER_LONG;
+
+	for (k = 0; k != lim; k++)
+		if (pa[k] != pb[k])
+			return (0);
+
+	if (bits % BITS_PER_LONG) {
+		if ((pa[k] ^ pb[k]) & BITMAP_LAST_WORD_MASK(bits))
+			return (0);
+	}
+	return (1);
+}
+
+int
+bitmap_empty(const unsigned long *pa, unsigned bits)
+{
+	unsigned k;
+	unsigned lim = bits / BITS_PER_LONG;
+
+	for (k = 0; k != lim; k++)
+		if (pa[k] != 0)
+			return (0);
+
+	if (bits % BITS_PER_LONG) {
+		if (pa[k] & BITMAP_LAST_WORD_MASK(bits))
+			return (0);
+	}
+	return (1);
+}
+
+int
+bitmap_intersects(const unsigned long *pa,
+    const unsigned long *pb, unsigned bits)
+{
+	unsigned k;
+	unsigned lim = bits / BITS_PER_LONG;
+
+	for (k = 0; k != lim; k++)
+		if (pa[k] & pb[k])
+			return (1);
+
+	if (bits % BITS_PER_LONG) {
+		if ((pa[k] & pb[k]) & BITMAP_LAST_WORD_MASK(bits))
+			return (1);
+	}
+	return (0);
+}
+
+/*
+ * Print a JSON string literal, escaping as needed. Used by the
+ * statistics snapshots of the control socket.
+ */
+void
+json_print_string(FILE *fp, const char *str)
+{
+	uint8_t ch;
+
+	fputc('"', fp);
+	while (str != NULL && (ch = *str++) != 0) {
+		if (ch == '"' || ch == '\\')
+			fprintf(fp, "\\%c", ch);
+		else if (ch < 0x20)
+			fprintf(fp, "\\u%04x", ch);
+		else
+			fputc(ch, fp);
+	}
+	fputc('"', fp);
+}
+
+/* standard CRC computation */
+
+static u32 crc32_le_table[8][256];
+static u32 crc32_be_table[8][256];
+
+#if defined(__amd64__) || defined(__i386__) || defined(__aarch64__)
+static u32 (*crc32_le_hw) (u32, unsigned char const *, size_t);
+static u32 (*crc32_le_hw_found) (u32, unsigned char const *, size_t);
+#endif
+
+static u32
+crc32_le_bitwise(u32 crc, unsigned char const *p, size_t len)
+{
+	uint8_t i;
+
+	while (len--) {
+		crc ^= *p++;
+		for (i = 0; i != 8; i++)
+			crc = (crc >> 1) ^ ((crc & 1) ? CRCPOLY_LE : 0);
+	}
+	return crc;
+}
+
+static u32
+crc32_be_bitwise(u32 crc, unsigned char const *p, size_t len)
+{
+	uint8_t i;
+
+	while (len--) {
+		crc ^= (u32)*p++ << 24;
+		for (i = 0; i != 8; i++)
+			crc =
+			    (crc << 1) ^ ((crc & 0x80000000) ? CRCPOLY_BE : 0);
+	}
+	return crc;
+}
+
+#if defined(__amd64__) || defined(__i386__)
+/*
+ * CRC folding using carry-less multiplication, as described in the
+ * Intel white paper "Fast CRC Computation for Generic Polynomials
+ * Using PCLMULQDQ Instruction". The length must be a multiple of 16
+ * and at least 64 bytes.
+ */
+static u32 __attribute__((__target__("pclmul,sse4.1")))
+crc32_le_pclmul(u32 crc, unsigned char const *p, size_t len)
+{
+	static const uint64_t k1k2[2] __aligned(16) = { 0x154442bd4, 0x1c6e41596 };
+	static const uint64_t k3k4[2] __aligned(16) = { 0x1751997d0, 0x0ccaa009e };
+	static const uint64_t k5k0[2] __aligned(16) = { 0x163cd6124, 0x000000000 };
+	static const uint64_t poly[2] __aligned(16) = { 0x1db710641, 0x1f7011641 };
+	__m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+	x1 = _mm_loadu_si128((const __m128i *)(p + 0x00));
+	x2 = _mm_loadu_si128((const __m128i *)(p + 0x10));
+	x3 = _mm_loadu_si128((const __m128i *)(p + 0x20));
+	x4 = _mm_loadu_si128((const __m128i *)(p + 0x30));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+	x0 = _mm_load_si128((const __m128i *)k1k2);
+	p += 64;
+	len -= 64;
+
+	/* fold blocks of 64 bytes in parallel */
+	while (len >= 64) {
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5),
+		    _mm_loadu_si128((const __m128i *)(p + 0x00)));
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6),
+		    _mm_loadu_si128((const __m128i *)(p + 0x10)));
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7),
+		    _mm_loadu_si128((const __m128i *)(p + 0x20)));
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8),
+		    _mm_loadu_si128((const __m128i *)(p + 0x30)));
+		p += 64;
+		len -= 64;
+	}
+
+	/* fold into 128 bits */
+	x0 = _mm_load_si128((const __m128i *)k3k4);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+	/* fold remaining blocks of 16 bytes, if any */
+	while (len >= 16) {
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1,
+		    _mm_loadu_si128((const __m128i *)p)), x5);
+		p += 16;
+		len -= 16;
+	}
+
+	/* fold 128 bits into 64 bits */
+	x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+	x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+
+	x0 = _mm_loadl_epi64((const __m128i *)k5k0);
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, x3);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	/* Barrett reduction into 32 bits */
+	x0 = _mm_load_si128((const __m128i *)poly);
+	x2 = _mm_and_si128(x1, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+	x2 = _mm_and_si128(x2, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	return (_mm_extract_epi32(x1, 1));
+}
+#endif
+
+#if defined(__aarch64__) && defined(HWCAP_CRC32)
+#if defined(__clang__)
+#define	CRC32_ARM_TARGET __attribute__((__target__("crc")))
+#else
+#define	CRC32_ARM_TARGET __attribute__((__target__("+crc")))
+#endif
+
+static u32 CRC32_ARM_TARGET
+crc32_le_armv8(u32 crc, unsigned char const *p, size_t len)
+{
+	uint64_t temp;
+
+	for (; len >= 8; len -= 8, p += 8) {
+		memcpy(&temp, p, 8);
+		crc = __crc32d(crc, le64toh(temp));
+	}
+	while (len--)
+		crc = __crc32b(crc, *p++);
+	return (crc);
+}
+#endif
+
+/*
+ * Build the slicing-by-8 tables and select the hardware accelerated
+ * CRC function, if any. The hardware accelerated function is only
+ * used when it gives the same results like the bitwise reference.
+ */
+void
+crc32_init(void)
+{
+	static uint8_t buf[512];
+	u32 crc;
+	unsigned n;
+	unsigned x;
+
+	for (n = 0; n != 256; n++) {
+		buf[0] = n;
+		crc32_le_table[0][n] = crc32_le_bitwise(0, buf, 1);
+		crc32_be_table[0][n] = crc32_be_bitwise(0, buf, 1);
+	}
+	for (n = 0; n != 256; n++) {
+		for (x = 1; x != 8; x++) {
+			crc = crc32_le_table[x - 1][n];
+			crc32_le_table[x][n] = (crc >> 8) ^
+			    crc32_le_table[0][crc & 0xFF];
+			crc = crc32_be_table[x - 1][n];
+			crc32_be_table[x][n] = (crc << 8) ^
+			    crc32_be_table[0][crc >> 24];
+		}
+	}
+
+#if defined(__amd64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("pclmul") &&
+	    __builtin_cpu_supports("sse4.1"))
+		crc32_le_hw = &crc32_le_pclmul;
+#elif defined(__aarch64__) && defined(HWCAP_CRC32)
+	{
+		u_long hwcap = 0;
+
+#if defined(__linux__)
+		hwcap = getauxval(AT_HWCAP);
+#else
+		if (elf_aux_info(AT_HWCAP, &hwcap, sizeof(hwcap)) != 0)
+			hwcap = 0;
+#endif
+		if ((hwcap & HWCAP_CRC32) != 0)
+			crc32_le_hw = &crc32_le_armv8;
+	}
+#endif
+
+#if defined(__amd64__) || defined(__i386__) || defined(__aarch64__)
+	if (crc32_le_hw != NULL) {
+		for (n = 0; n != sizeof(buf); n++)
+			buf[n] = n * 0x9E + (n >> 3);
+		for (n = 64; n <= sizeof(buf); n += 16) {
+			crc = -1U + n;
+			if (crc32_le_hw(crc, buf, n) !=
+			    crc32_le_bitwise(crc, buf, n)) {
+				printf("WARNING: Hardware CRC32 mismatch, disabled\n");
+				crc32_le_hw = NULL;
+				break;
+			}
+		}
+	}
+	crc32_le_hw_found = crc32_le_hw;
+#endif
+}
+
+/*
+ * Enable or disable the hardware accelerated crc32_le(), if any, so
+ * that tools/kernel_bench can check and time both code paths.
+ * Returns non-zero if the hardware accelerated function is in use.
+ */
+int
+crc32_le_hw_select(int enable)
+{
+#if defined(__amd64__) || defined(__i386__) || defined(__aarch64__)
+	crc32_le_hw = enable ? crc32_le_hw_found : NULL;
+	return (crc32_le_hw != NULL);
+#else
+	return (0);
+#endif
+}
+
+u32
+crc32_le(u32 crc, unsigned char const *p, size_t len)
+{
+	uint32_t lo;
+	uint32_t hi;
+
+#if defined(__amd64__) || defined(__i386__) || defined(__aarch64__)
+	if (crc32_le_hw != NULL && len >= 64) {
+		size_t n = len & ~(size_t)15;
+
+		crc = crc32_le_hw(crc, p, n);
+		p += n;
+		len -= n;
+	}
+#endif
+	for (; len >= 8; len -= 8, p += 8) {
+		memcpy(&lo, p, 4);
+		memcpy(&hi, p + 4, 4);
+		lo = le32toh(lo) ^ crc;
+		hi = le32toh(hi);
+		crc = crc32_le_table[7][lo & 0xFF] ^
+		    crc32_le_table[6][(lo >> 8) & 0xFF] ^
+		    crc32_le_table[5][(lo >> 16) & 0xFF] ^
+		    crc32_le_table[4][lo >> 24] ^
+		    crc32_le_table[3][hi & 0xFF] ^
+		    crc32_le_table[2][(hi >> 8) & 0xFF] ^
+		    crc32_le_table[1][(hi >> 16) & 0xFF] ^
+		    crc32_le_table[0][hi >> 24];
+	}
+	while (len--)
+		crc = (crc >> 8) ^ crc32_le_table[0][(crc ^ *p++) & 0xFF];
+	return crc;
+}
+
+u32
+crc32_be(u32 crc, unsigned char const *p, size_t len)
+{
+	uint32_t lo;
+	uint32_t hi;
+
+	for (; len >= 8; len -= 8, p += 8) {
+		memcpy(&lo, p, 4);
+		memcpy(&hi, p + 4, 4);
+		lo = be32toh(lo) ^ crc;
+		hi = be32toh(hi);
+		crc = crc32_be_table[7][lo >> 24] ^
+		    crc32_be_table[6][(lo >> 16) & 0xFF] ^
+		    crc32_be_table[5][(lo >> 8) & 0xFF] ^
+		    crc32_be_table[4][lo & 0xFF] ^
+		    crc32_be_table[3][hi >> 24] ^
+		    crc32_be_table[2][(hi >> 16) & 0xFF] ^
+		    crc32_be_table[1][(hi >> 8) & 0xFF] ^
+		    crc32_be_table[0][hi & 0xFF];
+	}
+	while (len--)
+		crc = (crc << 8) ^ crc32_be_table[0][(crc >> 24) ^ *p++];
+	return crc;
+}
+
+/*
+ * Non-recursive introspective sort. Partitions are sorted using
+ * quicksort with median of three pivoting. Small partitions are
+ * finished using insertion sort and partitions which recurse too
+ * deep are finished using heapsort, so that the worst case stays
+ * O(n log n). The heapsort part derives from:
+ *
+ * A fast, small, non-recursive O(nlog n) sort for the Linux kernel
+ *
+ * Jan 23 2005  Matt Mackall <mpm@selenic.com>
+ */
+
+#define	SORT_INSERTION_MAX 12
+
+typedef int (sort_cmp_t)(const void *, const void *);
+typedef void (sort_swap_t)(void *, void *, int);
+
+static inline __attribute__((__always_inline__)) void
+sort_swap(char *a, char *b, size_t size, sort_swap_t *swap_fn)
+{
+	unsigned long tl;
+	uint64_t t64;
+	uint32_t t32;
+	char t;
+
+	if (swap_fn != NULL) {
+		swap_fn(a, b, size);
+	} else if (size == 4) {
+		memcpy(&t32, a, 4);
+		memcpy(a, b, 4);
+		memcpy(b, &t32, 4);
+	} else if (size == 8) {
+		memcpy(&t64, a, 8);
+		memcpy(a, b, 8);
+		memcpy(b, &t64, 8);
+	} else if (((uintptr_t)a | (uintptr_t)b | size) % sizeof(long) == 0) {
+		do {
+			tl = *(unsigned long *)a;
+			*(unsigned long *)a = *(unsigned long *)b;
+			*(unsigned long *)b = tl;
+			a += sizeof(long);
+			b += sizeof(long);
+		} while ((size -= sizeof(long)) != 0);
+	} else {
+		do {
+			t = *a;
+			*a++ = *b;
+			*b++ = t;
+		} while (--size != 0);
+	}
+}
+
+static inline __attribute__((__always_inline__)) void
+sort_heap(char *base, size_t num, size_t size, sort_cmp_t *cmp,
+    sort_swap_t *swap_fn)
+{
+	/* pre-scale counters for performance */
+	size_t n = num * size;
+	size_t i = (num / 2) * size;
+	size_t c;
+	size_t r;
+
+	/* heapify */
+	while (i != 0) {
+		i -= size;
+		for (r = i; r * 2 + size < n; r = c) {
+			c = r * 2 + size;
+			if (c < n - size && cmp(base + c, base + c + size) < 0)
+				c += size;
+			if (cmp(base + r, base + c) >= 0)
+				break;
+			sort_swap(base + r, base + c, size, swap_fn);
+		}
+	}
+
+	/* sort */
+	for (i = n - size; i > 0; i -= size) {
+		sort_swap(base, base + i, size, swap_fn);
+		for (r = 0; r * 2 + size < i; r = c) {
+			c = r * 2 + size;
+			if (c < i - size && cmp(base + c, base + c + size) < 0)
+				c += size;
+			if (cmp(base + r, base + c) >= 0)
+				break;
+			sort_swap(base + r, base + c, size, swap_fn);
+		}
+	}
+}
+
+static inline __attribute__((__always_inline__)) void
+sort_intro(char *base, size_t num, size_t size, sort_cmp_t *cmp,
+    sort_swap_t *swap_fn)
+{
+	struct {
+		char   *lo;
+		char   *hi;
+		int	depth;
+	}	stack[sizeof(size_t) * 8], *sp = stack;
+	char *lo = base;
+	char *hi = base + (num - 1) * size;
+	char *mid;
+	char *i;
+	char *j;
+	size_t nl;
+	size_t nr;
+	int depth = 2 * (BITS_PER_LONG - __builtin_clzl(num));	/* num >= 2 */
+
+	while (1) {
+		num = (hi - lo) / size + 1;
+
+		if (num <= SORT_INSERTION_MAX) {
+			for (i = lo + size; i <= hi; i += size) {
+				for (j = i; j > lo && cmp(j - size, j) > 0; j -= size)
+					sort_swap(j - size, j, size, swap_fn);
+			}
+			goto next;
+		} else if (depth-- == 0) {
+			sort_heap(lo, num, size, cmp, swap_fn);
+			goto next;
+		}
+
+		/* order the first, middle and last element */
+		mid = lo + (num / 2) * size;
+		if (cmp(mid, lo) < 0)
+			sort_swap(mid, lo, size, swap_fn);
+		if (cmp(hi, mid) < 0) {
+			sort_swap(hi, mid, size, swap_fn);
+			if (cmp(mid, lo) < 0)
+				sort_swap(mid, lo, size, swap_fn);
+		}
+
+		/* use the median as pivot, which is stored first */
+		sort_swap(lo, mid, size, swap_fn);
+		i = lo;
+		j = hi + size;
+		while (1) {
+			do {
+				i += size;
+			} while (cmp(i, lo) < 0);
+			do {
+				j -= size;
+			} while (cmp(lo, j) < 0);
+			if (i >= j)
+				break;
+			sort_swap(i, j, size, swap_fn);
+		}
+		sort_swap(lo, j, size, swap_fn);
+
+		/* continue with the smaller partition */
+		nl = (j - lo) / size;
+		nr = (hi - j) / size;
+		if (nl < nr) {
+			if (nr > 1) {
+				sp->lo = j + size;
+				sp->hi = hi;
+				sp->depth = depth;
+				sp++;
+			}
+			if (nl > 1) {
+				hi = j - size;
+				continue;
+			}
+		} else {
+			if (nl > 1) {
+				sp->lo = lo;
+				sp->hi = j - size;
+				sp->depth = depth;
+				sp++;
+			}
+			if (nr > 1) {
+				lo = j + size;
+				continue;
+			}
+		}
+next:
+		if (sp == stack)
+			break;
+		sp--;
+		lo = sp->lo;
+		hi = sp->hi;
+		depth = sp->depth;
+	}
+}
+
+/*
+ * Separate instances for the common element sizes, so that the
+ * compiler can inline the element swap.
+ */
+static void
+sort_4(void *base, size_t num, sort_cmp_t *cmp)
+{
+	sort_intro(base, num, 4, cmp, NULL);
+}
+
+static void
+sort_8(void *base, size_t num, sort_cmp_t *cmp)
+{
+	sort_intro(base, num, 8, cmp, NULL);
+}
+
+static void
+sort_any(void *base, size_t num, size_t size, sort_cmp_t *cmp,
+    sort_swap_t *swap_fn)
+{
+	sort_intro(base, num, size, cmp, swap_fn);
+}
+
+void
+sort(void *base, size_t num, size_t size,
+    int (*cmp) (const void *, const void *),
+    void (*swap_fn) (void *, void *, int size))
+{
+	if (num < 2 || size == 0)
+		return;
+
+	if (swap_fn == NULL && size == 4)
+		sort_4(base, num, cmp);
+	else if (swap_fn == NULL && size == 8)
+		sort_8(base, num, cmp);
+	else
+		sort_any(base, num, size, cmp, swap_fn);
+}
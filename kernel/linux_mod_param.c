@@ -25,32 +25,99 @@
 
 static TAILQ_HEAD(, mod_param) mod_param_head = TAILQ_HEAD_INITIALIZER(mod_param_head);
 
-int
-mod_set_param(const char *name, const char *value)
+/*
+ * The parameters are also hashed by name, so that they can be looked
+ * up quickly at runtime. Runtime updates are serialised by a separate
+ * lock, because the command line parameters are set before
+ * thread_init().
+ */
+#define	MOD_PARAM_HASH_SIZE 256
+
+/* LIST_HEAD() is the Linux one here */
+static struct {
+	struct mod_param *lh_first;
+}	mod_param_hash[MOD_PARAM_HASH_SIZE];
+static pthread_mutex_t mod_param_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned
+mod_param_hash_key(const char *name)
+{
+	uint32_t hash = 2166136261U;
+
+	while (*name)
+		hash = (hash ^ (uint8_t)*name++) * 16777619U;
+
+	return (hash % MOD_PARAM_HASH_SIZE);
+}
+
+static struct mod_param *
+mod_param_lookup(const char *name)
 {
 	struct mod_param *p;
 
-	TAILQ_FOREACH(p, &mod_param_head, entry) {
+	LIST_FOREACH(p, &mod_param_hash[mod_param_hash_key(name)], hash_entry) {
 		if (strcmp(p->name, name) == 0)
 			break;
 	}
-	if (p == NULL)
+	return (p);
+}
+
+/*
+ * Parse a numeric parameter value. The command line parameters are
+ * parsed leniently like before, while runtime updates reject values
+ * which are not a number or do not fit the parameter type.
+ */
+static int
+mod_param_number(const char *value, long long min, long long max,
+    long long *pval, int runtime)
+{
+	char *ep;
+	long long val;
+
+	val = strtoll(value, &ep, 0);
+	if (runtime != 0 && (ep == value || *ep != 0 ||
+	    val < min || val > max))
 		return (-1);
+	*pval = val;
+	return (0);
+}
+
+static int
+mod_param_store(struct mod_param *p, const char *value, int runtime)
+{
+	long long val;
 
 	if (strcmp(p->type, "string") == 0) {
+		if (runtime != 0 && strlen(value) >= p->size)
+			return (-1);
 		strlcpy(p->ptr, value, p->size);
 	} else if (strcmp(p->type, "short") == 0) {
-		*((short *)p->ptr) = strtoul(value, NULL, 0);
+		if (mod_param_number(value, SHRT_MIN, SHRT_MAX, &val, runtime))
+			return (-1);
+		*((short *)p->ptr) = val;
 	} else if (strcmp(p->type, "ushort") == 0) {
-		*((unsigned short *)p->ptr) = strtoul(value, NULL, 0);
+		if (mod_param_number(value, 0, USHRT_MAX, &val, runtime))
+			return (-1);
+		*((unsigned short *)p->ptr) = val;
 	} else if (strcmp(p->type, "int") == 0) {
-		*((int *)p->ptr) = strtoul(value, NULL, 0);
+		if (mod_param_number(value, INT_MIN, INT_MAX, &val, runtime))
+			return (-1);
+		*((int *)p->ptr) = val;
 	} else if (strcmp(p->type, "bool") == 0) {
-		*((bool *) p->ptr) = strtoul(value, NULL, 0) ? 1 : 0;
+		if (mod_param_number(value, 0, 1, &val, runtime))
+			return (-1);
+		*((bool *) p->ptr) = val ? 1 : 0;
 	} else if (strcmp(p->type, "uint") == 0) {
-		*((unsigned int *)p->ptr) = strtoul(value, NULL, 0);
+		if (mod_param_number(value, 0, UINT_MAX, &val, runtime))
+			return (-1);
+		*((unsigned int *)p->ptr) = val;
 	} else if (strcmp(p->type, "charp") == 0) {
-		free(*((void **)p->ptr));
+		/*
+		 * At runtime the old string might still be in use,
+		 * and is therefore not freed.
+		 */
+		if (runtime == 0)
+			free(*((void **)p->ptr));
 		*((void **)p->ptr) = strdup(value);
 	} else {
 		return (-1);
@@ -58,6 +125,53 @@ mod_set_param(const char *name, const char *value)
 	return (0);
 }
 
+int
+mod_set_param(const char *name, const char *value)
+{
+	struct mod_param *p;
+	int retval;
+
+	pthread_mutex_lock(&mod_param_mtx);
+	p = mod_param_lookup(name);
+	if (p == NULL)
+		retval = -1;
+	else
+		retval = mod_param_store(p, value, 0);
+	pthread_mutex_unlock(&mod_param_mtx);
+
+	return (retval);
+}
+
+/*
+ * Set a module parameter of a running instance. Only parameters
+ * which are writable according to their permissions can be changed.
+ * The notify callback of the parameter, if any, is called after the
+ * new value has been stored.
+ */
+int
+mod_set_param_runtime(const char *name, const char *value)
+{
+	struct mod_param *p;
+	int retval;
+
+	pthread_mutex_lock(&mod_param_mtx);
+	p = mod_param_lookup(name);
+	if (p == NULL)
+		retval = -ENOENT;
+	else if ((p->perm & 0222) == 0)
+		retval = -EPERM;
+	else if (mod_param_store(p, value, 1) != 0)
+		retval = -EINVAL;
+	else
+		retval = 0;
+	pthread_mutex_unlock(&mod_param_mtx);
+
+	if (retval == 0 && p->notify != NULL)
+		p->notify(p);
+
+	return (retval);
+}
+
 static void
 mod_output_desc(const char *desc)
 {
@@ -90,24 +204,22 @@ mod_get_int_param(const char *name)
 {
 	struct mod_param *p;
 
-	TAILQ_FOREACH(p, &mod_param_head, entry) {
-		if (strcmp(p->name, name) == 0) {
-			if (strcmp(p->type, "string") == 0) {
-				return (atoi((const char *)p->ptr));
-			} else if (strcmp(p->type, "bool") == 0) {
-				return (*((bool *) p->ptr));
-			} else if (strcmp(p->type, "int") == 0) {
-				return (*((int *)p->ptr));
-			} else if (strcmp(p->type, "uint") == 0) {
-				return (*((unsigned int *)p->ptr));
-			} else if (strcmp(p->type, "short") == 0) {
-				return (*((short *)p->ptr));
-			} else if (strcmp(p->type, "ushort") == 0) {
-				return (*((unsigned short *)p->ptr));
-			} else {
-				break;
-			}
-		}
+	p = mod_param_lookup(name);
+	if (p == NULL)
+		return (0);
+
+	if (strcmp(p->type, "string") == 0) {
+		return (atoi((const char *)p->ptr));
+	} else if (strcmp(p->type, "bool") == 0) {
+		return (*((bool *) p->ptr));
+	} else if (strcmp(p->type, "int") == 0) {
+		return (*((int *)p->ptr));
+	} else if (strcmp(p->type, "uint") == 0) {
+		return (*((unsigned int *)p->ptr));
+	} else if (strcmp(p->type, "short") == 0) {
+		return (*((short *)p->ptr));
+	} else if (strcmp(p->type, "ushort") == 0) {
+		return (*((unsigned short *)p->ptr));
 	}
 	return (0);
 }
@@ -140,10 +252,73 @@ mod_show_params(void)
 	}
 }
 
+static void
+mod_param_json(FILE *fp, struct mod_param *p)
+{
+	fprintf(fp, "{\"name\":");
+	json_print_string(fp, p->name);
+	fprintf(fp, ",\"type\":");
+	json_print_string(fp, p->type);
+	fprintf(fp, ",\"writable\":%s,\"value\":",
+	    (p->perm & 0222) ? "true" : "false");
+
+	if (strcmp(p->type, "string") == 0) {
+		json_print_string(fp, (const char *)p->ptr);
+	} else if (strcmp(p->type, "bool") == 0) {
+		fprintf(fp, "%s", *((bool *) p->ptr) ? "true" : "false");
+	} else if (strcmp(p->type, "int") == 0) {
+		fprintf(fp, "%d", *((int *)p->ptr));
+	} else if (strcmp(p->type, "uint") == 0) {
+		fprintf(fp, "%u", *((unsigned int *)p->ptr));
+	} else if (strcmp(p->type, "short") == 0) {
+		fprintf(fp, "%d", *((short *)p->ptr));
+	} else if (strcmp(p->type, "ushort") == 0) {
+		fprintf(fp, "%u", *((unsigned short *)p->ptr));
+	} else if (strcmp(p->type, "charp") == 0) {
+		json_print_string(fp, *((const char **)p->ptr));
+	} else {
+		fprintf(fp, "null");
+	}
+	fprintf(fp, "}");
+}
+
+int
+mod_get_param_json(FILE *fp, const char *name)
+{
+	struct mod_param *p;
+
+	pthread_mutex_lock(&mod_param_mtx);
+	p = mod_param_lookup(name);
+	if (p != NULL)
+		mod_param_json(fp, p);
+	pthread_mutex_unlock(&mod_param_mtx);
+
+	return ((p == NULL) ? -ENOENT : 0);
+}
+
+void
+mod_show_params_json(FILE *fp)
+{
+	struct mod_param *p;
+	const char *sep = "";
+
+	fprintf(fp, "[");
+	pthread_mutex_lock(&mod_param_mtx);
+	TAILQ_FOREACH(p, &mod_param_head, entry) {
+		fprintf(fp, "%s", sep);
+		mod_param_json(fp, p);
+		sep = ",";
+	}
+	pthread_mutex_unlock(&mod_param_mtx);
+	fprintf(fp, "]");
+}
+
 void
 mod_param_register(struct mod_param *p)
 {
 	TAILQ_INSERT_TAIL(&mod_param_head, p, entry);
+	LIST_INSERT_HEAD(&mod_param_hash[mod_param_hash_key(p->name)],
+	    p, hash_entry);
 }
 
 void
@@ -151,3 +326,9 @@ mod_param_register_desc(struct mod_param *p, const char *desc)
 {
 	p->desc = desc;
 }
+
+void
+mod_param_register_notify(struct mod_param *p, mod_param_notify_t *func)
+{
+	p->notify = func;
+}
@@ -28,8 +28,12 @@
 
 struct mod_param;
 
+typedef void (mod_param_notify_t)(struct mod_param *);
+
 struct mod_param {
 	TAILQ_ENTRY(mod_param) entry;
+	LIST_ENTRY(mod_param) hash_entry;
+	mod_param_notify_t *notify;	/* called on runtime changes */
 	const char *name;
 	const char *type;
 	const char *desc;
@@ -102,13 +106,29 @@ static int mod_param_##id##_init_desc(void)		\
 }							\
 module_parm_init(mod_param_##id##_init_desc)
 
+/*
+ * Register a function which is called when the given parameter is
+ * changed at runtime, see mod_set_param_runtime().
+ */
+#define	module_param_notify(id, func)				\
+static int mod_param_##id##_init_notify(void)			\
+{								\
+	mod_param_register_notify(&mod_param_##id, func);	\
+	return (0);						\
+}								\
+module_parm_init(mod_param_##id##_init_notify)
+
 #define	___MODULE_STRING(x) #x
 #define	__MODULE_STRING(x) ___MODULE_STRING(x)
 
 int	mod_set_param(const char *name, const char *value);
+int	mod_set_param_runtime(const char *name, const char *value);
 int	mod_get_int_param(const char *name);
+int	mod_get_param_json(FILE *, const char *name);
 void	mod_show_params(void);
+void	mod_show_params_json(FILE *);
 void	mod_param_register(struct mod_param *p);
 void	mod_param_register_desc(struct mod_param *p, const char *desc);
+void	mod_param_register_notify(struct mod_param *p, mod_param_notify_t *func);
 
 #endif					/* _LINUX_MOD_PARAM_H_ */
@@ -30,23 +30,164 @@
 static inline unsigned long
 radix_max(struct radix_tree_root *root)
 {
+	if ((root->height * RADIX_TREE_MAP_SHIFT) >= (int)(sizeof(long) * 8))
+		return (-1UL);
 	return ((1UL << (root->height * RADIX_TREE_MAP_SHIFT)) - 1UL);
 }
 
+static inline unsigned long
+radix_node_max(struct radix_tree_node *node)
+{
+	if (((node->height + 1) * RADIX_TREE_MAP_SHIFT) >= (int)(sizeof(long) * 8))
+		return (-1UL);
+	return ((1UL << ((node->height + 1) * RADIX_TREE_MAP_SHIFT)) - 1UL);
+}
+
 static inline int
 radix_pos(long id, int height)
 {
 	return (id >> (RADIX_TREE_MAP_SHIFT * height)) & RADIX_TREE_MAP_MASK;
 }
 
+/*
+ * The radix_tree_lookup() function does not take any locks. Instead
+ * each reader registers in one of two reader counters, selected by
+ * the lowest bit of the current epoch. Radix nodes removed from the
+ * tree are put on the limbo list of the current epoch and are freed
+ * two epochs later. The epoch is only advanced when no readers are
+ * left in the previous epoch, so that no reader can reference a
+ * node when it is freed. Writers are serialized by atomic_lock().
+ *
+ * Pointers which can be seen by readers must be updated using
+ * radix_store() after the data they point to is initialized.
+ */
+#define	radix_load(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define	radix_store(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+
+static unsigned radix_tree_epoch;
+static unsigned radix_tree_readers[2];
+static struct radix_tree_node *radix_tree_limbo[2];
+
+/*
+ * Freed radix nodes are kept on a free list, up to a limit, so that
+ * inserting and deleting items does not hit malloc() every time.
+ */
+#define	RADIX_TREE_FREE_MAX 256
+
+static struct radix_tree_node *radix_tree_free_head;
+static unsigned radix_tree_free_count;
+
+static inline unsigned
+radix_tree_read_enter(void)
+{
+	unsigned e;
+
+	while (1) {
+		e = __atomic_load_n(&radix_tree_epoch, __ATOMIC_RELAXED) & 1;
+		__atomic_fetch_add(&radix_tree_readers[e], 1, __ATOMIC_SEQ_CST);
+		/* make sure the epoch did not change meanwhile */
+		if ((__atomic_load_n(&radix_tree_epoch, __ATOMIC_SEQ_CST) & 1) == e)
+			break;
+		__atomic_fetch_sub(&radix_tree_readers[e], 1, __ATOMIC_RELEASE);
+	}
+	return (e);
+}
+
+static inline void
+radix_tree_read_exit(unsigned e)
+{
+	__atomic_fetch_sub(&radix_tree_readers[e], 1, __ATOMIC_RELEASE);
+}
+
+static struct radix_tree_node *
+radix_tree_alloc_node(int height)
+{
+	struct radix_tree_node *node;
+
+	atomic_lock();
+	node = radix_tree_free_head;
+	if (node != NULL) {
+		radix_tree_free_head = node->next;
+		radix_tree_free_count--;
+	}
+	atomic_unlock();
+
+	if (node == NULL) {
+		node = malloc(sizeof(*node));
+		if (node == NULL)
+			return (NULL);
+	}
+	memset(node, 0, sizeof(*node));
+	node->height = height;
+	return (node);
+}
+
+/*
+ * This function must only be called for nodes which are not
+ * visible to any readers.
+ */
+static void
+radix_tree_put_node(struct radix_tree_node *node)
+{
+	atomic_lock();
+	if (radix_tree_free_count < RADIX_TREE_FREE_MAX) {
+		node->next = radix_tree_free_head;
+		radix_tree_free_head = node;
+		radix_tree_free_count++;
+		node = NULL;
+	}
+	atomic_unlock();
+
+	free(node);
+}
+
+static void
+radix_tree_free_node(struct radix_tree_node *node)
+{
+	unsigned e;
+
+	atomic_lock();
+	e = radix_tree_epoch & 1;
+	node->next = radix_tree_limbo[e];
+	radix_tree_limbo[e] = node;
+	atomic_unlock();
+}
+
+static void
+radix_tree_reclaim(void)
+{
+	struct radix_tree_node *node;
+	unsigned e;
+
+	atomic_lock();
+	while (radix_tree_limbo[0] != NULL || radix_tree_limbo[1] != NULL) {
+		e = radix_tree_epoch;
+		/* check for readers left in the previous epoch */
+		if (__atomic_load_n(&radix_tree_readers[(e + 1) & 1],
+		    __ATOMIC_SEQ_CST) != 0)
+			break;
+		e++;
+		__atomic_store_n(&radix_tree_epoch, e, __ATOMIC_SEQ_CST);
+
+		/* free the nodes removed two epochs ago */
+		while ((node = radix_tree_limbo[e & 1]) != NULL) {
+			radix_tree_limbo[e & 1] = node->next;
+			radix_tree_put_node(node);
+		}
+	}
+	atomic_unlock();
+}
+
 static void
 radix_tree_clean_root_node(struct radix_tree_root *root)
 {
+	struct radix_tree_node *node = root->rnode;
+
 	/* Check if the root node should be freed */
-	if (root->rnode->count == 0) {
-		free(root->rnode);
-		root->rnode = NULL;
+	if (node->count == 0) {
+		radix_store(&root->rnode, NULL);
 		root->height = 0;
+		radix_tree_free_node(node);
 	}
 }
 
@@ -55,66 +196,177 @@ radix_tree_lookup(struct radix_tree_root *root, unsigned long index)
 {
 	struct radix_tree_node *node;
 	void *item;
+	unsigned e;
 	int height;
 
 	item = NULL;
-	node = root->rnode;
-	height = root->height - 1;
-	if (index > radix_max(root))
+	e = radix_tree_read_enter();
+	node = radix_load(&root->rnode);
+	if (node == NULL || index > radix_node_max(node))
 		goto out;
+	height = node->height;
 	while (height && node)
-		node = node->slots[radix_pos(index, height--)];
+		node = radix_load(&node->slots[radix_pos(index, height--)]);
 	if (node)
-		item = node->slots[radix_pos(index, 0)];
+		item = radix_load(&node->slots[radix_pos(index, 0)]);
 
 out:
+	radix_tree_read_exit(e);
 	return (item);
 }
 
+/*
+ * This function returns the first item at an index greater than or
+ * equal to the index given by "iter". Empty radix levels are always
+ * freed, so every non-NULL slot above the lowest level leads to at
+ * least one item. At the lowest level the bitmap of full slots tells
+ * which slots hold an item.
+ */
 bool
 radix_tree_iter_find(struct radix_tree_root *root, struct radix_tree_iter *iter,
     void ***pppslot)
 {
+	struct radix_tree_node *stack[RADIX_TREE_MAX_HEIGHT];
 	struct radix_tree_node *node;
 	unsigned long index = iter->index;
+	uint64_t bits;
 	int height;
+	int shift;
+	int pos;
 
-restart:
 	node = root->rnode;
-	if (node == NULL)
+	if (node == NULL || node->count == 0 || index > radix_max(root))
 		return (false);
 	height = root->height - 1;
-	if (height == -1 || index > radix_max(root))
-		return (false);
-	do {
-		unsigned long mask = RADIX_TREE_MAP_MASK << (RADIX_TREE_MAP_SHIFT * height);
-		unsigned long step = 1UL << (RADIX_TREE_MAP_SHIFT * height);
-		int pos = radix_pos(index, height);
-		struct radix_tree_node *next;
-
-		/* track last slot */
-		*pppslot = node->slots + pos;
-
-		next = node->slots[pos];
-		if (next == NULL) {
-			index += step;
-			index &= -step;
-			if ((index & mask) == 0)
-				goto restart;
+	while (1) {
+		shift = RADIX_TREE_MAP_SHIFT * height;
+		pos = radix_pos(index, height);
+		if (height == 0) {
+			bits = node->full & (RADIX_TREE_MAP_FULL << pos);
+			if (bits != 0) {
+				pos = __builtin_ctzll(bits);
+				index &= ~RADIX_TREE_MAP_MASK;
+				index |= pos;
+				break;
+			}
 		} else {
-			node = next;
-			height--;
+			while (pos != RADIX_TREE_MAP_SIZE && node->slots[pos] == NULL)
+				pos++;
+			if (pos != RADIX_TREE_MAP_SIZE) {
+				if (pos != radix_pos(index, height)) {
+					index &= ~((RADIX_TREE_MAP_MASK << shift) |
+					    ((1UL << shift) - 1UL));
+					index |= (unsigned long)pos << shift;
+				}
+				stack[height] = node;
+				node = node->slots[pos];
+				height--;
+				continue;
+			}
+		}
+		/* advance to the next slot in the radix levels above */
+		if (++height == root->height)
+			return (false);
+		shift = RADIX_TREE_MAP_SHIFT * height;
+		index = (index | ((1UL << shift) - 1UL)) + 1UL;
+		if (index == 0)
+			return (false);
+		while (radix_pos(index, height) == 0) {
+			if (++height == root->height)
+				return (false);
 		}
-	} while (height != -1);
+		node = stack[height];
+	}
+	*pppslot = node->slots + pos;
 	iter->index = index;
 	return (true);
 }
 
+/*
+ * Each radix node has a bitmap of slots which are full. At the lowest
+ * level a slot is full when it holds an item. At the higher levels a
+ * slot is full when the radix level below it is full. This allows
+ * finding free indexes without visiting occupied subtrees.
+ */
+static void
+radix_tree_set_full(struct radix_tree_root *root, unsigned long index,
+    struct radix_tree_node **stack)
+{
+	struct radix_tree_node *node;
+	int height;
+
+	for (height = 0; height != root->height; height++) {
+		node = stack[height];
+		node->full |= 1ULL << radix_pos(index, height);
+		if (node->full != RADIX_TREE_MAP_FULL)
+			break;
+	}
+}
+
+/*
+ * This function returns the first free index greater than or equal
+ * to the index pointed to by "pindex" and not greater than "max". The
+ * index pointed to by "pindex" is updated upon success. Else -ENOSPC
+ * is returned.
+ */
+int
+radix_tree_find_free(struct radix_tree_root *root, unsigned long *pindex,
+    unsigned long max)
+{
+	struct radix_tree_node *node;
+	unsigned long index = *pindex;
+	unsigned long mask;
+	uint64_t bits;
+	int height;
+	int shift;
+	int pos;
+
+restart:
+	if (index > max)
+		return (-ENOSPC);
+	node = root->rnode;
+	if (node == NULL || index > radix_max(root))
+		goto done;
+	height = root->height - 1;
+	while (1) {
+		shift = RADIX_TREE_MAP_SHIFT * height;
+		pos = radix_pos(index, height);
+		bits = ~node->full & (RADIX_TREE_MAP_FULL << pos);
+		if (bits == 0) {
+			/* skip to the next slot in the radix level above */
+			if (shift + RADIX_TREE_MAP_SHIFT >= (int)(sizeof(long) * 8))
+				return (-ENOSPC);
+			mask = (1UL << (shift + RADIX_TREE_MAP_SHIFT)) - 1UL;
+			index = (index | mask) + 1UL;
+			if (index == 0)
+				return (-ENOSPC);
+			goto restart;
+		}
+		if (pos != __builtin_ctzll(bits)) {
+			/* advance to the first free slot */
+			pos = __builtin_ctzll(bits);
+			index &= ~((RADIX_TREE_MAP_MASK << shift) |
+			    ((1UL << shift) - 1UL));
+			index |= (unsigned long)pos << shift;
+		}
+		if (height == 0 || node->slots[pos] == NULL)
+			break;
+		node = node->slots[pos];
+		height--;
+	}
+	if (index > max)
+		return (-ENOSPC);
+done:
+	*pindex = index;
+	return (0);
+}
+
 void *
 radix_tree_delete(struct radix_tree_root *root, unsigned long index)
 {
 	struct radix_tree_node *stack[RADIX_TREE_MAX_HEIGHT];
 	struct radix_tree_node *node;
+	uint64_t bit;
 	void *item;
 	int height;
 	int idx;
@@ -131,28 +383,54 @@ radix_tree_delete(struct radix_tree_root *root, unsigned long index)
 		stack[height] = node;
 		node = node->slots[radix_pos(index, height--)];
 	}
-	idx = radix_pos(index, 0);
-	if (node)
-		item = node->slots[idx];
+	if (node == NULL)
+		goto out;
+	stack[0] = node;
+	item = node->slots[radix_pos(index, 0)];
+	if (item == NULL)
+		goto out;
 	/*
-	 * If we removed something reduce the height of the tree.
+	 * Remove the item and free the empty radix levels, if any.
 	 */
-	if (item)
-		for (;;) {
-			node->slots[idx] = NULL;
-			node->count--;
-			if (node->count > 0)
-				break;
-			free(node);
-			if (node == root->rnode) {
-				root->rnode = NULL;
-				root->height = 0;
-				break;
-			}
-			height++;
-			node = stack[height];
-			idx = radix_pos(index, height);
+	for (height = 0;; height++) {
+		node = stack[height];
+		idx = radix_pos(index, height);
+		radix_store(&node->slots[idx], NULL);
+		node->full &= ~(1ULL << idx);
+		node->count--;
+		if (node->count > 0)
+			break;
+		radix_tree_free_node(node);
+		if (node == root->rnode) {
+			radix_store(&root->rnode, NULL);
+			root->height = 0;
+			goto done;
 		}
+	}
+	/*
+	 * The remaining radix levels on the path are no longer full.
+	 */
+	while (++height != root->height) {
+		node = stack[height];
+		bit = 1ULL << radix_pos(index, height);
+		if ((node->full & bit) == 0)
+			break;
+		node->full &= ~bit;
+	}
+	/*
+	 * Reduce the tree height while the root node only has a
+	 * child in the first slot.
+	 */
+	while (root->height > 1) {
+		node = root->rnode;
+		if (node->count != 1 || node->slots[0] == NULL)
+			break;
+		radix_store(&root->rnode, node->slots[0]);
+		root->height--;
+		radix_tree_free_node(node);
+	}
+done:
+	radix_tree_reclaim();
 out:
 	return (item);
 }
@@ -164,29 +442,38 @@ radix_tree_iter_delete(struct radix_tree_root *root,
 	radix_tree_delete(root, iter->index);
 }
 
-int
-radix_tree_insert(struct radix_tree_root *root, unsigned long index, void *item)
+/*
+ * This function looks up the radix node at the lowest level for the
+ * given index, allocating the missing radix levels, if any. The path
+ * from the root node is stored in "stack", indexed by height.
+ */
+static int
+radix_tree_get_leaf(struct radix_tree_root *root, unsigned long index,
+    struct radix_tree_node **stack)
 {
 	struct radix_tree_node *node;
 	struct radix_tree_node *temp[RADIX_TREE_MAX_HEIGHT - 1];
 	int height;
 	int idx;
 
-	/* bail out upon insertion of a NULL item */
-	if (item == NULL)
-		return (-EINVAL);
-
 	/* get root node, if any */
 	node = root->rnode;
 
-	/* allocate root node, if any */
+	/*
+	 * Allocate root node, if any. The height of a radix node
+	 * never changes once it is visible to readers, so make the
+	 * new root node tall enough for the given index.
+	 */
 	if (node == NULL) {
-		node = malloc(sizeof(*node));
-		if (node == NULL)
+		root->height = 1;
+		while (radix_max(root) < index)
+			root->height++;
+		node = radix_tree_alloc_node(root->height - 1);
+		if (node == NULL) {
+			root->height = 0;
 			return (-ENOMEM);
-		memset(node, 0, sizeof(*node));
-		root->rnode = node;
-		root->height++;
+		}
+		radix_store(&root->rnode, node);
 	}
 
 	/* expand radix tree as needed */
@@ -198,26 +485,25 @@ radix_tree_insert(struct radix_tree_root *root, unsigned long index, void *item)
 		}
 
 		/*
-		 * If the root radix level is not empty, we need to
+		 * The root radix level is not empty, we need to
 		 * allocate a new radix level:
 		 */
-		if (node->count != 0) {
-			node = malloc(sizeof(*node));
-			if (node == NULL) {
-				/*
-				 * Freeing the already allocated radix
-				 * levels, if any, will be handled by
-				 * the radix_tree_delete() function.
-				 * This code path can only happen when
-				 * the tree is not empty.
-				 */
-				return (-ENOMEM);
-			}
-			memset(node, 0, sizeof(*node));
-			node->slots[0] = root->rnode;
-			node->count++;
-			root->rnode = node;
+		node = radix_tree_alloc_node(root->height);
+		if (node == NULL) {
+			/*
+			 * Freeing the already allocated radix
+			 * levels, if any, will be handled by
+			 * the radix_tree_delete() function.
+			 * This code path can only happen when
+			 * the tree is not empty.
+			 */
+			return (-ENOMEM);
 		}
+		node->slots[0] = root->rnode;
+		node->count++;
+		if (root->rnode->full == RADIX_TREE_MAP_FULL)
+			node->full = 1;
+		radix_store(&root->rnode, node);
 		root->height++;
 	}
 
@@ -226,6 +512,7 @@ radix_tree_insert(struct radix_tree_root *root, unsigned long index, void *item)
 
 	/* walk down the tree until the first missing node, if any */
 	for ( ; height != 0; height--) {
+		stack[height] = node;
 		idx = radix_pos(index, height);
 		if (node->slots[idx] == NULL)
 			break;
@@ -234,43 +521,65 @@ radix_tree_insert(struct radix_tree_root *root, unsigned long index, void *item)
 
 	/* allocate the missing radix levels, if any */
 	for (idx = 0; idx != height; idx++) {
-		temp[idx] = malloc(sizeof(*node));
+		temp[idx] = radix_tree_alloc_node(idx);
 		if (temp[idx] == NULL) {
 			while (idx--)
-				free(temp[idx]);
+				radix_tree_put_node(temp[idx]);
 			radix_tree_clean_root_node(root);
 			return (-ENOMEM);
 		}
-		memset(temp[idx], 0, sizeof(*node));
 	}
 
 	/* setup new radix levels, if any */
 	for ( ; height != 0; height--) {
 		idx = radix_pos(index, height);
-		node->slots[idx] = temp[height - 1];
+		radix_store(&node->slots[idx], temp[height - 1]);
 		node->count++;
 		node = node->slots[idx];
+		stack[height - 1] = node;
 	}
+	stack[0] = node;
+	return (0);
+}
+
+int
+radix_tree_insert(struct radix_tree_root *root, unsigned long index, void *item)
+{
+	struct radix_tree_node *stack[RADIX_TREE_MAX_HEIGHT];
+	struct radix_tree_node *node;
+	int error;
+	int idx;
+
+	/* bail out upon insertion of a NULL item */
+	if (item == NULL)
+		return (-EINVAL);
+
+	error = radix_tree_get_leaf(root, index, stack);
+	if (error)
+		return (error);
 
 	/*
 	 * Insert and adjust count if the item does not already exist.
 	 */
+	node = stack[0];
 	idx = radix_pos(index, 0);
 	if (node->slots[idx])
 		return (-EEXIST);
-	node->slots[idx] = item;
+	radix_store(&node->slots[idx], item);
 	node->count++;
 
+	radix_tree_set_full(root, index, stack);
+
 	return (0);
 }
 
 int
 radix_tree_store(struct radix_tree_root *root, unsigned long index, void **ppitem)
 {
+	struct radix_tree_node *stack[RADIX_TREE_MAX_HEIGHT];
 	struct radix_tree_node *node;
-	struct radix_tree_node *temp[RADIX_TREE_MAX_HEIGHT - 1];
 	void *pitem;
-	int height;
+	int error;
 	int idx;
 
 	/*
@@ -282,92 +591,23 @@ radix_tree_store(struct radix_tree_root *root, unsigned long index, void **ppite
 		return (0);
 	}
 
-	/* get root node, if any */
-	node = root->rnode;
-
-	/* allocate root node, if any */
-	if (node == NULL) {
-		node = malloc(sizeof(*node));
-		if (node == NULL)
-			return (-ENOMEM);
-		memset(node, 0, sizeof(*node));
-		root->rnode = node;
-		root->height++;
-	}
-
-	/* expand radix tree as needed */
-	while (radix_max(root) < index) {
-		/* check if the radix tree is getting too big */
-		if (root->height == RADIX_TREE_MAX_HEIGHT) {
-			radix_tree_clean_root_node(root);
-			return (-E2BIG);
-		}
-
-		/*
-		 * If the root radix level is not empty, we need to
-		 * allocate a new radix level:
-		 */
-		if (node->count != 0) {
-			node = malloc(sizeof(*node));
-			if (node == NULL) {
-				/*
-				 * Freeing the already allocated radix
-				 * levels, if any, will be handled by
-				 * the radix_tree_delete() function.
-				 * This code path can only happen when
-				 * the tree is not empty.
-				 */
-				return (-ENOMEM);
-			}
-			memset(node, 0, sizeof(*node));
-			node->slots[0] = root->rnode;
-			node->count++;
-			root->rnode = node;
-		}
-		root->height++;
-	}
-
-	/* get radix tree height index */
-	height = root->height - 1;
-
-	/* walk down the tree until the first missing node, if any */
-	for ( ; height != 0; height--) {
-		idx = radix_pos(index, height);
-		if (node->slots[idx] == NULL)
-			break;
-		node = node->slots[idx];
-	}
-
-	/* allocate the missing radix levels, if any */
-	for (idx = 0; idx != height; idx++) {
-		temp[idx] = malloc(sizeof(*node));
-		if (temp[idx] == NULL) {
-			while (idx--)
-				free(temp[idx]);
-			radix_tree_clean_root_node(root);
-			return (-ENOMEM);
-		}
-		memset(temp[idx], 0, sizeof(*node));
-	}
-
-	/* setup new radix levels, if any */
-	for ( ; height != 0; height--) {
-		idx = radix_pos(index, height);
-		node->slots[idx] = temp[height - 1];
-		node->count++;
-		node = node->slots[idx];
-	}
+	error = radix_tree_get_leaf(root, index, stack);
+	if (error)
+		return (error);
 
 	/*
 	 * Insert and adjust count if the item does not already exist.
 	 */
+	node = stack[0];
 	idx = radix_pos(index, 0);
 	/* swap */
 	pitem = node->slots[idx];
-	node->slots[idx] = *ppitem;
+	radix_store(&node->slots[idx], *ppitem);
 	*ppitem = pitem;
 
-	if (pitem == NULL)
+	if (pitem == NULL) {
 		node->count++;
+		radix_tree_set_full(root, index, stack);
+	}
 	return (0);
 }
@@ -34,6 +34,7 @@
 #define	RADIX_TREE_MAP_SHIFT	6
 #define	RADIX_TREE_MAP_SIZE	(1UL << RADIX_TREE_MAP_SHIFT)
 #define	RADIX_TREE_MAP_MASK	(RADIX_TREE_MAP_SIZE - 1UL)
+#define	RADIX_TREE_MAP_FULL	(-1ULL >> (64 - RADIX_TREE_MAP_SIZE))
 #define	RADIX_TREE_MAX_HEIGHT \
 	howmany(sizeof(long) * 8, RADIX_TREE_MAP_SHIFT)
 
@@ -43,7 +44,10 @@
 
 struct radix_tree_node {
 	void		*slots[RADIX_TREE_MAP_SIZE];
+	uint64_t	full;		/* bitmap of full slots */
+	struct radix_tree_node *next;	/* next node waiting to be freed */
 	int		count;
+	int		height;		/* radix level, zero is the lowest */
 };
 
 struct radix_tree_root {
@@ -77,6 +81,7 @@ void	*radix_tree_lookup(struct radix_tree_root *, unsigned long);
 void	*radix_tree_delete(struct radix_tree_root *, unsigned long);
 int	radix_tree_insert(struct radix_tree_root *, unsigned long, void *);
 int	radix_tree_store(struct radix_tree_root *, unsigned long, void **);
+int	radix_tree_find_free(struct radix_tree_root *, unsigned long *, unsigned long);
 bool	radix_tree_iter_find(struct radix_tree_root *, struct radix_tree_iter *, void ***);
 void	radix_tree_iter_delete(struct radix_tree_root *, struct radix_tree_iter *, void **);
 
@@ -441,11 +441,27 @@ enum {
 	F_V4B_MAX,
 };
 
+struct cdev_handle_stats {
+	uint64_t reads;
+	uint64_t writes;
+	uint64_t ioctls;
+	uint64_t polls;
+	uint64_t mmaps;
+	uint64_t errors;
+	uint64_t read_bytes;
+	uint64_t write_bytes;
+};
+
 struct cdev_handle {
 	struct dentry fixed_dentry;
 	struct inode fixed_inode;
 	struct file fixed_file;
 	struct vm_area_struct fixed_vma[LINUX_VMA_MAX];
+	TAILQ_ENTRY(cdev_handle) entry;
+	struct cdev_handle_stats stats;
+	uint64_t open_jiffies;
+	unsigned int last_ioctl;
+	int	f_v4b;
 };
 
 struct cdev {
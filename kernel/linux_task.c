@@ -32,6 +32,8 @@ static struct work_head work_head = TAILQ_HEAD_INITIALIZER(work_head);
 static pthread_t work_thread;
 static pthread_cond_t work_cond;
 static int flush_work_var;
+static uint64_t work_queued;
+static uint64_t work_executed;
 
 int
 schedule_work(struct work_struct *work)
@@ -42,6 +44,7 @@ schedule_work(struct work_struct *work)
 	if (work->entry.tqe_prev == NULL) {
 		TAILQ_INSERT_TAIL(&work_head, work, entry);
 		pthread_cond_signal(&work_cond);
+		work_queued++;
 		retval = 1;
 	} else {
 		retval = 0;
@@ -106,6 +109,8 @@ work_exec(void *arg)
 {
 	struct work_struct *t;
 
+	thread_stats_register("work");
+
 	atomic_lock();
 	while (1) {
 		t = TAILQ_FIRST(&work_head);
@@ -113,8 +118,11 @@ work_exec(void *arg)
 			TAILQ_REMOVE(&work_head, t, entry);
 			t->entry.tqe_prev = NULL;
 			work_curr = t;
+			work_executed++;
 			atomic_unlock();
+			linux_trace_begin(LINUX_TRACE_WORK, work_executed, 0);
 			t->func(t);
+			linux_trace_end(LINUX_TRACE_WORK, work_executed, 0);
 			atomic_lock();
 			work_curr = NULL;
 		} else {
@@ -251,6 +259,21 @@ work_init(void)
 
 module_init(work_init);
 
+void
+work_stats_json(FILE *fp)
+{
+	struct work_struct *t;
+	unsigned pending = 0;
+
+	atomic_lock();
+	TAILQ_FOREACH(t, &work_head, entry)
+		pending++;
+	fprintf(fp, "{\"pending\":%u,\"queued\":%ju,\"executed\":%ju,"
+	    "\"busy\":%s}", pending, (uintmax_t)work_queued,
+	    (uintmax_t)work_executed, (work_curr != NULL) ? "true" : "false");
+	atomic_unlock();
+}
+
 static void
 tasklet_wrapper_callback(struct work_struct *work)
 {
@@ -305,6 +328,8 @@ rcu_exec(void *arg)
 {
 	struct rcu_head *t;
 
+	thread_stats_register("rcu");
+
 	atomic_lock();
 	while (1) {
 		t = rcu_head;
@@ -85,6 +85,7 @@ struct workqueue_struct *create_singlethread_workqueue(const char *name);
 bool	flush_work(struct work_struct *work);
 void	flush_workqueue(struct workqueue_struct *wq);
 void	flush_scheduled_work(void);
+void	work_stats_json(FILE *);
 void	cancel_rearming_delayed_work(struct delayed_work *);
 void	cancel_delayed_work(struct delayed_work *);
 void	cancel_delayed_work_sync(struct delayed_work *);
@@ -32,6 +32,20 @@ static volatile uint32_t atomic_recurse;
 static pthread_key_t wrapper_key;
 static __thread uint32_t wakeup_inhibit;
 
+/*
+ * Registry of the long running threads, used to report the CPU time
+ * of each thread. It has its own lock, because some threads are
+ * started before thread_init().
+ */
+#define	THREAD_STATS_MAX 64
+
+static struct thread_stats {
+	pthread_t thread;
+	char	name[24];
+}	thread_stats[THREAD_STATS_MAX];
+
+static pthread_mutex_t thread_stats_mtx = PTHREAD_MUTEX_INITIALIZER;
+
 struct task_struct linux_task = {
 	.comm = "WEBCAMD",
 	.pid = 1,
@@ -143,6 +157,8 @@ wake_up(wait_queue_head_t *q)
 	pthread_cond_broadcast(&sema_cond);
 	atomic_unlock();
 
+	linux_trace_event(LINUX_TRACE_WAKE_UP, do_poll, 0);
+
 	if (do_poll) {
 		if (wakeup_inhibit == 0)
 			poll_wakeup_internal();
@@ -498,6 +514,7 @@ complete(struct completion *x)
 struct funcdata {
 	threadfn_t *volatile func;
 	void   *volatile data;
+	char	name[24];
 };
 
 struct thread_wrapper {
@@ -537,6 +554,8 @@ kthread_wrapper(void *arg)
 
 	signal(SIGURG, thread_urg);
 
+	thread_stats_register(fd.name);
+
 	pthread_mutex_lock(&atomic_mutex);
 	((struct funcdata *)arg)->func = NULL;
 	pthread_cond_broadcast(&sema_cond);
@@ -544,6 +563,8 @@ kthread_wrapper(void *arg)
 
 	fd.func(fd.data);
 
+	thread_stats_unregister();
+
 	pthread_setspecific(wrapper_key, NULL);
 
 	pthread_exit(NULL);
@@ -567,6 +588,7 @@ kthread_run(threadfn_t *func, void *data, char *fmt,...)
 {
 	pthread_t ptd;
 	struct funcdata *fd = malloc(sizeof(*fd));
+	va_list args;
 
 	if (fd == NULL)
 		return (ERR_PTR(-ENOMEM));
@@ -574,6 +596,10 @@ kthread_run(threadfn_t *func, void *data, char *fmt,...)
 	fd->func = func;
 	fd->data = data;
 
+	va_start(args, fmt);
+	vsnprintf(fd->name, sizeof(fd->name), fmt, args);
+	va_end(args);
+
 	if (pthread_create(&ptd, NULL, kthread_wrapper, fd)) {
 		free(fd);
 		return (ERR_PTR(-ENOMEM));
@@ -664,6 +690,91 @@ thread_init(void)
 	return (0);
 }
 
+void
+thread_stats_register(const char *name)
+{
+	unsigned n;
+
+	if (name == NULL || name[0] == 0)
+		name = "kthread";
+
+	pthread_mutex_lock(&thread_stats_mtx);
+	for (n = 0; n != THREAD_STATS_MAX; n++) {
+		if (thread_stats[n].name[0] != 0)
+			continue;
+		thread_stats[n].thread = pthread_self();
+		strlcpy(thread_stats[n].name, name,
+		    sizeof(thread_stats[n].name));
+		break;
+	}
+	pthread_mutex_unlock(&thread_stats_mtx);
+}
+
+void
+thread_stats_unregister(void)
+{
+	unsigned n;
+
+	pthread_mutex_lock(&thread_stats_mtx);
+	for (n = 0; n != THREAD_STATS_MAX; n++) {
+		if (thread_stats[n].name[0] != 0 &&
+		    pthread_equal(thread_stats[n].thread, pthread_self())) {
+			thread_stats[n].name[0] = 0;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&thread_stats_mtx);
+}
+
+/*
+ * Copy the registered name of the given thread, if any.
+ */
+int
+thread_stats_name(pthread_t thread, char *name, size_t size)
+{
+	unsigned n;
+	int retval = -1;
+
+	pthread_mutex_lock(&thread_stats_mtx);
+	for (n = 0; n != THREAD_STATS_MAX; n++) {
+		if (thread_stats[n].name[0] != 0 &&
+		    pthread_equal(thread_stats[n].thread, thread)) {
+			strlcpy(name, thread_stats[n].name, size);
+			retval = 0;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&thread_stats_mtx);
+
+	return (retval);
+}
+
+void
+thread_stats_json(FILE *fp)
+{
+	struct timespec ts;
+	clockid_t clock;
+	const char *sep = "";
+	unsigned n;
+
+	fprintf(fp, "[");
+	pthread_mutex_lock(&thread_stats_mtx);
+	for (n = 0; n != THREAD_STATS_MAX; n++) {
+		if (thread_stats[n].name[0] == 0)
+			continue;
+		if (pthread_getcpuclockid(thread_stats[n].thread, &clock) != 0 ||
+		    clock_gettime(clock, &ts) != 0)
+			continue;
+		fprintf(fp, "%s{\"name\":", sep);
+		json_print_string(fp, thread_stats[n].name);
+		fprintf(fp, ",\"cpu_us\":%ju}", (uintmax_t)ts.tv_sec * 1000000 +
+		    (uintmax_t)ts.tv_nsec / 1000);
+		sep = ",";
+	}
+	pthread_mutex_unlock(&thread_stats_mtx);
+	fprintf(fp, "]");
+}
+
 void
 thread_exit(void)
 {
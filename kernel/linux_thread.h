@@ -52,7 +52,8 @@ typedef struct semaphore {
 	pthread_t owner;
 } semaphore_t;
 
-#define	DEFINE_SPINLOCK(n) struct spinlock n = { }
+/* all spinlocks map to the atomic lock, the lock itself is not used */
+#define	DEFINE_SPINLOCK(n) struct spinlock n __attribute__((__unused__)) = { }
 #define	DEFINE_MUTEX(n) struct mutex n = { .sem.value = 1, .sem.owner = MUTEX_NO_OWNER, }
 struct mutex {
 	struct semaphore sem;
@@ -230,6 +231,10 @@ void	atomic_post_sleep(void);
 
 int	thread_init(void);
 int	thread_got_stopping(void);
+void	thread_stats_register(const char *);
+void	thread_stats_unregister(void);
+int	thread_stats_name(pthread_t, char *, size_t);
+void	thread_stats_json(FILE *);
 
 void	prepare_to_wait(wait_queue_head_t *, wait_queue_t *, int);
 void	finish_wait(wait_queue_head_t *, wait_queue_t *);
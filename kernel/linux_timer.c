@@ -33,6 +33,8 @@ static volatile int timer_thread_started;
 static int timer_needed;
 static struct timespec timer_last;
 static uint32_t timer_nsec_rem;
+static uint64_t timer_added;
+static uint64_t timer_fired;
 
 int
 timer_pending(const struct timer_list *timer)
@@ -53,6 +55,7 @@ add_timer(struct timer_list *timer)
 
 	atomic_lock();
 	TAILQ_INSERT_TAIL(&timer_head, timer, entry);
+	timer_added++;
 	atomic_unlock();
 }
 
@@ -109,6 +112,8 @@ timer_exec(void *arg)
 
 	signal(SIGIO, &timer_io);
 
+	thread_stats_register("timer");
+
 	timer_thread_started = 1;
 
 	last_check = get_jiffies_64();
@@ -144,8 +149,11 @@ restart:
 			if (delta < 0) {
 				TAILQ_REMOVE(&timer_head, t, entry);
 				t->entry.tqe_prev = NULL;
+				timer_fired++;
 				atomic_unlock();
+				linux_trace_begin(LINUX_TRACE_TIMER, timer_fired, 0);
 				t->function(t);
+				linux_trace_end(LINUX_TRACE_TIMER, timer_fired, 0);
 				atomic_lock();
 				goto restart;
 			}
@@ -241,4 +249,19 @@ need_timer(int flag)
 		pthread_kill(timer_thread, SIGIO);
 }
 
+void
+timer_stats_json(FILE *fp)
+{
+	struct timer_list *t;
+	unsigned pending = 0;
+
+	atomic_lock();
+	TAILQ_FOREACH(t, &timer_head, entry)
+		pending++;
+	fprintf(fp, "{\"pending\":%u,\"added\":%ju,\"fired\":%ju,"
+	    "\"needed\":%d}", pending, (uintmax_t)timer_added,
+	    (uintmax_t)timer_fired, timer_needed);
+	atomic_unlock();
+}
+
 module_init(timer_init);
@@ -52,6 +52,7 @@ int	timer_pending(const struct timer_list *timer);
 uint64_t get_jiffies_64(void);
 void	init_timer(struct timer_list *timer);
 void	need_timer(int flag);
+void	timer_stats_json(FILE *);
 int	mod_timer(struct timer_list *timer, unsigned long);
 
 #endif					/* _LINUX_TIMER_H_ */
@@ -0,0 +1,261 @@
+/*-
+ * Copyright (c) 2026 Hans Petter Selasky. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifdef HAVE_TRACE
+
+/*
+ * Each thread records its trace events into a private ring buffer,
+ * without any locking. When the ring is full, the oldest events are
+ * overwritten. The rings are written to a file in the Chrome trace
+ * event format, which can be loaded into Perfetto or chrome://tracing,
+ * by linux_trace_dump().
+ */
+#define	LINUX_TRACE_RING_SIZE 8192	/* entries, must be power of two */
+#define	LINUX_TRACE_RING_MASK (LINUX_TRACE_RING_SIZE - 1)
+
+struct linux_trace_entry {
+	uint64_t usecs;
+	uint32_t arg[2];
+	uint8_t	event;
+	uint8_t	phase;
+};
+
+struct linux_trace_ring {
+	TAILQ_ENTRY(linux_trace_ring) entry;
+	pthread_t thread;
+	char	name[24];
+	uint32_t head;			/* written by owner thread only */
+	uint8_t	exited;
+	struct linux_trace_entry data[LINUX_TRACE_RING_SIZE];
+};
+
+static const struct {
+	const char *name;
+	const char *cat;
+	const char *arg[2];
+}	linux_trace_desc[LINUX_TRACE_MAX] = {
+	[LINUX_TRACE_USB_SUBMIT] = {"usb_submit_urb", "usb", {"ep", "length"}},
+	[LINUX_TRACE_USB_CALLBACK] = {"usb_callback", "usb", {"ep", "status"}},
+	[LINUX_TRACE_USB_COMPLETE] = {"usb_complete", "usb", {"ep", "length"}},
+	[LINUX_TRACE_WAKE_UP] = {"wake_up", "sched", {"poll", NULL}},
+	[LINUX_TRACE_IOCTL] = {"v4b_ioctl", "cuse", {"cmd", "error"}},
+	[LINUX_TRACE_TIMER] = {"timer", "sched", {"fired", NULL}},
+	[LINUX_TRACE_WORK] = {"work", "sched", {"executed", NULL}},
+	[LINUX_TRACE_VTUNER_SEND] = {"vtuner_send", "vtuner", {"fd", "length"}},
+	[LINUX_TRACE_VTUNER_RECV] = {"vtuner_recv", "vtuner", {"fd", "length"}},
+};
+
+static char trace_dir[128] = "/var/tmp";
+
+module_param_string(trace_dir, trace_dir, sizeof(trace_dir), 0444);
+MODULE_PARM_DESC(trace_dir, "Set directory for trace files");
+
+static pthread_mutex_t linux_trace_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t linux_trace_once = PTHREAD_ONCE_INIT;
+static pthread_key_t linux_trace_key;
+static TAILQ_HEAD(, linux_trace_ring) linux_trace_rings =
+    TAILQ_HEAD_INITIALIZER(linux_trace_rings);
+static uint32_t linux_trace_seq;
+static __thread struct linux_trace_ring *linux_trace_self;
+
+static void
+linux_trace_thread_exit(void *arg)
+{
+	struct linux_trace_ring *ring = arg;
+
+	pthread_mutex_lock(&linux_trace_mtx);
+	ring->exited = 1;
+	pthread_mutex_unlock(&linux_trace_mtx);
+}
+
+static void
+linux_trace_init(void)
+{
+	pthread_key_create(&linux_trace_key, &linux_trace_thread_exit);
+}
+
+static struct linux_trace_ring *
+linux_trace_ring_get(void)
+{
+	struct linux_trace_ring *ring;
+
+	pthread_once(&linux_trace_once, &linux_trace_init);
+
+	/* reuse the ring of an exited thread, if any */
+	pthread_mutex_lock(&linux_trace_mtx);
+	TAILQ_FOREACH(ring, &linux_trace_rings, entry) {
+		if (ring->exited != 0)
+			break;
+	}
+	if (ring == NULL) {
+		ring = calloc(1, sizeof(*ring));
+		if (ring == NULL) {
+			pthread_mutex_unlock(&linux_trace_mtx);
+			return (NULL);
+		}
+		TAILQ_INSERT_TAIL(&linux_trace_rings, ring, entry);
+	}
+	ring->thread = pthread_self();
+	ring->head = 0;
+	ring->exited = 0;
+	strlcpy(ring->name, "thread", sizeof(ring->name));
+	pthread_mutex_unlock(&linux_trace_mtx);
+
+	pthread_setspecific(linux_trace_key, ring);
+	linux_trace_self = ring;
+	return (ring);
+}
+
+static uint64_t
+linux_trace_usecs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000ULL + (ts.tv_nsec / 1000));
+}
+
+void
+linux_trace_record(uint8_t event, uint8_t phase, uint32_t a, uint32_t b)
+{
+	struct linux_trace_ring *ring = linux_trace_self;
+	struct linux_trace_entry *pte;
+	uint32_t head;
+
+	if (ring == NULL) {
+		ring = linux_trace_ring_get();
+		if (ring == NULL)
+			return;
+	}
+	head = ring->head;
+	pte = &ring->data[head & LINUX_TRACE_RING_MASK];
+	pte->usecs = linux_trace_usecs();
+	pte->arg[0] = a;
+	pte->arg[1] = b;
+	pte->event = event;
+	pte->phase = phase;
+
+	/* publish the entry to linux_trace_dump() */
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+static void
+linux_trace_dump_ring(FILE *fp, struct linux_trace_ring *ring,
+    unsigned tid, pid_t pid, const char **psep)
+{
+	struct linux_trace_entry te;
+	uint32_t head;
+	uint32_t x;
+
+	thread_stats_name(ring->thread, ring->name, sizeof(ring->name));
+
+	fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,"
+	    "\"tid\":%u,\"args\":{\"name\":", *psep, (int)pid, tid);
+	json_print_string(fp, ring->name);
+	fprintf(fp, "}}");
+	*psep = ",\n";
+
+	head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	if (head > LINUX_TRACE_RING_SIZE)
+		x = head - LINUX_TRACE_RING_SIZE;
+	else
+		x = 0;
+
+	for (; x != head; x++) {
+		te = ring->data[x & LINUX_TRACE_RING_MASK];
+
+		/*
+		 * Skip entries which the owner thread might have
+		 * overwritten while they were copied.
+		 */
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&ring->head, __ATOMIC_RELAXED) - x >=
+		    LINUX_TRACE_RING_SIZE)
+			continue;
+		if (te.event >= LINUX_TRACE_MAX)
+			continue;
+
+		fprintf(fp, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%c\","
+		    "\"ts\":%ju,\"pid\":%d,\"tid\":%u,",
+		    linux_trace_desc[te.event].name,
+		    linux_trace_desc[te.event].cat, te.phase,
+		    (uintmax_t)te.usecs, (int)pid, tid);
+		if (te.phase == LINUX_TRACE_INSTANT)
+			fprintf(fp, "\"s\":\"t\",");
+		fprintf(fp, "\"args\":{\"%s\":%u",
+		    linux_trace_desc[te.event].arg[0], te.arg[0]);
+		if (linux_trace_desc[te.event].arg[1] != NULL) {
+			fprintf(fp, ",\"%s\":%u",
+			    linux_trace_desc[te.event].arg[1], te.arg[1]);
+		}
+		fprintf(fp, "}}");
+	}
+}
+
+/*------------------------------------------------------------------------*
+ *	linux_trace_dump
+ *
+ * The following function writes the contents of all trace rings to a
+ * new file in the "trace_dir" directory. The threads keep recording
+ * while the rings are dumped.
+ *------------------------------------------------------------------------*/
+void
+linux_trace_dump(void)
+{
+	struct linux_trace_ring *ring;
+	const char *sep = "";
+	char path[192];
+	pid_t pid = getpid();
+	unsigned tid = 0;
+	FILE *fp;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/webcamd.%d.%u.trace.json",
+	    trace_dir, (int)pid, __atomic_fetch_add(&linux_trace_seq, 1,
+	    __ATOMIC_RELAXED));
+
+	fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0600);
+	if (fd < 0 || (fp = fdopen(fd, "w")) == NULL) {
+		if (fd > -1)
+			close(fd);
+		syslog(LOG_WARNING, "Cannot create trace file '%s'\n", path);
+		return;
+	}
+	fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+	pthread_mutex_lock(&linux_trace_mtx);
+	TAILQ_FOREACH(ring, &linux_trace_rings, entry)
+		linux_trace_dump_ring(fp, ring, tid++, pid, &sep);
+	pthread_mutex_unlock(&linux_trace_mtx);
+
+	fprintf(fp, "\n]}\n");
+
+	if (fclose(fp) != 0)
+		syslog(LOG_WARNING, "Cannot write trace file '%s'\n", path);
+	else
+		syslog(LOG_INFO, "Trace written to '%s'\n", path);
+}
+
+#endif					/* HAVE_TRACE */
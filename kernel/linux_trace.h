@@ -0,0 +1,65 @@
+/*-
+ * Copyright (c) 2026 Hans Petter Selasky. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _LINUX_TRACE_H_
+#define	_LINUX_TRACE_H_
+
+enum {
+	LINUX_TRACE_USB_SUBMIT,
+	LINUX_TRACE_USB_CALLBACK,
+	LINUX_TRACE_USB_COMPLETE,
+	LINUX_TRACE_WAKE_UP,
+	LINUX_TRACE_IOCTL,
+	LINUX_TRACE_TIMER,
+	LINUX_TRACE_WORK,
+	LINUX_TRACE_VTUNER_SEND,
+	LINUX_TRACE_VTUNER_RECV,
+	LINUX_TRACE_MAX,
+};
+
+#define	LINUX_TRACE_INSTANT 'i'
+#define	LINUX_TRACE_BEGIN 'B'
+#define	LINUX_TRACE_END 'E'
+
+/*
+ * The trace points are only compiled in when HAVE_TRACE is defined.
+ */
+#ifdef HAVE_TRACE
+#define	linux_trace_event(ev, a, b) \
+	linux_trace_record(ev, LINUX_TRACE_INSTANT, a, b)
+#define	linux_trace_begin(ev, a, b) \
+	linux_trace_record(ev, LINUX_TRACE_BEGIN, a, b)
+#define	linux_trace_end(ev, a, b) \
+	linux_trace_record(ev, LINUX_TRACE_END, a, b)
+
+void	linux_trace_record(uint8_t, uint8_t, uint32_t, uint32_t);
+void	linux_trace_dump(void);
+#else
+#define	linux_trace_event(ev, a, b) do { } while (0)
+#define	linux_trace_begin(ev, a, b) do { } while (0)
+#define	linux_trace_end(ev, a, b) do { } while (0)
+#endif
+
+#endif					/* _LINUX_TRACE_H_ */
@@ -41,6 +41,11 @@ static int min_frames;
 module_param(min_frames, int, 0644);
 MODULE_PARM_DESC(min_frames, "Set minimum ISOC buffering in milliseconds");
 
+static int idle_timeout = 10;
+
+module_param(idle_timeout, int, 0644);
+MODULE_PARM_DESC(idle_timeout, "Set seconds before idle USB buffers are freed, 0 disables");
+
 struct usb_linux_softc {
 	struct libusb20_config *pcfg;
 	struct libusb20_device *pdev;
@@ -50,11 +55,19 @@ struct usb_linux_softc {
 	pthread_t thread;
 	volatile int thread_started;
 	volatile int thread_stopping;
+	uint8_t	ep_regrow;
+	uint64_t idle_check;
 };
 
 static struct usb_linux_softc uls[16];
 static struct device usb_dummy_bus;
 
+/*
+ * Isochronous IN endpoint last submitted by the current thread, see
+ * usb_linux_isoc_submitted().
+ */
+static __thread int usb_isoc_submitted;
+
 /* prototypes */
 
 static libusb20_tr_callback_t usb_linux_isoc_callback;
@@ -66,10 +79,19 @@ static void usb_linux_free_device(struct usb_device *dev);
 
 static struct usb_device *usb_linux_create_usb_device(struct usb_linux_softc *sc, struct libusb20_device *udev, struct libusb20_config *pcfg, uint16_t addr);
 static void usb_linux_cleanup_interface(struct usb_device *, struct usb_interface *);
+static void usb_linux_suspend_endpoint(struct usb_device *, struct usb_host_endpoint *);
+static void usb_linux_resume_endpoint(struct usb_device *, struct usb_host_endpoint *);
+static void usb_linux_suspend_interface(struct usb_device *, struct usb_interface *);
+static void usb_linux_resume_interface(struct usb_device *, struct usb_interface *);
 static void usb_linux_complete(struct libusb20_transfer *);
+static uint64_t usb_linux_usecs(void);
 static int usb_unlink_urb_sub(struct urb *, uint8_t);
 static int usb_setup_endpoint(struct usb_device *dev, struct usb_host_endpoint *uhe, int bufsize);
+static void usb_linux_maintain_endpoints(struct usb_linux_softc *);
+static void usb_linux_regrow_request(struct urb *, struct usb_host_endpoint *);
 static struct usb_host_endpoint *usb_find_host_endpoint(struct usb_device *dev, unsigned int pipe);
+static void usb_api_blocking_completion(struct urb *);
+static int usb_start_wait_urb(struct urb *, int, int *);
 
 /*------------------------------------------------------------------------*
  * FreeBSD USB interface
@@ -170,6 +192,8 @@ usb_exec(void *arg)
 
 	signal(SIGIO, &thread_io);
 
+	thread_stats_register("usb");
+
 	sc->thread_started = 1;
 
 	while (1) {
@@ -178,6 +202,7 @@ usb_exec(void *arg)
 
 		atomic_lock();
 		err = libusb20_dev_process(dev);
+		usb_linux_maintain_endpoints(sc);
 		atomic_unlock();
 
 		wake_up_inhibit(false);
@@ -194,13 +219,15 @@ usb_exec(void *arg)
 			else
 				usleep(100000);
 		}
-		/* wait for USB event from kernel */
-		libusb20_dev_wait_process(dev, -1);
+		/* wait for USB event from kernel, or buffer maintenance */
+		libusb20_dev_wait_process(dev, 1000);
 
 		if (sc->thread_stopping)
 			break;
 	}
 
+	thread_stats_unregister();
+
 	sc->thread_started = 0;
 
 	pthread_exit(NULL);
@@ -625,6 +652,7 @@ usb_submit_urb_sub(struct libusb20_transfer *xfer)
 int
 usb_submit_urb(struct urb *urb, uint16_t mem_flags)
 {
+	struct usb_linux_softc *sc;
 	struct usb_host_endpoint *uhe;
 	int err;
 
@@ -641,6 +669,35 @@ usb_submit_urb(struct urb *urb, uint16_t mem_flags)
 		atomic_unlock();
 		return (-EINVAL);
 	}
+	linux_trace_event(LINUX_TRACE_USB_SUBMIT,
+	    uhe->desc.bEndpointAddress, urb->transfer_buffer_length);
+
+	if (uhe->bsd_maxlen < (int)urb->transfer_buffer_length)
+		uhe->bsd_maxlen = urb->transfer_buffer_length;
+	uhe->bsd_last_use = jiffies;
+	sc = urb->dev->parent;
+
+	if ((uhe->desc.bmAttributes & USB_ENDPOINT_XFERTYPE_MASK) ==
+	    USB_ENDPOINT_XFER_ISOC &&
+	    (uhe->desc.bEndpointAddress & USB_ENDPOINT_DIR_MASK) == USB_DIR_IN)
+		usb_isoc_submitted = ((sc - uls) << 8) | uhe->desc.bEndpointAddress;
+
+	/*
+	 * The USB transfers are closed while usb_set_interface() is
+	 * changing an alternate setting. Only queue the URB. It is
+	 * started when the endpoints are resumed.
+	 */
+	if (urb->dev->bsd_alt_busy != 0) {
+		urb->hcpriv = USB_HCPRIV_QUEUED;
+		if (urb->bsd_urb_list.tqe_prev == NULL) {
+			TAILQ_INSERT_TAIL(&uhe->bsd_urb_list, urb, bsd_urb_list);
+			urb->status = -EINPROGRESS;
+			urb->bsd_time[0] = usb_linux_usecs();
+		}
+		atomic_unlock();
+		return (0);
+	}
+
 	err = usb_setup_endpoint(urb->dev, uhe,
 	    urb->transfer_buffer_length);
 	if (err) {
@@ -663,6 +720,7 @@ usb_submit_urb(struct urb *urb, uint16_t mem_flags)
 		if (urb->bsd_urb_list.tqe_prev == NULL) {
 			TAILQ_INSERT_TAIL(&uhe->bsd_urb_list, urb, bsd_urb_list);
 			urb->status = -EINPROGRESS;
+			urb->bsd_time[0] = usb_linux_usecs();
 		}
 		/*
 		 * Check if this is a re-submit in context of a USB
@@ -672,6 +730,15 @@ usb_submit_urb(struct urb *urb, uint16_t mem_flags)
 		if (urb->bsd_no_resubmit == 0) {
 			usb_submit_urb_sub(uhe->bsd_xfer[0]);
 			usb_submit_urb_sub(uhe->bsd_xfer[1]);
+
+			/*
+			 * Check if the buffers are too small. The
+			 * transfers are reopened by the USB event
+			 * thread, because we might be called from a
+			 * USB callback.
+			 */
+			if (uhe->bsd_regrow != 0 && sc->thread_started != 0)
+				pthread_kill(sc->thread, SIGIO);
 		}
 		err = 0;
 	} else {
@@ -807,8 +874,8 @@ usb_clear_halt(struct usb_device *dev, unsigned int pipe)
 /*------------------------------------------------------------------------*
  *	usb_control_msg
  *
- * The following function performs a control transfer sequence one any
- * control, bulk or interrupt endpoint, specified by "uhe". A control
+ * The following function performs a control transfer sequence on any
+ * control endpoint, specified by "pipe". A control
  * transfer means that you transfer an 8-byte header first followed by
  * a data-phase as indicated by the 8-byte header. The "timeout" is
  * given in milliseconds.
@@ -824,48 +891,47 @@ usb_control_msg(struct usb_device *dev, unsigned int pipe,
     uint16_t value, uint16_t wIndex, void *data,
     uint16_t size, uint32_t timeout)
 {
-	struct LIBUSB20_CONTROL_SETUP_DECODED req;
+	struct usb_ctrlrequest req;
 	struct usb_host_endpoint *uhe;
+	struct urb *urb;
+	int actlen;
 	int err;
-	uint16_t actlen;
-	uint8_t type;
-	uint8_t addr;
-
-	LIBUSB20_INIT(LIBUSB20_CONTROL_SETUP, &req);
-
-	req.bmRequestType = requesttype;
-	req.bRequest = request;
-	req.wValue = value;
-	req.wIndex = wIndex;
-	req.wLength = size;
 
 	atomic_lock();
 	uhe = usb_find_host_endpoint(dev, pipe);
 	atomic_unlock();
 
-	if (uhe == NULL) {
+	if (uhe == NULL)
 		return (-EINVAL);
-	}
-	type = (uhe->desc.bmAttributes & USB_ENDPOINT_XFERTYPE_MASK);
-	addr = (uhe->desc.bEndpointAddress & USB_ENDPOINT_NUMBER_MASK);
-
-	if (type != USB_ENDPOINT_XFER_CONTROL) {
+	if ((uhe->desc.bmAttributes & USB_ENDPOINT_XFERTYPE_MASK) !=
+	    USB_ENDPOINT_XFER_CONTROL)
 		return (-EINVAL);
-	}
-	if (addr == 0) {
-		/*
-		 * The FreeBSD USB stack supports standard control
-		 * transfers on control endpoint zero:
-		 */
-		err = libusb20_dev_request_sync(dev->bsd_udev, &req,
-		    data, &actlen, timeout, 0);
-		if (err)
-			return (-EPIPE);
 
-		return (actlen);
-	}
-	/* TODO: implement support for non-endpoint zero */
-	return (-EINVAL);
+	req.bRequestType = requesttype;
+	req.bRequest = request;
+	req.wValue = cpu_to_le16(value);
+	req.wIndex = cpu_to_le16(wIndex);
+	req.wLength = cpu_to_le16(size);
+
+	urb = usb_alloc_urb(0, GFP_KERNEL);
+	if (urb == NULL)
+		return (-ENOMEM);
+
+	/*
+	 * Control requests on any control endpoint are queued like
+	 * other URBs and executed by usb_linux_ctrl_callback(). The
+	 * caller sleeps on a completion while the request is in
+	 * progress, for at most "timeout" milliseconds unless the
+	 * timeout is zero.
+	 */
+	usb_fill_control_urb(urb, dev, pipe, (unsigned char *)&req,
+	    data, size, usb_api_blocking_completion, NULL);
+
+	err = usb_start_wait_urb(urb, timeout, &actlen);
+	if (err)
+		return (err);
+
+	return (actlen);
 }
 
 /*------------------------------------------------------------------------*
@@ -893,33 +959,56 @@ usb_set_interface(struct usb_device *dev, uint8_t iface_no, uint8_t alt_index)
 
 	atomic_lock();
 	drops = atomic_drop();
+	dev->bsd_alt_busy++;
 	atomic_unlock();
 
 	/*
 	 * Due to the LibUSB v2.0 design, doing an alternate setting
-	 * on one endpoint means we need to kill the URB's on the
-	 * other endpoints aswell!
+	 * on one interface tears down the USB transfers of all the
+	 * other interfaces and of endpoint zero aswell. Close the
+	 * transfers of the affected interface and suspend the other
+	 * endpoints, keeping their URBs queued, so that they can be
+	 * restarted after the alternate setting has been changed.
+	 * URBs submitted meanwhile are only queued, see
+	 * usb_submit_urb().
 	 */
+	usb_linux_cleanup_interface(dev, p_ui);
+
+	atomic_lock();
+	usb_linux_suspend_endpoint(dev, &dev->ep0);
 	for (ui = dev->bsd_iface_start;
-	    ui != dev->bsd_iface_end; ui++)
-		usb_linux_cleanup_interface(dev, ui);
+	    ui != dev->bsd_iface_end; ui++) {
+		if (ui != p_ui)
+			usb_linux_suspend_interface(dev, ui);
+	}
+	atomic_unlock();
 
 	err = libusb20_dev_set_alt_index(dev->bsd_udev,
 	    p_ui->bsd_iface_index, alt_index);
 
+	atomic_lock();
+	if (err == 0) {
+		p_ui->cur_altsetting = p_ui->altsetting + alt_index;
+
+		usb_linux_fill_ep_info(dev, p_ui->cur_altsetting);
+	}
+	/* the last alternate setting change resumes all endpoints */
+	if (--(dev->bsd_alt_busy) == 0) {
+		for (ui = dev->bsd_iface_start;
+		    ui != dev->bsd_iface_end; ui++)
+			usb_linux_resume_interface(dev, ui);
+		usb_linux_resume_endpoint(dev, &dev->ep0);
+	}
+	atomic_unlock();
+
 	/* XXX */
 
 	atomic_lock();
 	atomic_pickup(drops);
 	atomic_unlock();
 
-	if (err) {
+	if (err)
 		err = -EPIPE;
-	} else {
-		p_ui->cur_altsetting = p_ui->altsetting + alt_index;
-
-		usb_linux_fill_ep_info(dev, p_ui->cur_altsetting);
-	}
 
 	usb_linux_create_event_thread(dev);
 
@@ -940,6 +1029,644 @@ usb_unsetup_endpoint(struct usb_device *dev,
 	}
 }
 
+/*------------------------------------------------------------------------*
+ *	usb_linux_urb_is_write
+ *
+ * The following function returns non-zero if an URB in progress on
+ * the given endpoint may already have changed the device state.
+ *------------------------------------------------------------------------*/
+static uint8_t
+usb_linux_urb_is_write(struct usb_host_endpoint *uhe, struct urb *urb)
+{
+	struct usb_ctrlrequest *req;
+
+	if ((uhe->desc.bmAttributes & USB_ENDPOINT_XFERTYPE_MASK) ==
+	    USB_ENDPOINT_XFER_CONTROL) {
+		/* the device may already have executed the request */
+		req = (struct usb_ctrlrequest *)urb->setup_packet;
+		return (req == NULL || (req->bRequestType & USB_DIR_IN) == 0);
+	}
+	return ((uhe->desc.bEndpointAddress & USB_ENDPOINT_DIR_MASK) != USB_DIR_IN);
+}
+
+/*------------------------------------------------------------------------*
+ *	usb_linux_suspend_endpoint
+ *
+ * The following function closes the USB transfers of an endpoint.
+ * URBs which are in progress are put back first on the endpoint
+ * queue, oldest first, so that they are restarted by
+ * usb_linux_resume_endpoint(). URBs which may already have sent
+ * data to the device are completed with an error instead, because
+ * replaying them could repeat a write. Must be called with the
+ * atomic lock held.
+ *------------------------------------------------------------------------*/
+static void
+usb_linux_suspend_endpoint(struct usb_device *dev,
+    struct usb_host_endpoint *uhe)
+{
+	struct libusb20_transfer *xfer;
+	struct urb *urb[2];
+	struct urb *temp;
+	uint16_t x;
+	unsigned y;
+
+	for (y = 0; y != 2; y++) {
+		xfer = uhe->bsd_xfer[y];
+		urb[y] = NULL;
+		if (xfer == NULL || libusb20_tr_pending(xfer) == 0)
+			continue;
+		urb[y] = libusb20_tr_get_priv_sc1(xfer);
+		libusb20_tr_set_priv_sc1(xfer, NULL);
+		if (urb[y] != NULL && urb[y]->bsd_urb_list.tqe_prev != NULL)
+			urb[y] = NULL;
+	}
+	usb_unsetup_endpoint(dev, uhe);
+
+	/* the newest URB is inserted first */
+	if (urb[0] != NULL && urb[1] != NULL &&
+	    urb[0]->bsd_time[0] > urb[1]->bsd_time[0]) {
+		temp = urb[0];
+		urb[0] = urb[1];
+		urb[1] = temp;
+	}
+	for (y = 2; y-- != 0; ) {
+		if (urb[y] == NULL)
+			continue;
+		if (usb_linux_urb_is_write(uhe, urb[y]) == 0) {
+			TAILQ_INSERT_HEAD(&uhe->bsd_urb_list, urb[y], bsd_urb_list);
+			continue;
+		}
+		urb[y]->status = -ECONNRESET;
+		urb[y]->actual_length = 0;
+		uhe->bsd_stats.cancels++;
+		for (x = 0; x < urb[y]->number_of_packets; x++)
+			urb[y]->iso_frame_desc[x].actual_length = 0;
+		if (urb[y]->complete) {
+			urb[y]->hcpriv = NULL;
+			(urb[y]->complete) (urb[y]);
+		}
+	}
+}
+
+/*------------------------------------------------------------------------*
+ *	usb_linux_resume_endpoint
+ *
+ * The following function reopens the USB transfers closed by
+ * usb_linux_suspend_endpoint() and restarts any queued URBs. Must be
+ * called with the atomic lock held.
+ *------------------------------------------------------------------------*/
+static void
+usb_linux_resume_endpoint(struct usb_device *dev,
+    struct usb_host_endpoint *uhe)
+{
+	if (TAILQ_FIRST(&uhe->bsd_urb_list) == NULL)
+		return;
+	if (usb_setup_endpoint(dev, uhe, uhe->bsd_bufsize) != 0)
+		return;
+	usb_submit_urb_sub(uhe->bsd_xfer[0]);
+	usb_submit_urb_sub(uhe->bsd_xfer[1]);
+}
+
+/*------------------------------------------------------------------------*
+ *	usb_linux_suspend_interface
+ *
+ * The following function suspends the endpoints of the current
+ * alternate setting of an interface. Must be called with the atomic
+ * lock held.
+ *------------------------------------------------------------------------*/
+static void
+usb_linux_suspend_interface(struct usb_device *dev,
+    struct usb_interface *iface)
+{
+	struct usb_host_interface *uhi = iface->cur_altsetting;
+	unsigned x;
+
+	if (uhi == NULL)
+		return;
+
+	for (x = 0; x != uhi->desc.bNumEndpoints; x++)
+		usb_linux_suspend_endpoint(dev, uhi->endpoint + x);
+}
+
+/*------------------------------------------------------------------------*
+ *	usb_linux_resume_interface
+ *
+ * The following function resumes the endpoints suspended by
+ * usb_linux_suspend_interface(). Must be called with the atomic lock
+ * held.
+ *------------------------------------------------------------------------*/
+static void
+usb_linux_resume_interface(struct usb_device *dev,
+    struct usb_interface *iface)
+{
+	struct usb_host_interface *uhi = iface->cur_altsetting;
+	unsigned x;
+
+	if (uhi == NULL)
+		return;
+
+	for (x = 0; x != uhi->desc.bNumEndpoints; x++)
+		usb_linux_resume_endpoint(dev, uhi->endpoint + x);
+}
+
+/*------------------------------------------------------------------------*
+ *	usb_endpoint_bufsize
+ *
+ * The following function returns the per transfer buffer size used
+ * for URBs of "bufsize" bytes on a BULK, INTERRUPT or CONTROL
+ * endpoint, excluding the setup packet. Buffers are sized after what
+ * the driver actually submits and are rounded up to a power of two,
+ * so that a growing URB size only reopens the transfers a few times.
+ *------------------------------------------------------------------------*/
+static int
+usb_endpoint_bufsize(struct usb_device *dev,
+    struct usb_host_endpoint *uhe, int bufsize)
+{
+	uint8_t type = uhe->desc.bmAttributes & USB_ENDPOINT_XFERTYPE_MASK;
+	int maxp;
+
+	if (type == USB_ENDPOINT_XFER_CONTROL) {
+		if (bufsize < 256)
+			bufsize = 256;
+		bufsize = roundup_pow_of_two(bufsize);
+		if (bufsize > 65536)
+			bufsize = 65536;
+	} else {
+		maxp = usb_endpoint_maxp(&uhe->desc) *
+		    usb_endpoint_maxp_mult(&uhe->desc);
+		if (bufsize < min_bufsize)
+			bufsize = min_bufsize;
+		if (bufsize < maxp)
+			bufsize = maxp;
+		if (bufsize < 64)
+			bufsize = 64;
+		bufsize = roundup_pow_of_two(bufsize);
+	}
+	return (bufsize);
+}
+
+/*------------------------------------------------------------------------*
+ *	usb_endpoint_fixed_bufsize
+ *
+ * The following function returns the per transfer buffer size which
+ * a fixed buffer sizing policy would have used for the given
+ * endpoint. It is only used for the statistics.
+ *------------------------------------------------------------------------*/
+static int
+usb_endpoint_fixed_bufsize(struct usb_device *dev,
+    struct usb_host_endpoint *uhe)
+{
+	uint8_t type = uhe->desc.bmAttributes & USB_ENDPOINT_XFERTYPE_MASK;
+	uint8_t speed = libusb20_dev_get_speed(dev->bsd_udev);
+	int bufsize = uhe->bsd_bufsize;
+
+	if (type == USB_ENDPOINT_XFER_CONTROL)
+		return (65536 + 8);
+	if (bufsize < min_bufsize)
+		bufsize = min_bufsize;
+	if (speed == LIBUSB20_SPEED_LOW) {
+		if (bufsize < 256)
+			bufsize = 256;
+	} else if (type == USB_ENDPOINT_XFER_INT ||
+	    speed == LIBUSB20_SPEED_FULL) {
+		if (bufsize < 4096)
+			bufsize = 4096;
+	} else {
+		if (bufsize < 131072)
+			bufsize = 131072;
+	}
+	return (bufsize);
+}
+
+/*------------------------------------------------------------------------*
+ *	usb_endpoint_capacity
+ *
+ * The following function returns the largest URB, in bytes, which
+ * fits into the currently open USB transfers of an endpoint.
+ *------------------------------------------------------------------------*/
+static int
+usb_endpoint_capacity(struct usb_host_endpoint *uhe)
+{
+	uint8_t type = uhe->desc.bmAttributes & USB_ENDPOINT_XFERTYPE_MASK;
+	uint32_t len;
+
+	if (uhe->bsd_xfer[0] == NULL)
+		return (0);
+	len = libusb20_tr_get_max_total_length(uhe->bsd_xfer[0]);
+	if (type == USB_ENDPOINT_XFER_CONTROL)
+		len = (len < 8) ? 0 : (len - 8);
+	return (len);
+}
+
+static uint8_t
+usb_endpoint_pending(struct usb_host_endpoint *uhe)
+{
+	return ((uhe->bsd_xfer[0] != NULL &&
+	    libusb20_tr_pending(uhe->bsd_xfer[0])) ||
+	    (uhe->bsd_xfer[1] != NULL &&
+	    libusb20_tr_pending(uhe->bsd_xfer[1])));
+}
+
+/*------------------------------------------------------------------------*
+ *	usb_regrow_endpoint
+ *
+ * The following function reopens the USB transfers of an endpoint
+ * with buffers large enough for the largest URB submitted so far, and
+ * restarts the queued URBs. If any of the transfers is still pending,
+ * nothing is done and the USB event thread retries later. This
+ * function must not be called from a USB callback. If the
+ * larger buffers cannot be allocated, the previous size is restored
+ * and URBs which do not fit fail with -EFBIG. Must be called with the
+ * atomic lock held.
+ *------------------------------------------------------------------------*/
+static void
+usb_regrow_endpoint(struct usb_device *dev,
+    struct usb_host_endpoint *uhe)
+{
+	int size;
+
+	if (usb_endpoint_pending(uhe))
+		return;
+
+	uhe->bsd_regrow = 0;
+
+	size = usb_endpoint_capacity(uhe);
+
+	usb_unsetup_endpoint(dev, uhe);
+
+	if (usb_setup_endpoint(dev, uhe, uhe->bsd_bufsize) != 0) {
+		uhe->bsd_maxlen = size;
+		if (usb_setup_endpoint(dev, uhe, size) != 0)
+			return;
+	}
+	/* refuse URBs which still do not fit, if any */
+	size = usb_endpoint_capacity(uhe);
+	if (uhe->bsd_maxlen > size)
+		uhe->bsd_maxlen = size;
+
+	usb_submit_urb_sub(uhe->bsd_xfer[0]);
+	usb_submit_urb_sub(uhe->bsd_xfer[1]);
+}
+
+/*------------------------------------------------------------------------*
+ *	usb_linux_maintain_endpoint
+ *
+ * The following function regrows the buffers of an endpoint when
+ * requested by the transfer callbacks, and frees the buffers of an
+ * endpoint which has been idle for "idle_timeout" seconds, if they
+ * are larger than the minimum size. The buffers are allocated again
+ * by the next usb_submit_urb(), sized after the URBs submitted from
+ * then on.
+ *------------------------------------------------------------------------*/
+static void
+usb_linux_maintain_endpoint(struct usb_device *dev,
+    struct usb_host_endpoint *uhe, uint8_t idle)
+{
+	uint8_t type = uhe->desc.bmAttributes & USB_ENDPOINT_XFERTYPE_MASK;
+
+	if (type == USB_ENDPOINT_XFER_ISOC)
+		return;
+	if (uhe->bsd_xfer[0] == NULL && uhe->bsd_xfer[1] == NULL)
+		return;
+	if (uhe->bsd_regrow != 0) {
+		usb_regrow_endpoint(dev, uhe);
+		return;
+	}
+	if (idle == 0 || usb_endpoint_pending(uhe) ||
+	    TAILQ_FIRST(&uhe->bsd_urb_list) != NULL)
+		return;
+	if (!time_after(jiffies, uhe->bsd_last_use + (idle_timeout * HZ)))
+		return;
+	if (usb_endpoint_capacity(uhe) <= usb_endpoint_bufsize(dev, uhe, 0))
+		return;
+
+	usb_unsetup_endpoint(dev, uhe);
+	uhe->bsd_maxlen = 0;
+}
+
+static void
+usb_linux_maintain_endpoints(struct usb_linux_softc *sc)
+{
+	struct usb_device *dev = sc->p_dev;
+	struct usb_host_interface *uhi;
+	struct usb_interface *ui;
+	uint8_t idle = 0;
+	unsigned x;
+
+	if (dev == NULL)
+		return;
+
+	if (idle_timeout > 0 && time_after(jiffies, sc->idle_check + HZ)) {
+		sc->idle_check = jiffies;
+		idle = 1;
+	}
+	if (sc->ep_regrow == 0 && idle == 0)
+		return;
+
+	sc->ep_regrow = 0;
+
+	usb_linux_maintain_endpoint(dev, &dev->ep0, idle);
+
+	for (ui = dev->bsd_iface_start; ui != dev->bsd_iface_end; ui++) {
+		uhi = ui->cur_altsetting;
+		if (uhi == NULL)
+			continue;
+		for (x = 0; x != uhi->desc.bNumEndpoints; x++)
+			usb_linux_maintain_endpoint(dev, uhi->endpoint + x, idle);
+	}
+}
+
+static void
+usb_linux_min_bufsize_check(struct usb_linux_softc *sc,
+    struct usb_host_endpoint *uhe)
+{
+	uint8_t type = uhe->desc.bmAttributes & USB_ENDPOINT_XFERTYPE_MASK;
+
+	/* control endpoint buffers do not depend on "min_bufsize" */
+	if (type == USB_ENDPOINT_XFER_ISOC ||
+	    type == USB_ENDPOINT_XFER_CONTROL || uhe->bsd_xfer[0] == NULL)
+		return;
+	if (usb_endpoint_capacity(uhe) >= min_bufsize)
+		return;
+	uhe->bsd_regrow = 1;
+	sc->ep_regrow = 1;
+}
+
+/*------------------------------------------------------------------------*
+ *	usb_linux_min_bufsize_notify
+ *
+ * The following function is called when the "min_bufsize" parameter
+ * is changed at runtime. Open BULK and INTERRUPT endpoints with
+ * smaller buffers are regrown by their USB event thread once their
+ * transfers are idle.
+ *------------------------------------------------------------------------*/
+static void
+usb_linux_min_bufsize_notify(struct mod_param *p)
+{
+	struct usb_host_interface *uhi;
+	struct usb_interface *ui;
+	struct usb_device *dev;
+	unsigned i;
+	unsigned x;
+
+	atomic_lock();
+	for (i = 0; i != ARRAY_SIZE(uls); i++) {
+		dev = uls[i].p_dev;
+		if (dev == NULL)
+			continue;
+
+		for (ui = dev->bsd_iface_start; ui != dev->bsd_iface_end; ui++) {
+			uhi = ui->cur_altsetting;
+			if (uhi == NULL)
+				continue;
+			for (x = 0; x != uhi->desc.bNumEndpoints; x++)
+				usb_linux_min_bufsize_check(uls + i, uhi->endpoint + x);
+		}
+		if (uls[i].ep_regrow != 0 && uls[i].thread_started != 0)
+			pthread_kill(uls[i].thread, SIGIO);
+	}
+	atomic_unlock();
+}
+
+module_param_notify(min_bufsize, usb_linux_min_bufsize_notify);
+
+static void
+usb_linux_stats_endpoint(FILE *fp, struct usb_device *dev,
+    struct usb_host_endpoint *uhe, size_t *palloc, size_t *pfixed)
+{
+	uint8_t type = uhe->desc.bmAttributes & USB_ENDPOINT_XFERTYPE_MASK;
+	size_t alloc = 0;
+	size_t fixed;
+	unsigned y;
+
+	if (type == USB_ENDPOINT_XFER_ISOC)
+		return;
+	if (uhe->bsd_xfer[0] == NULL && uhe->bsd_maxlen == 0)
+		return;
+
+	for (y = 0; y != 2; y++) {
+		if (uhe->bsd_xfer[y] != NULL)
+			alloc += libusb20_tr_get_max_total_length(uhe->bsd_xfer[y]);
+	}
+	fixed = 2 * (size_t)usb_endpoint_fixed_bufsize(dev, uhe);
+
+	fprintf(fp, "ugen%u.%u: endpoint 0x%02x: %zu bytes allocated, "
+	    "%zu bytes with fixed sizing, %d bytes largest URB\n",
+	    libusb20_dev_get_bus_number(dev->bsd_udev),
+	    libusb20_dev_get_address(dev->bsd_udev),
+	    uhe->desc.bEndpointAddress, alloc, fixed, uhe->bsd_maxlen);
+
+	*palloc += alloc;
+	*pfixed += fixed;
+}
+
+static void
+usb_linux_stats_hist(FILE *fp, const char *prefix, const char *what,
+    const uint32_t *hist)
+{
+	unsigned n;
+
+	fprintf(fp, "%s: %s us", prefix, what);
+	for (n = 0; n != USB_STATS_HIST; n++) {
+		if (hist[n] == 0)
+			continue;
+		if (n == USB_STATS_HIST - 1)
+			fprintf(fp, " >=%u:%u", 1U << (n - 1), hist[n]);
+		else
+			fprintf(fp, " <%u:%u", 1U << n, hist[n]);
+	}
+	fprintf(fp, "\n");
+}
+
+static void
+usb_linux_stats_urbs(FILE *fp, struct usb_device *dev,
+    struct usb_host_interface *uhi, struct usb_host_endpoint *uhe)
+{
+	struct usb_host_endpoint_stats *st = &uhe->bsd_stats;
+	char prefix[64];
+
+	if (st->urbs == 0)
+		return;
+
+	if (uhi == NULL) {
+		snprintf(prefix, sizeof(prefix), "ugen%u.%u: endpoint 0x%02x",
+		    libusb20_dev_get_bus_number(dev->bsd_udev),
+		    libusb20_dev_get_address(dev->bsd_udev),
+		    uhe->desc.bEndpointAddress);
+	} else {
+		snprintf(prefix, sizeof(prefix),
+		    "ugen%u.%u: endpoint 0x%02x iface %u alt %u",
+		    libusb20_dev_get_bus_number(dev->bsd_udev),
+		    libusb20_dev_get_address(dev->bsd_udev),
+		    uhe->desc.bEndpointAddress,
+		    uhi->desc.bInterfaceNumber,
+		    uhi->desc.bAlternateSetting);
+	}
+	fprintf(fp, "%s: %ju URBs, %ju bytes, %ju errors, %ju cancelled, "
+	    "%ju timeouts, %ju short\n", prefix,
+	    (uintmax_t)st->urbs, (uintmax_t)st->bytes,
+	    (uintmax_t)st->errors, (uintmax_t)st->cancels,
+	    (uintmax_t)st->timeouts, (uintmax_t)st->shorts);
+
+	usb_linux_stats_hist(fp, prefix, "queue", st->queue_hist);
+	usb_linux_stats_hist(fp, prefix, "transfer", st->xfer_hist);
+	usb_linux_stats_hist(fp, prefix, "callback", st->complete_hist);
+}
+
+/*------------------------------------------------------------------------*
+ *	usb_linux_stats
+ *
+ * The following function prints the USB transfer buffer memory used
+ * by each BULK, INTERRUPT and CONTROL endpoint, next to the memory a
+ * fixed buffer sizing policy would have used. Then the URB counters
+ * and latency histograms of every endpoint which has completed URBs
+ * are printed, including endpoints of inactive alternate settings.
+ *------------------------------------------------------------------------*/
+void
+usb_linux_stats(FILE *fp)
+{
+	struct usb_host_interface *uhi;
+	struct usb_interface *ui;
+	struct usb_device *dev;
+	size_t alloc;
+	size_t fixed;
+	unsigned i;
+	unsigned x;
+	unsigned y;
+
+	atomic_lock();
+	for (i = 0; i != ARRAY_SIZE(uls); i++) {
+		dev = uls[i].p_dev;
+		if (dev == NULL)
+			continue;
+
+		alloc = fixed = 0;
+
+		usb_linux_stats_endpoint(fp, dev, &dev->ep0, &alloc, &fixed);
+
+		for (ui = dev->bsd_iface_start; ui != dev->bsd_iface_end; ui++) {
+			uhi = ui->cur_altsetting;
+			if (uhi == NULL)
+				continue;
+			for (x = 0; x != uhi->desc.bNumEndpoints; x++) {
+				usb_linux_stats_endpoint(fp, dev,
+				    uhi->endpoint + x, &alloc, &fixed);
+			}
+		}
+		fprintf(fp, "ugen%u.%u: %zu bytes of transfer buffers, "
+		    "%zu bytes with fixed sizing\n",
+		    libusb20_dev_get_bus_number(dev->bsd_udev),
+		    libusb20_dev_get_address(dev->bsd_udev), alloc, fixed);
+
+		usb_linux_stats_urbs(fp, dev, NULL, &dev->ep0);
+
+		for (ui = dev->bsd_iface_start; ui != dev->bsd_iface_end; ui++) {
+			for (y = 0; y != ui->num_altsetting; y++) {
+				uhi = ui->altsetting + y;
+				for (x = 0; x != uhi->desc.bNumEndpoints; x++) {
+					usb_linux_stats_urbs(fp, dev,
+					    uhi, uhi->endpoint + x);
+				}
+			}
+		}
+	}
+	atomic_unlock();
+}
+
+static void
+usb_linux_stats_json_hist(FILE *fp, const char *what, const uint32_t *hist)
+{
+	unsigned n;
+
+	fprintf(fp, ",\"%s\":[", what);
+	for (n = 0; n != USB_STATS_HIST; n++)
+		fprintf(fp, "%s%u", n ? "," : "", hist[n]);
+	fprintf(fp, "]");
+}
+
+static void
+usb_linux_stats_json_endpoint(FILE *fp, struct usb_host_interface *uhi,
+    struct usb_host_endpoint *uhe, const char **psep)
+{
+	static const char *type_name[4] = {"control", "isoc", "bulk", "interrupt"};
+	struct usb_host_endpoint_stats *st = &uhe->bsd_stats;
+	size_t alloc = 0;
+	unsigned y;
+
+	if (st->urbs == 0 && uhe->bsd_xfer[0] == NULL)
+		return;
+
+	for (y = 0; y != 2; y++) {
+		if (uhe->bsd_xfer[y] != NULL)
+			alloc += libusb20_tr_get_max_total_length(uhe->bsd_xfer[y]);
+	}
+	fprintf(fp, "%s{\"address\":%u,\"iface\":%d,\"alt\":%d,"
+	    "\"type\":\"%s\",\"alloc\":%zu,\"maxlen\":%d,"
+	    "\"urbs\":%ju,\"bytes\":%ju,\"errors\":%ju,\"cancels\":%ju,"
+	    "\"timeouts\":%ju,\"shorts\":%ju", *psep,
+	    uhe->desc.bEndpointAddress,
+	    uhi ? uhi->desc.bInterfaceNumber : -1,
+	    uhi ? uhi->desc.bAlternateSetting : -1,
+	    type_name[uhe->desc.bmAttributes & USB_ENDPOINT_XFERTYPE_MASK],
+	    alloc, uhe->bsd_maxlen,
+	    (uintmax_t)st->urbs, (uintmax_t)st->bytes,
+	    (uintmax_t)st->errors, (uintmax_t)st->cancels,
+	    (uintmax_t)st->timeouts, (uintmax_t)st->shorts);
+	usb_linux_stats_json_hist(fp, "queue_hist", st->queue_hist);
+	usb_linux_stats_json_hist(fp, "xfer_hist", st->xfer_hist);
+	usb_linux_stats_json_hist(fp, "callback_hist", st->complete_hist);
+	fprintf(fp, "}");
+	*psep = ",";
+}
+
+/*------------------------------------------------------------------------*
+ *	usb_linux_stats_json
+ *
+ * The following function prints the same information as
+ * usb_linux_stats() as a JSON array with one object per USB device.
+ *------------------------------------------------------------------------*/
+void
+usb_linux_stats_json(FILE *fp)
+{
+	struct usb_host_interface *uhi;
+	struct usb_interface *ui;
+	struct usb_device *dev;
+	const char *dsep = "";
+	const char *esep;
+	unsigned i;
+	unsigned x;
+	unsigned y;
+
+	fprintf(fp, "[");
+	atomic_lock();
+	for (i = 0; i != ARRAY_SIZE(uls); i++) {
+		dev = uls[i].p_dev;
+		if (dev == NULL)
+			continue;
+
+		fprintf(fp, "%s{\"device\":\"ugen%u.%u\",\"endpoints\":[",
+		    dsep, libusb20_dev_get_bus_number(dev->bsd_udev),
+		    libusb20_dev_get_address(dev->bsd_udev));
+		dsep = ",";
+		esep = "";
+
+		usb_linux_stats_json_endpoint(fp, NULL, &dev->ep0, &esep);
+
+		for (ui = dev->bsd_iface_start; ui != dev->bsd_iface_end; ui++) {
+			for (y = 0; y != ui->num_altsetting; y++) {
+				uhi = ui->altsetting + y;
+				for (x = 0; x != uhi->desc.bNumEndpoints; x++) {
+					usb_linux_stats_json_endpoint(fp,
+					    uhi, uhi->endpoint + x, &esep);
+				}
+			}
+		}
+		fprintf(fp, "]}");
+	}
+	atomic_unlock();
+	fprintf(fp, "]");
+}
+
 /*------------------------------------------------------------------------*
  *	usb_setup_endpoint
  *
@@ -949,7 +1676,9 @@ usb_unsetup_endpoint(struct usb_device *dev,
  * to set a maximum buffer size, the endpoint will not be functional.
  * Note that for isochronous endpoints the maximum buffer size must be
  * a non-zero dummy, hence this function will base the maximum buffer
- * size on "wMaxPacketSize".
+ * size on "wMaxPacketSize". For other endpoints the buffer size is
+ * raised to the largest URB submitted so far, see
+ * usb_endpoint_bufsize().
  *------------------------------------------------------------------------*/
 static int
 usb_setup_endpoint(struct usb_device *dev,
@@ -958,7 +1687,6 @@ usb_setup_endpoint(struct usb_device *dev,
 	uint8_t type = uhe->desc.bmAttributes & USB_ENDPOINT_XFERTYPE_MASK;
 	uint8_t addr = uhe->desc.bEndpointAddress;
 	uint8_t ep_index = (((addr & 0x80) / 0x40) | (addr * 4)) % (16 * 4);
-	uint8_t speed;
 
 	if (uhe->bsd_xfer[0] ||
 	    uhe->bsd_xfer[1]) {
@@ -967,9 +1695,14 @@ usb_setup_endpoint(struct usb_device *dev,
 	}
 	uhe->bsd_xfer[0] = libusb20_tr_get_pointer(dev->bsd_udev, ep_index + 0);
 	uhe->bsd_xfer[1] = libusb20_tr_get_pointer(dev->bsd_udev, ep_index + 1);
+	uhe->bsd_bufsize = bufsize;
+	uhe->bsd_regrow = 0;
+
+	if (bufsize < uhe->bsd_maxlen)
+		bufsize = uhe->bsd_maxlen;
 
 	if (type == USB_ENDPOINT_XFER_CONTROL) {
-		unsigned bufsize = 65536 + 8;
+		bufsize = usb_endpoint_bufsize(dev, uhe, bufsize) + 8;
 
 		/* one transfer and one frame */
 		if (libusb20_tr_open(uhe->bsd_xfer[0], bufsize,
@@ -1014,24 +1747,8 @@ usb_setup_endpoint(struct usb_device *dev,
 
 	} else {
 
-		speed = libusb20_dev_get_speed(dev->bsd_udev);
-
 		/* figure out a sensible buffer size */
-		if (bufsize < 0)
-			bufsize = 0;
-		if (bufsize < min_bufsize)
-			bufsize = min_bufsize;
-		if (speed == LIBUSB20_SPEED_LOW) {
-			if (bufsize < 256)
-				bufsize = 256;
-		} else if (type == USB_ENDPOINT_XFER_INT ||
-		    speed == LIBUSB20_SPEED_FULL) {
-			if (bufsize < 4096)
-				bufsize = 4096;
-		} else {
-			if (bufsize < 131072)
-				bufsize = 131072;
-		}
+		bufsize = usb_endpoint_bufsize(dev, uhe, bufsize);
 
 		/* one transfer and one frame */
 		if (libusb20_tr_open(uhe->bsd_xfer[0], bufsize,
@@ -1621,7 +2338,7 @@ urb_destroy(struct kref *kref)
 
 	/* free transfer buffer, if free buffer flag is set */
 	if (urb->transfer_flags & URB_FREE_BUFFER)
-		free(urb->transfer_buffer);
+		kfree(urb->transfer_buffer);
 
 	/* just free it */
 	free(urb);
@@ -1723,20 +2440,169 @@ usb_linux_cleanup_interface(struct usb_device *dev,
 	atomic_unlock();
 }
 
+/*------------------------------------------------------------------------*
+ *	usb_linux_usecs
+ *
+ * The following functions are used to collect the per endpoint URB
+ * statistics. Time is measured in microseconds using the monotonic
+ * clock.
+ *------------------------------------------------------------------------*/
+static uint64_t
+usb_linux_usecs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000ULL + (ts.tv_nsec / 1000));
+}
+
+static void
+usb_linux_stats_add(uint32_t *hist, uint64_t usecs)
+{
+	unsigned n;
+
+	n = (usecs == 0) ? 0 : (64 - __builtin_clzll(usecs));
+	if (n > USB_STATS_HIST - 1)
+		n = USB_STATS_HIST - 1;
+	hist[n]++;
+}
+
+/*------------------------------------------------------------------------*
+ *	usb_linux_isoc_submitted
+ *
+ * The following function returns the isochronous IN endpoint which
+ * was last submitted by the calling thread, and forgets it. A video
+ * device uses this to find the endpoint which was started by its
+ * ioctls. Returns zero if no such endpoint was submitted.
+ *------------------------------------------------------------------------*/
+int
+usb_linux_isoc_submitted(void)
+{
+	int ep = usb_isoc_submitted;
+
+	usb_isoc_submitted = 0;
+	return (ep);
+}
+
+/*------------------------------------------------------------------------*
+ *	usb_linux_isoc_lookup
+ *
+ * The following function looks up the last completion callback of the
+ * given isochronous endpoint, as returned by usb_linux_isoc_submitted(),
+ * which started before the given time, in microseconds of the monotonic
+ * clock. Returns zero on success, else no such completion was recorded.
+ *------------------------------------------------------------------------*/
+int
+usb_linux_isoc_lookup(int ep, uint64_t usecs, uint64_t *pstart,
+    uint32_t *pxfer)
+{
+	struct usb_host_endpoint_stats *st;
+	struct usb_host_endpoint *uhe;
+	struct usb_device *dev;
+	unsigned n;
+	unsigned x;
+	unsigned y;
+	int retval = -1;
+
+	if (ep == 0 || (unsigned)(ep >> 8) >= ARRAY_SIZE(uls))
+		return (-1);
+
+	atomic_lock();
+	dev = uls[ep >> 8].p_dev;
+	uhe = (dev != NULL) ?
+	    usb_find_host_endpoint(dev, usb_rcvisocpipe(dev, ep & 0xFF)) : NULL;
+	if (uhe == NULL)
+		goto done;
+
+	st = &uhe->bsd_stats;
+	n = st->isoc_count;
+	for (x = 0; x != USB_ISOC_HISTORY && x != n; x++) {
+		y = (n - x - 1) % USB_ISOC_HISTORY;
+		if (st->isoc_usecs[y] > usecs)
+			continue;
+		*pstart = st->isoc_usecs[y];
+		*pxfer = st->isoc_xfer[y];
+		retval = 0;
+		break;
+	}
+done:
+	atomic_unlock();
+
+	return (retval);
+}
+
+static void
+usb_linux_start_stats(struct usb_host_endpoint *uhe, struct urb *urb)
+{
+	urb->bsd_time[1] = usb_linux_usecs();
+	usb_linux_stats_add(uhe->bsd_stats.queue_hist,
+	    urb->bsd_time[1] - urb->bsd_time[0]);
+}
+
 /*------------------------------------------------------------------------*
  *	usb_linux_complete
  *------------------------------------------------------------------------*/
 static void
 usb_linux_complete(struct libusb20_transfer *xfer)
 {
+	struct usb_host_endpoint *uhe = libusb20_tr_get_priv_sc0(xfer);
+	struct usb_host_endpoint_stats *st = &uhe->bsd_stats;
 	struct urb *urb;
+	uint64_t now;
+	uint16_t x;
 
 	urb = libusb20_tr_get_priv_sc1(xfer);
 	libusb20_tr_set_priv_sc1(xfer, NULL);
 
+	now = usb_linux_usecs();
+	usb_linux_stats_add(st->xfer_hist, now - urb->bsd_time[1]);
+
+	if ((uhe->desc.bmAttributes & USB_ENDPOINT_XFERTYPE_MASK) ==
+	    USB_ENDPOINT_XFER_ISOC) {
+		x = st->isoc_count++ % USB_ISOC_HISTORY;
+		st->isoc_usecs[x] = now;
+		st->isoc_xfer[x] = now - urb->bsd_time[1];
+	}
+
+	st->urbs++;
+	st->bytes += urb->actual_length;
+
+	switch (libusb20_tr_get_status(xfer)) {
+	case LIBUSB20_TRANSFER_COMPLETED:
+		if ((uhe->desc.bmAttributes & USB_ENDPOINT_XFERTYPE_MASK) ==
+		    USB_ENDPOINT_XFER_ISOC) {
+			for (x = 0; x != urb->number_of_packets; x++) {
+				if (urb->iso_frame_desc[x].actual_length <
+				    urb->iso_frame_desc[x].length)
+					st->shorts++;
+			}
+		} else if (urb->actual_length < urb->transfer_buffer_length) {
+			st->shorts++;
+		}
+		break;
+	case LIBUSB20_TRANSFER_CANCELLED:
+		st->cancels++;
+		break;
+	case LIBUSB20_TRANSFER_TIMED_OUT:
+		st->timeouts++;
+		break;
+	default:
+		break;
+	}
+	if (urb->status != 0 && urb->status != -ECONNRESET)
+		st->errors++;
+
 	if (urb->complete) {
 		urb->hcpriv = NULL;
+		linux_trace_begin(LINUX_TRACE_USB_COMPLETE,
+		    uhe->desc.bEndpointAddress, urb->actual_length);
 		(urb->complete) (urb);
+		linux_trace_end(LINUX_TRACE_USB_COMPLETE,
+		    uhe->desc.bEndpointAddress, 0);
+
+		/* the URB might be freed at this point */
+		usb_linux_stats_add(st->complete_hist,
+		    usb_linux_usecs() - now);
 	}
 }
 
@@ -1759,6 +2625,9 @@ usb_linux_isoc_callback(struct libusb20_transfer *xfer)
 	uint8_t status = libusb20_tr_get_status(xfer);
 	uint8_t is_short = 0;
 
+	linux_trace_event(LINUX_TRACE_USB_CALLBACK,
+	    uhe->desc.bEndpointAddress, status);
+
 	switch (status) {
 	case LIBUSB20_TRANSFER_COMPLETED:
 
@@ -1832,6 +2701,8 @@ tr_setup:
 		}
 
 		libusb20_tr_set_priv_sc1(xfer, urb);
+		usb_linux_start_stats(uhe, urb);
+
 		if (urb->timeout == 0) {
 			/*
 			 * Sometimes we are late putting stuff into the
@@ -1907,6 +2778,9 @@ usb_linux_bulk_intr_callback(struct libusb20_transfer *xfer)
 	uint32_t actlen;
 	uint8_t status = libusb20_tr_get_status(xfer);
 
+	linux_trace_event(LINUX_TRACE_USB_CALLBACK,
+	    uhe->desc.bEndpointAddress, status);
+
 	switch (status) {
 	case LIBUSB20_TRANSFER_COMPLETED:
 
@@ -1940,10 +2814,17 @@ tr_setup:
 			/* nothing to do */
 			break;
 		}
+		/* check if the buffers need to grow first */
+		if (urb->transfer_buffer_length > max_bulk &&
+		    urb->transfer_buffer_length <= (uint32_t)uhe->bsd_maxlen) {
+			usb_linux_regrow_request(urb, uhe);
+			break;
+		}
 		TAILQ_REMOVE(&uhe->bsd_urb_list, urb, bsd_urb_list);
 		urb->bsd_urb_list.tqe_prev = NULL;
 
 		libusb20_tr_set_priv_sc1(xfer, urb);
+		usb_linux_start_stats(uhe, urb);
 
 		/* assert valid transfer size */
 		if (urb->transfer_buffer_length > max_bulk) {
@@ -2003,6 +2884,23 @@ tr_setup:
 	}
 }
 
+/*------------------------------------------------------------------------*
+ *	usb_linux_regrow_request
+ *
+ * The following function is called by the BULK, INTERRUPT and CONTROL
+ * callbacks when the first queued URB does not fit into the transfer
+ * buffers. The URB is left on the queue and the buffers are regrown
+ * once both transfers are idle.
+ *------------------------------------------------------------------------*/
+static void
+usb_linux_regrow_request(struct urb *urb, struct usb_host_endpoint *uhe)
+{
+	struct usb_linux_softc *sc = urb->dev->parent;
+
+	uhe->bsd_regrow = 1;
+	sc->ep_regrow = 1;
+}
+
 /*------------------------------------------------------------------------*
  *	usb_linux_ctrl_callback
  *
@@ -2020,6 +2918,9 @@ usb_linux_ctrl_callback(struct libusb20_transfer *xfer)
 	uint32_t actlen;
 	uint8_t status = libusb20_tr_get_status(xfer);
 
+	linux_trace_event(LINUX_TRACE_USB_CALLBACK,
+	    uhe->desc.bEndpointAddress, status);
+
 	switch (status) {
 	case LIBUSB20_TRANSFER_COMPLETED:
 
@@ -2059,10 +2960,18 @@ tr_setup:
 			/* nothing to do */
 			break;
 		}
+		/* check if the buffers need to grow first */
+		if (max_ctrl >= 8 &&
+		    urb->transfer_buffer_length > (max_ctrl - 8) &&
+		    urb->transfer_buffer_length <= (uint32_t)uhe->bsd_maxlen) {
+			usb_linux_regrow_request(urb, uhe);
+			break;
+		}
 		TAILQ_REMOVE(&uhe->bsd_urb_list, urb, bsd_urb_list);
 		urb->bsd_urb_list.tqe_prev = NULL;
 
 		libusb20_tr_set_priv_sc1(xfer, urb);
+		usb_linux_start_stats(uhe, urb);
 
 		/* assert valid transfer size */
 		if (max_ctrl < 8 ||
@@ -2298,8 +3207,19 @@ usb_start_wait_urb(struct urb *urb, int timeout, int *actual_length)
 	urb->timeout = timeout;
 	retval = usb_submit_urb(urb, GFP_NOIO);
 	if (retval == 0) {
-		wait_for_completion(&ctx.done);
-		retval = ctx.status;
+		if (timeout == 0) {
+			wait_for_completion(&ctx.done);
+			retval = ctx.status;
+		} else if (wait_for_completion_timeout(&ctx.done,
+		    msecs_to_jiffies(timeout)) != 0) {
+			retval = ctx.status;
+		} else {
+			/* the completion callback is still called once */
+			usb_kill_urb(urb);
+			wait_for_completion(&ctx.done);
+			retval = (ctx.status == -ECONNRESET) ?
+			    -ETIMEDOUT : ctx.status;
+		}
 	}
 	if (actual_length)
 		*actual_length = urb->actual_length;
@@ -2812,7 +3732,7 @@ usb_sg_init(struct usb_sg_request *io, struct usb_device *dev,
 	int i;
 	int urb_flags;
 
-	if (!io || !dev || !sg || usb_pipecontrol(pipe) || usb_pipeisoc(pipe) || nents != 1)
+	if (!io || !dev || !sg || usb_pipecontrol(pipe) || usb_pipeisoc(pipe) || nents <= 0)
 		return (-EINVAL);
 
 	spin_lock_init(&io->lock);
@@ -2829,7 +3749,12 @@ usb_sg_init(struct usb_sg_request *io, struct usb_device *dev,
 	if (usb_pipein(pipe))
 		urb_flags |= URB_SHORT_NOT_OK;
 
-	for (i = 0; i != 1; i++) {
+	/*
+	 * Each scatter gather entry gets its own URB. The URBs are
+	 * queued back to back on the endpoint by usb_sg_wait(), so the
+	 * transfers are pipelined and no bounce buffer is needed.
+	 */
+	for (i = 0; i != io->entries; i++, sg++) {
 		struct urb *urb;
 		unsigned len;
 
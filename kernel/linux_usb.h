@@ -457,6 +457,30 @@ struct usb_ss_ep_comp_descriptor {
  * refer to the USB specification for a definition of "endpoints" and
  * "interfaces".
  */
+/*
+ * Per endpoint URB statistics. The histograms have log2 sized buckets
+ * in microseconds, where bucket "n" counts durations below 2**n
+ * microseconds and the last bucket counts everything above.
+ */
+#define	USB_STATS_HIST 24
+#define	USB_ISOC_HISTORY 64
+
+struct usb_host_endpoint_stats {
+	uint64_t urbs;			/* completed URBs */
+	uint64_t bytes;			/* bytes transferred */
+	uint64_t errors;		/* URBs completed with an error */
+	uint64_t cancels;		/* URBs cancelled */
+	uint64_t timeouts;		/* transfers timed out */
+	uint64_t shorts;		/* short transfers or ISO packets */
+	uint32_t queue_hist[USB_STATS_HIST];	/* time queued */
+	uint32_t xfer_hist[USB_STATS_HIST];	/* time on the bus */
+	uint32_t complete_hist[USB_STATS_HIST];	/* time in callback */
+	/* recent isochronous completions, see usb_linux_isoc_lookup() */
+	uint64_t isoc_usecs[USB_ISOC_HISTORY];	/* start of callback */
+	uint32_t isoc_xfer[USB_ISOC_HISTORY];	/* time on the bus */
+	uint32_t isoc_count;
+};
+
 struct usb_host_endpoint {
 	struct usb_endpoint_descriptor desc;
 	struct usb_ss_ep_comp_descriptor ss_ep_comp;
@@ -465,6 +489,13 @@ struct usb_host_endpoint {
 
 	struct libusb20_transfer *bsd_xfer[2];
 
+	int	bsd_bufsize;		/* buffer size given at setup */
+	int	bsd_maxlen;		/* largest URB submitted */
+	uint64_t bsd_last_use;		/* jiffies of last submit */
+	uint8_t	bsd_regrow;		/* reopen transfers when idle */
+
+	struct usb_host_endpoint_stats bsd_stats;
+
 	uint8_t *extra;			/* Extra descriptors */
 
 	uint16_t extralen;
@@ -546,6 +577,8 @@ struct usb_device {
 					 * transfer */
 
 	uint8_t	speed;			/* LIBUSB20_SPEED_XXX */
+	uint8_t	bsd_alt_busy;		/* alternate setting changes in
+					 * progress */
 
 	char	devpath[1];
 
@@ -614,6 +647,8 @@ struct urb {
 	uint8_t	setup_dma;		/* (in) not used on FreeBSD */
 	dma_addr_t transfer_dma;	/* (in) not used on FreeBSD */
 	uint8_t	bsd_no_resubmit;	/* (internal) FreeBSD specific */
+	uint64_t bsd_time[2];		/* (internal) queue and start time in
+					 * microseconds */
 
 	struct usb_iso_packet_descriptor iso_frame_desc[];	/* (in) ISO ONLY */
 };
@@ -651,6 +686,10 @@ int	usb_linux_probe_p(int *p_bus, int *p_addr, int *p_index, const char **ppdesc
 int	usb_linux_detach(int fd);
 int	usb_linux_suspend(int fd);
 int	usb_linux_resume(int fd);
+void	usb_linux_stats(FILE *);
+void	usb_linux_stats_json(FILE *);
+int	usb_linux_isoc_submitted(void);
+int	usb_linux_isoc_lookup(int, uint64_t, uint64_t *, uint32_t *);
 
 #define	interface_to_usbdev(intf) (intf)->usb_dev
 #define	interface_to_bsddev(intf) (intf)->usb_dev->bsd_udev
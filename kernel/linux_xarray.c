@@ -50,56 +50,43 @@ xa_erase(struct xarray *xa, uint32_t index)
 
 /*
  * This function returns the element pointer at the given index. A
- * value of NULL is returned if the element does not exist.
+ * value of NULL is returned if the element does not exist. The radix
+ * tree lookup is lockless and does not need the xarray lock.
  */
 void *
 xa_load(struct xarray *xa, uint32_t index)
 {
-	void *retval;
-
-	xa_lock(xa);
-	retval = radix_tree_lookup(&xa->root, index);
-	xa_unlock(xa);
-
-	return (retval);
+	return (radix_tree_lookup(&xa->root, index));
 }
 
 /*
- * This function iterates the xarray until it finds a free slot where
- * it can insert the element pointer to by "ptr". It starts at the
- * index pointed to by "pindex" and updates this value at return. The
- * "mask" argument defines the maximum index allowed, inclusivly, and
- * must be a power of two minus one value. The "gfp" argument
- * basically tells if we can wait for more memory to become available
- * or not. This function returns zero upon success or a negative error
- * code on failure. A typical error code is -ENOMEM which means either
- * the xarray is full, or there was not enough internal memory
- * available to complete the radix tree insertion.
+ * This function finds the first free slot in the xarray where it can
+ * insert the element pointer to by "ptr". The index of the slot is
+ * stored at the location pointed to by "pindex". The "mask" argument
+ * defines the maximum index allowed, inclusivly, and must be a power
+ * of two minus one value. The "gfp" argument basically tells if we
+ * can wait for more memory to become available or not. This function
+ * returns zero upon success or a negative error code on failure. A
+ * typical error code is -ENOMEM which means either the xarray is
+ * full, or there was not enough internal memory available to
+ * complete the radix tree insertion.
  */
 int
 __xa_alloc(struct xarray *xa, uint32_t *pindex, void *ptr, uint32_t mask, gfp_t gfp)
 {
+	unsigned long index = 0;
 	int retval;
 
 	XA_ASSERT_LOCKED(xa);
 
-	*pindex = 0;
-retry:
-	retval = radix_tree_insert(&xa->root, *pindex, ptr);
-
-	switch (retval) {
-	case -EEXIST:
-		if (likely(*pindex != mask)) {
-			(*pindex)++;
-			goto retry;
-		}
+	retval = radix_tree_find_free(&xa->root, &index, mask);
+	if (likely(retval == 0))
+		retval = radix_tree_insert(&xa->root, index, ptr);
+	else
 		retval = -ENOMEM;
-		break;
-	case -ENOMEM:
-		break;
-	default:
-		break;
-	}
+
+	if (likely(retval == 0))
+		*pindex = index;
 	return (retval);
 }
 
@@ -117,39 +104,36 @@ xa_alloc(struct xarray *xa, uint32_t *pindex, void *ptr, uint32_t mask, gfp_t gf
 
 /*
  * This function works the same like the "xa_alloc" function, except
- * it wraps the next index value to zero when there are no entries
- * left at the end of the xarray searching for a free slot from the
- * beginning of the array. If the xarray is full -ENOMEM is returned.
+ * it starts searching for a free slot at the index pointed to by
+ * "pnext_index" and wraps to zero when there are no entries left at
+ * the end of the xarray. Upon success the index following the
+ * allocated one is stored at "pnext_index". If the xarray is full
+ * -ENOMEM is returned.
  */
 int
 __xa_alloc_cyclic(struct xarray *xa, uint32_t *pindex, void *ptr, uint32_t mask,
     uint32_t *pnext_index, gfp_t gfp)
 {
+	unsigned long index;
 	int retval;
-	int timeout = 1;
 
 	XA_ASSERT_LOCKED(xa);
 
-	*pnext_index = 0;
-retry:
-	retval = radix_tree_insert(&xa->root, *pnext_index, ptr);
-
-	switch (retval) {
-	case -EEXIST:
-		if (unlikely(*pnext_index == mask) && !timeout--) {
-			retval = -ENOMEM;
-			break;
-		}
-		(*pnext_index)++;
-		(*pnext_index) &= mask;
-		goto retry;
-	case -ENOMEM:
-		break;
-	default:
-		break;
+	index = *pnext_index & mask;
+	retval = radix_tree_find_free(&xa->root, &index, mask);
+	if (unlikely(retval != 0 && index != 0)) {
+		index = 0;
+		retval = radix_tree_find_free(&xa->root, &index, mask);
 	}
-	*pindex = *pnext_index;
+	if (likely(retval == 0))
+		retval = radix_tree_insert(&xa->root, index, ptr);
+	else
+		retval = -ENOMEM;
 
+	if (likely(retval == 0)) {
+		*pindex = index;
+		*pnext_index = (index + 1) & mask;
+	}
 	return (retval);
 }
 
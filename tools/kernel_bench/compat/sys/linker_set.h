@@ -0,0 +1,52 @@
+/*-
+ * Copyright (c) 2026 Hans Petter Selasky. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _KERNEL_BENCH_SYS_LINKER_SET_H_
+#define	_KERNEL_BENCH_SYS_LINKER_SET_H_
+
+#ifdef __linux__
+/*
+ * Minimal linker set implementation for the GNU linker, which
+ * provides the __start_ and __stop_ symbols for every section whose
+ * name is a valid C identifier.
+ */
+#define	__MAKE_SET(set, sym)						\
+	static void const * const __set_##set##_sym_##sym		\
+	__attribute__((__section__("set_" #set), __used__)) = &(sym)
+
+#define	TEXT_SET(set, sym) __MAKE_SET(set, sym)
+#define	DATA_SET(set, sym) __MAKE_SET(set, sym)
+
+#define	SET_DECLARE(set, ptype)						\
+	extern ptype * __start_set_##set[] __attribute__((__weak__));	\
+	extern ptype * __stop_set_##set[] __attribute__((__weak__))
+
+#define	SET_BEGIN(set) (__start_set_##set)
+#define	SET_LIMIT(set) (__stop_set_##set)
+#else
+#include_next <sys/linker_set.h>
+#endif
+
+#endif					/* _KERNEL_BENCH_SYS_LINKER_SET_H_ */
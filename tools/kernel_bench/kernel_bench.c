@@ -0,0 +1,2558 @@
+/*-
+ * Copyright (c) 2026 Hans Petter Selasky. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Benchmark for the kernel emulation layer in the kernel/ directory.
+ *
+ * Every scenario prints one JSON object per line on standard output,
+ * so that results can be collected and compared over time. The exit
+ * code is non-zero if any scenario computed a wrong result.
+ */
+
+#include <sys/utsname.h>
+
+#include <linux/i2c.h>
+#include <linux/idr.h>
+
+#ifdef HAVE_FIRMWARE_GZ
+#include <zlib.h>
+#endif
+#ifdef HAVE_FIRMWARE_XZ
+#include <lzma.h>
+#endif
+#ifdef HAVE_FIRMWARE_ZSTD
+#include <zstd.h>
+#endif
+
+#define	KB_SAMPLES_MAX (1U << 20)
+#define	KB_TIMERS 64
+#define	KB_WORKS 256
+
+unsigned long PAGE_SIZE;
+unsigned long PAGE_MASK;
+unsigned char PAGE_SHIFT;
+char	global_fw_prefix[128];
+
+struct kb_result {
+	const char *name;
+	unsigned threads;
+	uint64_t ops;
+	uint64_t nsecs;
+	uint64_t *samples;		/* latency samples in ns, optional */
+	unsigned nsamples;
+};
+
+struct kb_worker {
+	void    (*func) (unsigned);
+	unsigned count;
+	pthread_barrier_t *barrier;
+	pthread_t thread;
+};
+
+struct kb_timer {
+	struct timer_list timer;
+	uint64_t deadline;
+};
+
+static unsigned kb_iterations = 100000;
+static unsigned kb_threads = 8;
+static const char *kb_filter;
+static int kb_failed;
+
+static uint64_t kb_counter;
+static void **kb_ptr_arg;
+static struct mutex kb_mutex;
+static struct semaphore kb_ping;
+static struct semaphore kb_pong;
+static struct completion kb_req;
+static struct completion kb_ack;
+static wait_queue_head_t kb_wq_req;
+static wait_queue_head_t kb_wq_ack;
+static unsigned kb_seq_req;
+static unsigned kb_seq_ack;
+static uint64_t kb_work_start;
+static uint64_t kb_work_target;
+static struct kb_timer kb_timer[KB_TIMERS];
+static struct work_struct kb_work[KB_WORKS];
+static uint64_t *kb_samples;
+static unsigned kb_nsamples;
+
+#if defined(__GLIBC__) && !__GLIBC_PREREQ(2, 38)
+size_t
+strlcpy(char *dst, const char *src, size_t size)
+{
+	size_t len = strlen(src);
+
+	if (size != 0) {
+		size_t n = (len >= size) ? (size - 1) : len;
+
+		memcpy(dst, src, n);
+		dst[n] = 0;
+	}
+	return (len);
+}
+#endif
+
+/*
+ * The following functions are normally provided by webcamd.c:
+ */
+int
+check_signal(void)
+{
+	return (0);
+}
+
+void
+poll_wakeup_internal(void)
+{
+}
+
+/*
+ * The following functions are normally provided by linux_func.c:
+ */
+int
+printk_nop(void)
+{
+	return (1);
+}
+
+const char *
+dev_name(const struct device *dev)
+{
+	return (dev->name);
+}
+
+int
+device_register(struct device *dev)
+{
+	return (0);
+}
+
+static uint64_t
+kb_nsecs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+static void
+kb_fatal(const char *what)
+{
+	fprintf(stderr, "kernel_bench: %s\n", what);
+	exit(1);
+}
+
+static void
+kb_check(int expr, const char *name, const char *what)
+{
+	if (expr)
+		return;
+	fprintf(stderr, "kernel_bench: %s: %s\n", name, what);
+	kb_failed = 1;
+}
+
+static int
+kb_sample_compare(const void *pa, const void *pb)
+{
+	const uint64_t a = *(const uint64_t *)pa;
+	const uint64_t b = *(const uint64_t *)pb;
+
+	return ((a > b) - (a < b));
+}
+
+static void
+kb_samples_reset(void)
+{
+	kb_nsamples = 0;
+}
+
+static void
+kb_sample(uint64_t value)
+{
+	if (kb_nsamples < KB_SAMPLES_MAX)
+		kb_samples[kb_nsamples++] = value;
+}
+
+static void
+kb_report(const struct kb_result *pr)
+{
+	double ns_per_op;
+	double ops_per_sec;
+
+	ns_per_op = pr->ops ? (double)pr->nsecs / (double)pr->ops : 0.0;
+	ops_per_sec = pr->nsecs ?
+	    (double)pr->ops * 1000000000.0 / (double)pr->nsecs : 0.0;
+
+	printf("{\"bench\":");
+	json_print_string(stdout, pr->name);
+	printf(",\"threads\":%u,\"ops\":%ju,\"nsecs\":%ju,"
+	    "\"ns_per_op\":%.1f,\"ops_per_sec\":%.0f",
+	    pr->threads, (uintmax_t)pr->ops, (uintmax_t)pr->nsecs,
+	    ns_per_op, ops_per_sec);
+
+	if (pr->nsamples != 0) {
+		const uint64_t *ps = pr->samples;
+		const unsigned n = pr->nsamples;
+
+		qsort(pr->samples, n, sizeof(pr->samples[0]), &kb_sample_compare);
+		printf(",\"samples\":%u,\"p50_ns\":%ju,\"p90_ns\":%ju,"
+		    "\"p99_ns\":%ju,\"max_ns\":%ju", n,
+		    (uintmax_t)ps[(n * 50) / 100],
+		    (uintmax_t)ps[(n * 90) / 100],
+		    (uintmax_t)ps[(n * 99) / 100],
+		    (uintmax_t)ps[n - 1]);
+	}
+	printf("}\n");
+	fflush(stdout);
+}
+
+static void
+kb_report_ops(const char *name, unsigned threads, uint64_t ops, uint64_t nsecs)
+{
+	struct kb_result res = {
+		.name = name,
+		.threads = threads,
+		.ops = ops,
+		.nsecs = nsecs,
+	};
+
+	kb_report(&res);
+}
+
+static void
+kb_report_samples(const char *name, unsigned threads, uint64_t ops, uint64_t nsecs)
+{
+	struct kb_result res = {
+		.name = name,
+		.threads = threads,
+		.ops = ops,
+		.nsecs = nsecs,
+		.samples = kb_samples,
+		.nsamples = kb_nsamples,
+	};
+
+	kb_report(&res);
+}
+
+static void *
+kb_worker_exec(void *arg)
+{
+	struct kb_worker *pw = arg;
+
+	if (pw->barrier != NULL)
+		pthread_barrier_wait(pw->barrier);
+	pw->func(pw->count);
+	return (NULL);
+}
+
+/*
+ * Run the given loop in "nthreads" threads at the same time and
+ * return the elapsed time in nanoseconds.
+ */
+static uint64_t
+kb_run_threads(void (*func) (unsigned), unsigned nthreads, unsigned count)
+{
+	struct kb_worker worker[nthreads];
+	pthread_barrier_t barrier;
+	uint64_t start;
+	unsigned n;
+
+	pthread_barrier_init(&barrier, NULL, nthreads + 1);
+
+	for (n = 0; n != nthreads; n++) {
+		worker[n].func = func;
+		worker[n].count = count;
+		worker[n].barrier = &barrier;
+		if (pthread_create(&worker[n].thread, NULL,
+		    &kb_worker_exec, &worker[n]) != 0)
+			kb_fatal("Cannot create thread");
+	}
+	/* the workers cannot start before the main thread joins the barrier */
+	start = kb_nsecs();
+	pthread_barrier_wait(&barrier);
+
+	for (n = 0; n != nthreads; n++)
+		pthread_join(worker[n].thread, NULL);
+
+	start = kb_nsecs() - start;
+
+	pthread_barrier_destroy(&barrier);
+
+	return (start);
+}
+
+static void
+kb_start_thread(struct kb_worker *pw, void (*func) (unsigned), unsigned count)
+{
+	pw->func = func;
+	pw->count = count;
+	pw->barrier = NULL;
+
+	if (pthread_create(&pw->thread, NULL, &kb_worker_exec, pw) != 0)
+		kb_fatal("Cannot create thread");
+}
+
+static void
+kb_contention(const char *name, void (*func) (unsigned))
+{
+	unsigned nthreads;
+	uint64_t nsecs;
+
+	for (nthreads = 1; nthreads <= kb_threads; nthreads *= 2) {
+		kb_counter = 0;
+		nsecs = kb_run_threads(func, nthreads, kb_iterations);
+		kb_check(kb_counter == (uint64_t)nthreads * kb_iterations,
+		    name, "lost update");
+		kb_report_ops(name, nthreads,
+		    (uint64_t)nthreads * kb_iterations, nsecs);
+	}
+}
+
+static void
+kb_mutex_loop(unsigned count)
+{
+	while (count--) {
+		mutex_lock(&kb_mutex);
+		kb_counter++;
+		mutex_unlock(&kb_mutex);
+	}
+}
+
+static void
+kb_bench_mutex(void)
+{
+	mutex_init(&kb_mutex);
+	kb_contention("mutex_contention", &kb_mutex_loop);
+	mutex_destroy(&kb_mutex);
+}
+
+static void
+kb_atomic_loop(unsigned count)
+{
+	while (count--) {
+		atomic_lock();
+		kb_counter++;
+		atomic_unlock();
+	}
+}
+
+static void
+kb_bench_atomic(void)
+{
+	kb_contention("atomic_lock_contention", &kb_atomic_loop);
+}
+
+static void
+kb_kmalloc_loop(unsigned count)
+{
+	void *ptr[16];
+	unsigned n;
+
+	for (; count >= 16; count -= 16) {
+		for (n = 0; n != 16; n++)
+			ptr[n] = kmalloc(16 << (n & 7), GFP_KERNEL);
+		for (n = 0; n != 16; n++)
+			kfree(ptr[n]);
+		atomic_lock();
+		kb_counter += 16;
+		atomic_unlock();
+	}
+	atomic_lock();
+	kb_counter += count;
+	atomic_unlock();
+}
+
+/*
+ * Replay the allocations of a V4L2 streaming session: mostly
+ * DQBUF/QBUF pairs, with control reads and a queryctrl enumeration
+ * burst mixed in. Each ioctl allocates its argument copy and a few
+ * temporaries, and frees them when it returns. Every ioctl also
+ * replaces one entry in a ring of longer lived objects, like the
+ * event and request state drivers keep across ioctls.
+ */
+#define	KB_REPLAY_RING 32
+
+struct kb_replay_ioctl {
+	uint16_t size[4];		/* zero terminated */
+	uint8_t zero;			/* first allocation is cleared */
+};
+
+static const struct kb_replay_ioctl kb_replay_trace[] = {
+	{{88, 24, 0}, 1},		/* VIDIOC_DQBUF */
+	{{88, 24, 0}, 1},		/* VIDIOC_QBUF */
+	{{88, 24, 0}, 1},
+	{{88, 24, 0}, 1},
+	{{32, 16 * 8, 40, 0}, 1},	/* VIDIOC_G_EXT_CTRLS */
+	{{88, 24, 0}, 1},
+	{{88, 24, 0}, 1},
+	{{204, 64, 0}, 1},		/* VIDIOC_G_FMT */
+	{{68, 48, 0}, 1},		/* VIDIOC_QUERYCTRL */
+	{{68, 48, 0}, 1},
+	{{68, 48, 0}, 1},
+	{{68, 48, 0}, 1},
+	{{232, 0}, 1},			/* VIDIOC_QUERY_EXT_CTRL */
+	{{88, 24, 0}, 1},
+	{{88, 24, 0}, 1},
+	{{136, 2048, 0}, 0},		/* VIDIOC_DQEVENT and payload */
+};
+
+static void
+kb_replay_loop(void *(*alloc) (size_t, int), void (*release) (void *),
+    unsigned count)
+{
+	void *ring[KB_REPLAY_RING] = {};
+	void *ptr[4];
+	const struct kb_replay_ioctl *pi;
+	unsigned done;
+	unsigned n;
+	unsigned x;
+
+	for (done = n = 0; n != count; n++) {
+		pi = &kb_replay_trace[n % ARRAY_SIZE(kb_replay_trace)];
+
+		for (x = 0; x != 4 && pi->size[x] != 0; x++)
+			ptr[x] = alloc(pi->size[x], pi->zero && x == 0);
+
+		/* replace a long lived object, sized like the request */
+		release(ring[n % KB_REPLAY_RING]);
+		ring[n % KB_REPLAY_RING] = alloc(pi->size[x - 1], 0);
+
+		/* the temporaries go first, the argument copy last */
+		while (x--)
+			release(ptr[x]);
+
+		if (++done == 64) {
+			atomic_lock();
+			kb_counter += done;
+			atomic_unlock();
+			done = 0;
+		}
+	}
+	for (x = 0; x != KB_REPLAY_RING; x++)
+		release(ring[x]);
+
+	atomic_lock();
+	kb_counter += done;
+	atomic_unlock();
+}
+
+static void *
+kb_replay_kmalloc(size_t size, int zero)
+{
+	return (kmalloc(size, zero ? (GFP_KERNEL | __GFP_ZERO) : GFP_KERNEL));
+}
+
+static void
+kb_replay_kfree(void *ptr)
+{
+	kfree(ptr);
+}
+
+static void *
+kb_replay_malloc(size_t size, int zero)
+{
+	return (zero ? calloc(1, size) : malloc(size));
+}
+
+static void
+kb_kmalloc_replay_loop(unsigned count)
+{
+	kb_replay_loop(&kb_replay_kmalloc, &kb_replay_kfree, count);
+}
+
+static void
+kb_malloc_replay_loop(unsigned count)
+{
+	kb_replay_loop(&kb_replay_malloc, &free, count);
+}
+
+static void
+kb_kmalloc_mixed_worker(unsigned count)
+{
+	unsigned n;
+
+	for (n = 0; n != count; n++)
+		kb_ptr_arg[n] = kmalloc(24 << (n % 8), GFP_KERNEL);
+}
+
+/*
+ * kfree(), krealloc() and ksize() must accept pointers which did not
+ * come from the arena, like memory from malloc(), strdup() and large
+ * kmalloc() requests. Run this with the address sanitizer to catch
+ * pointers passed to the wrong free function.
+ */
+static void
+kb_kmalloc_mixed(void)
+{
+	struct kb_worker worker;
+	uint8_t *ptr;
+	uint8_t *dst;
+	char *str;
+	uint64_t start;
+	unsigned cases;
+	unsigned n;
+	size_t x;
+	int ok;
+
+	ok = 1;
+	start = kb_nsecs();
+	for (cases = n = 0; n != 64; n++) {
+		/* malloc() and strdup() memory */
+		ptr = malloc(1 + n * 37);
+		ok &= (ksize(ptr) == 0);
+		kfree(ptr);
+		str = strdup("webcamd");
+		kfree(str);
+
+		/* krealloc() of malloc() memory stays in malloc() */
+		ptr = malloc(32);
+		memset(ptr, n, 32);
+		ptr = krealloc(ptr, 4096 + n, GFP_KERNEL);
+		for (x = 0; x != 32; x++)
+			ok &= (ptr[x] == (uint8_t)n);
+		ok &= (ksize(ptr) == 0);
+		kfree(ptr);
+
+		/* requests above the largest class come from malloc() */
+		ptr = kmalloc(16384 + n, GFP_KERNEL | __GFP_ZERO);
+		ok &= (ptr != NULL && ksize(ptr) == 0 && ptr[16383] == 0);
+		kfree(ptr);
+
+		/* arena memory shrinks in place and grows into malloc() */
+		ptr = kmalloc(100, GFP_KERNEL);
+		ok &= (ksize(ptr) >= 100);
+		memset(ptr, 0xFF, 100);
+		dst = krealloc(ptr, 50, GFP_KERNEL);
+#ifndef HAVE_KMALLOC_DEBUG
+		ok &= (dst == ptr);
+#endif
+		ptr = krealloc(dst, 9000, GFP_KERNEL | __GFP_ZERO);
+		ok &= (ptr != NULL && ksize(ptr) == 0);
+		/* only the memory beyond ksize() of the old object is zeroed */
+		for (x = 0; x != 50; x++)
+			ok &= (ptr[x] == 0xFF);
+		for (x = 128; x != 9000; x++)
+			ok &= (ptr[x] == 0);
+		kfree(ptr);
+
+		/* recycled arena memory is cleared by kzalloc() */
+		ptr = kmalloc(200, GFP_KERNEL);
+		memset(ptr, 0xFF, 200);
+		kfree(ptr);
+		ptr = kzalloc(200, GFP_KERNEL);
+		for (x = 0; x != 200; x++)
+			ok &= (ptr[x] == 0);
+		kfree(ptr);
+
+		kfree(NULL);
+		ok &= (ksize(NULL) == 0);
+		cases += 8;
+	}
+
+	/* objects freed by another thread than the one allocating */
+	kb_ptr_arg = calloc(kb_iterations, sizeof(void *));
+	if (kb_ptr_arg == NULL)
+		kb_fatal("Cannot allocate pointer array");
+	kb_start_thread(&worker, &kb_kmalloc_mixed_worker, kb_iterations);
+	pthread_join(worker.thread, NULL);
+	for (n = 0; n != kb_iterations; n++) {
+		ok &= (ksize(kb_ptr_arg[n]) >= (24U << (n % 8)));
+		kfree(kb_ptr_arg[n]);
+	}
+	free(kb_ptr_arg);
+	kb_ptr_arg = NULL;
+	cases += kb_iterations;
+
+	start = kb_nsecs() - start;
+	kb_check(ok, "kmalloc_mixed_check", "wrong free path or size");
+	kb_report_ops("kmalloc_mixed_check", 1, cases, start);
+}
+
+static void
+kb_bench_kmalloc(void)
+{
+	kb_contention("kmalloc_kfree", &kb_kmalloc_loop);
+	kb_contention("kmalloc_ioctl_replay", &kb_kmalloc_replay_loop);
+	kb_contention("malloc_ioctl_replay", &kb_malloc_replay_loop);
+	kb_kmalloc_mixed();
+}
+
+/*
+ * The ping-pong scenarios measure the round trip latency between two
+ * threads, which is dominated by the wakeup path.
+ */
+static void
+kb_sema_loop(unsigned count)
+{
+	while (count--) {
+		down(&kb_ping);
+		up(&kb_pong);
+	}
+}
+
+static void
+kb_bench_sema(void)
+{
+	const unsigned count = kb_iterations / 10;
+	struct kb_worker worker;
+	uint64_t start;
+	uint64_t t0;
+	unsigned n;
+
+	sema_init(&kb_ping, 0);
+	sema_init(&kb_pong, 0);
+	kb_samples_reset();
+
+	kb_start_thread(&worker, &kb_sema_loop, count);
+	start = kb_nsecs();
+	for (n = 0; n != count; n++) {
+		t0 = kb_nsecs();
+		up(&kb_ping);
+		down(&kb_pong);
+		kb_sample(kb_nsecs() - t0);
+	}
+	start = kb_nsecs() - start;
+	pthread_join(worker.thread, NULL);
+
+	kb_report_samples("sema_pingpong", 2, count, start);
+
+	sema_uninit(&kb_ping);
+	sema_uninit(&kb_pong);
+}
+
+static void
+kb_completion_loop(unsigned count)
+{
+	while (count--) {
+		wait_for_completion(&kb_req);
+		complete(&kb_ack);
+	}
+}
+
+static void
+kb_bench_completion(void)
+{
+	const unsigned count = kb_iterations / 10;
+	struct kb_worker worker;
+	uint64_t start;
+	uint64_t t0;
+	unsigned n;
+
+	init_completion(&kb_req);
+	init_completion(&kb_ack);
+	kb_samples_reset();
+
+	kb_start_thread(&worker, &kb_completion_loop, count);
+	start = kb_nsecs();
+	for (n = 0; n != count; n++) {
+		t0 = kb_nsecs();
+		complete(&kb_req);
+		wait_for_completion(&kb_ack);
+		kb_sample(kb_nsecs() - t0);
+	}
+	start = kb_nsecs() - start;
+	pthread_join(worker.thread, NULL);
+
+	kb_report_samples("completion_pingpong", 2, count, start);
+
+	uninit_completion(&kb_req);
+	uninit_completion(&kb_ack);
+}
+
+static void
+kb_waitqueue_loop(unsigned count)
+{
+	unsigned n;
+
+	for (n = 1; n <= count; n++) {
+		wait_event(kb_wq_req, kb_seq_req == n);
+		atomic_lock();
+		kb_seq_ack = n;
+		atomic_unlock();
+		wake_up(&kb_wq_ack);
+	}
+}
+
+static void
+kb_bench_waitqueue(void)
+{
+	const unsigned count = kb_iterations / 10;
+	struct kb_worker worker;
+	uint64_t start;
+	uint64_t t0;
+	unsigned n;
+
+	init_waitqueue_head(&kb_wq_req);
+	init_waitqueue_head(&kb_wq_ack);
+	kb_seq_req = 0;
+	kb_seq_ack = 0;
+	kb_samples_reset();
+
+	kb_start_thread(&worker, &kb_waitqueue_loop, count);
+	start = kb_nsecs();
+	for (n = 1; n <= count; n++) {
+		t0 = kb_nsecs();
+		atomic_lock();
+		kb_seq_req = n;
+		atomic_unlock();
+		wake_up(&kb_wq_req);
+		wait_event(kb_wq_ack, kb_seq_ack == n);
+		kb_sample(kb_nsecs() - t0);
+	}
+	start = kb_nsecs() - start;
+	pthread_join(worker.thread, NULL);
+
+	kb_report_samples("waitqueue_pingpong", 2, count, start);
+
+	uninit_waitqueue_head(&kb_wq_req);
+	uninit_waitqueue_head(&kb_wq_ack);
+}
+
+/*
+ * Measure how late timers fire compared to their expiry time. The
+ * timer thread is kept in its fast polling mode, like when a device
+ * is open.
+ */
+static void
+kb_timer_callback(struct timer_list *t)
+{
+	struct kb_timer *pt = from_timer(pt, t, timer);
+	uint64_t now = kb_nsecs();
+
+	kb_sample((now > pt->deadline) ? (now - pt->deadline) : 0);
+	complete(&kb_ack);
+}
+
+static void
+kb_bench_timer(void)
+{
+	const unsigned rounds = (kb_iterations / 12500) ? (kb_iterations / 12500) : 1;
+	uint64_t start;
+	uint64_t now;
+	uint64_t ticks;
+	unsigned n;
+	unsigned r;
+
+	init_completion(&kb_ack);
+	kb_samples_reset();
+	need_timer(1);
+
+	start = kb_nsecs();
+	for (r = 0; r != rounds; r++) {
+		for (n = 0; n != KB_TIMERS; n++) {
+			struct kb_timer *pt = &kb_timer[n];
+
+			init_timer(&pt->timer);
+			timer_setup(&pt->timer, &kb_timer_callback, 0);
+
+			ticks = 1 + (n % 16);
+			now = kb_nsecs();
+			pt->deadline = now + jiffies_to_nsecs(ticks);
+			pt->timer.expires = jiffies + ticks;
+			add_timer(&pt->timer);
+		}
+		for (n = 0; n != KB_TIMERS; n++)
+			wait_for_completion(&kb_ack);
+	}
+	start = kb_nsecs() - start;
+
+	need_timer(0);
+
+	kb_check(kb_nsamples == rounds * KB_TIMERS, "timer_lateness",
+	    "missing timer callbacks");
+	kb_report_samples("timer_lateness", 1, (uint64_t)rounds * KB_TIMERS, start);
+
+	uninit_completion(&kb_ack);
+}
+
+/*
+ * The work latency scenario measures the time from schedule_work()
+ * until the work callback starts executing. The throughput scenario
+ * keeps a batch of work items queued at all times.
+ */
+static void
+kb_work_latency_callback(struct work_struct *work)
+{
+	kb_sample(kb_nsecs() - kb_work_start);
+	complete(&kb_ack);
+}
+
+static void
+kb_work_batch_callback(struct work_struct *work)
+{
+	int done;
+
+	atomic_lock();
+	done = (++kb_counter == kb_work_target);
+	atomic_unlock();
+
+	if (done)
+		complete(&kb_ack);
+}
+
+static void
+kb_bench_work(void)
+{
+	const unsigned count = kb_iterations / 10;
+	const unsigned rounds = (kb_iterations / KB_WORKS) ? (kb_iterations / KB_WORKS) : 1;
+	uint64_t start;
+	unsigned n;
+	unsigned r;
+
+	init_completion(&kb_ack);
+	kb_samples_reset();
+
+	INIT_WORK(&kb_work[0], &kb_work_latency_callback);
+
+	start = kb_nsecs();
+	for (n = 0; n != count; n++) {
+		kb_work_start = kb_nsecs();
+		schedule_work(&kb_work[0]);
+		wait_for_completion(&kb_ack);
+	}
+	start = kb_nsecs() - start;
+
+	kb_report_samples("work_latency", 1, count, start);
+
+	for (n = 0; n != KB_WORKS; n++)
+		INIT_WORK(&kb_work[n], &kb_work_batch_callback);
+
+	kb_counter = 0;
+
+	start = kb_nsecs();
+	for (r = 0; r != rounds; r++) {
+		atomic_lock();
+		kb_work_target = (uint64_t)(r + 1) * KB_WORKS;
+		atomic_unlock();
+
+		for (n = 0; n != KB_WORKS; n++)
+			kb_check(schedule_work(&kb_work[n]) != 0,
+			    "work_throughput", "work already queued");
+		wait_for_completion(&kb_ack);
+	}
+	start = kb_nsecs() - start;
+
+	kb_report_ops("work_throughput", 1, (uint64_t)rounds * KB_WORKS, start);
+
+	uninit_completion(&kb_ack);
+}
+
+/*
+ * The ID allocators, the radix tree and the xarray are only used by
+ * one thread at a time. Items are pointers into a static array,
+ * because NULL and unaligned pointers have special meaning.
+ */
+static uint64_t *
+kb_items(void)
+{
+	static uint64_t *items;
+
+	if (items == NULL) {
+		items = calloc(kb_iterations, sizeof(items[0]));
+		if (items == NULL)
+			kb_fatal("Cannot allocate items");
+	}
+	return (items);
+}
+
+static void
+kb_bench_idr(void)
+{
+	uint64_t *items = kb_items();
+	struct idr idr;
+	uint64_t start;
+	unsigned n;
+	int ok;
+
+	idr_init(&idr);
+
+	ok = 1;
+	start = kb_nsecs();
+	for (n = 0; n != kb_iterations; n++)
+		ok &= (idr_alloc(&idr, &items[n], 0, 0, GFP_KERNEL) == (int)n);
+	start = kb_nsecs() - start;
+	kb_check(ok, "idr_alloc", "unexpected ID");
+	kb_report_ops("idr_alloc", 1, kb_iterations, start);
+
+	ok = 1;
+	start = kb_nsecs();
+	for (n = 0; n != kb_iterations; n++)
+		ok &= (idr_find(&idr, n) == &items[n]);
+	start = kb_nsecs() - start;
+	kb_check(ok, "idr_find", "wrong pointer");
+	kb_report_ops("idr_find", 1, kb_iterations, start);
+
+	start = kb_nsecs();
+	for (n = 0; n != kb_iterations; n++)
+		idr_remove(&idr, n);
+	start = kb_nsecs() - start;
+	kb_check(idr_is_empty(&idr), "idr_remove", "IDR not empty");
+	kb_report_ops("idr_remove", 1, kb_iterations, start);
+
+	idr_destroy(&idr);
+}
+
+static void
+kb_bench_ida(void)
+{
+	struct ida ida;
+	uint64_t start;
+	unsigned n;
+	int ok;
+
+	ida_init(&ida);
+
+	ok = 1;
+	start = kb_nsecs();
+	for (n = 0; n != kb_iterations; n++)
+		ok &= (ida_simple_get(&ida, 0, 0, GFP_KERNEL) == (int)n);
+	start = kb_nsecs() - start;
+	kb_check(ok, "ida_get", "unexpected ID");
+	kb_report_ops("ida_get", 1, kb_iterations, start);
+
+	start = kb_nsecs();
+	for (n = 0; n != kb_iterations; n++)
+		ida_simple_remove(&ida, n);
+	start = kb_nsecs() - start;
+	kb_report_ops("ida_remove", 1, kb_iterations, start);
+
+	ida_destroy(&ida);
+}
+
+#define	KB_RADIX_KEY(n) ((unsigned long)(n) * 61UL)
+
+static void
+kb_bench_radix(void)
+{
+	uint64_t *items = kb_items();
+	struct radix_tree_root root;
+	uint64_t start;
+	unsigned n;
+	int ok;
+
+	INIT_RADIX_TREE(&root, GFP_KERNEL);
+
+	ok = 1;
+	start = kb_nsecs();
+	for (n = 0; n != kb_iterations; n++)
+		ok &= (radix_tree_insert(&root, KB_RADIX_KEY(n), &items[n]) == 0);
+	start = kb_nsecs() - start;
+	kb_check(ok, "radix_insert", "insert failed");
+	kb_report_ops("radix_insert", 1, kb_iterations, start);
+
+	ok = 1;
+	start = kb_nsecs();
+	for (n = 0; n != kb_iterations; n++)
+		ok &= (radix_tree_lookup(&root, KB_RADIX_KEY(n)) == &items[n]);
+	start = kb_nsecs() - start;
+	kb_check(ok, "radix_lookup", "wrong pointer");
+	kb_report_ops("radix_lookup", 1, kb_iterations, start);
+
+	ok = 1;
+	start = kb_nsecs();
+	for (n = 0; n != kb_iterations; n++)
+		ok &= (radix_tree_delete(&root, KB_RADIX_KEY(n)) == &items[n]);
+	start = kb_nsecs() - start;
+	kb_check(ok && root.rnode == NULL, "radix_delete", "delete failed");
+	kb_report_ops("radix_delete", 1, kb_iterations, start);
+}
+
+static void
+kb_bench_xarray(void)
+{
+	uint64_t *items = kb_items();
+	struct xarray xa;
+	uint64_t start;
+	uint32_t id;
+	unsigned n;
+	int ok;
+
+	xa_init_flags(&xa, 0);
+
+	ok = 1;
+	start = kb_nsecs();
+	for (n = 0; n != kb_iterations; n++)
+		ok &= (xa_store(&xa, n, &items[n], GFP_KERNEL) == NULL);
+	start = kb_nsecs() - start;
+	kb_check(ok, "xa_store", "store failed");
+	kb_report_ops("xa_store", 1, kb_iterations, start);
+
+	ok = 1;
+	start = kb_nsecs();
+	for (n = 0; n != kb_iterations; n++)
+		ok &= (xa_load(&xa, n) == &items[n]);
+	start = kb_nsecs() - start;
+	kb_check(ok, "xa_load", "wrong pointer");
+	kb_report_ops("xa_load", 1, kb_iterations, start);
+
+	ok = 1;
+	start = kb_nsecs();
+	for (n = 0; n != kb_iterations; n++)
+		ok &= (xa_erase(&xa, n) == &items[n]);
+	start = kb_nsecs() - start;
+	kb_check(ok && xa_empty(&xa), "xa_erase", "erase failed");
+	kb_report_ops("xa_erase", 1, kb_iterations, start);
+
+	xa_destroy(&xa);
+	xa_init_flags(&xa, XA_FLAGS_ALLOC);
+
+	ok = 1;
+	start = kb_nsecs();
+	for (n = 0; n != kb_iterations; n++) {
+		ok &= (xa_alloc(&xa, &id, &items[n], xa_limit_32b,
+		    GFP_KERNEL) == 0 && id == n);
+	}
+	start = kb_nsecs() - start;
+	kb_check(ok, "xa_alloc", "unexpected ID");
+	kb_report_ops("xa_alloc", 1, kb_iterations, start);
+
+	xa_destroy(&xa);
+}
+
+/*
+ * The concurrent lookup scenarios run lockless readers against a
+ * writer which keeps inserting and removing entries in a separate key
+ * range. Each removal frees a leaf node, so the readers also exercise
+ * the deferred node reclamation.
+ */
+#define	KB_CHURN_KEYS 1024
+#define	KB_CHURN_KEY(n) ((unsigned long)kb_iterations + \
+	((n) % KB_CHURN_KEYS) * RADIX_TREE_MAP_SIZE)
+
+static struct xarray kb_xa;
+static struct radix_tree_root kb_root;
+static int kb_churn_stop;
+static int kb_lookup_failed;
+
+static int
+kb_churn_stopped(void)
+{
+	int stop;
+
+	atomic_lock();
+	stop = kb_churn_stop;
+	atomic_unlock();
+	return (stop);
+}
+
+static void
+kb_lookup_done(unsigned count, int ok)
+{
+	atomic_lock();
+	kb_counter += count;
+	if (!ok)
+		kb_lookup_failed = 1;
+	atomic_unlock();
+}
+
+static void
+kb_xa_churn_loop(unsigned count)
+{
+	uint64_t *items = kb_items();
+	unsigned n;
+
+	for (n = 0; !kb_churn_stopped(); n++) {
+		xa_store(&kb_xa, KB_CHURN_KEY(n), &items[0], GFP_KERNEL);
+		xa_erase(&kb_xa, KB_CHURN_KEY(n));
+	}
+}
+
+static void
+kb_xa_lookup_loop(unsigned count)
+{
+	uint64_t *items = kb_items();
+	unsigned idx;
+	unsigned n;
+	int ok = 1;
+
+	for (n = 0; n != count; n++) {
+		idx = (n * 7919U) % kb_iterations;
+		ok &= (xa_load(&kb_xa, idx) == &items[idx]);
+	}
+	kb_lookup_done(count, ok);
+}
+
+static void
+kb_radix_churn_loop(unsigned count)
+{
+	uint64_t *items = kb_items();
+	unsigned n;
+
+	for (n = 0; !kb_churn_stopped(); n++) {
+		atomic_lock();
+		radix_tree_insert(&kb_root, KB_CHURN_KEY(n), &items[0]);
+		radix_tree_delete(&kb_root, KB_CHURN_KEY(n));
+		atomic_unlock();
+	}
+}
+
+static void
+kb_radix_lookup_loop(unsigned count)
+{
+	uint64_t *items = kb_items();
+	unsigned idx;
+	unsigned n;
+	int ok = 1;
+
+	for (n = 0; n != count; n++) {
+		idx = (n * 7919U) % kb_iterations;
+		ok &= (radix_tree_lookup(&kb_root, idx) == &items[idx]);
+	}
+	kb_lookup_done(count, ok);
+}
+
+static void
+kb_concurrent(const char *name, void (*churn) (unsigned),
+    void (*lookup) (unsigned))
+{
+	struct kb_worker writer;
+
+	kb_churn_stop = 0;
+	kb_lookup_failed = 0;
+	kb_start_thread(&writer, churn, 0);
+
+	kb_contention(name, lookup);
+
+	atomic_lock();
+	kb_churn_stop = 1;
+	atomic_unlock();
+	pthread_join(writer.thread, NULL);
+
+	kb_check(!kb_lookup_failed, name, "wrong pointer");
+}
+
+static void
+kb_bench_concurrent(void)
+{
+	uint64_t *items = kb_items();
+	unsigned n;
+
+	xa_init_flags(&kb_xa, 0);
+	for (n = 0; n != kb_iterations; n++)
+		xa_store(&kb_xa, n, &items[n], GFP_KERNEL);
+	kb_concurrent("xa_load_concurrent", &kb_xa_churn_loop,
+	    &kb_xa_lookup_loop);
+	xa_destroy(&kb_xa);
+
+	INIT_RADIX_TREE(&kb_root, GFP_KERNEL);
+	atomic_lock();
+	for (n = 0; n != kb_iterations; n++)
+		radix_tree_insert(&kb_root, n, &items[n]);
+	atomic_unlock();
+	kb_concurrent("radix_lookup_concurrent", &kb_radix_churn_loop,
+	    &kb_radix_lookup_loop);
+	atomic_lock();
+	for (n = 0; n != kb_iterations; n++)
+		radix_tree_delete(&kb_root, n);
+	atomic_unlock();
+	kb_check(kb_root.rnode == NULL, "radix_lookup_concurrent",
+	    "tree not empty");
+}
+
+/*
+ * Allocate 100000 IDs, free every other one and allocate the holes
+ * again. Each allocation has to find the lowest free ID, which is
+ * where the free slot bitmaps of the radix tree help.
+ */
+#define	KB_IDS 100000
+
+static void
+kb_bench_ids(void)
+{
+	static uint64_t item;
+	struct radix_tree_root root;
+	struct xarray xa;
+	unsigned long index;
+	uint64_t start;
+	uint32_t next;
+	uint32_t id;
+	unsigned n;
+	int ok;
+
+	xa_init_flags(&xa, XA_FLAGS_ALLOC);
+
+	ok = 1;
+	start = kb_nsecs();
+	for (n = 0; n != KB_IDS; n++) {
+		ok &= (xa_alloc(&xa, &id, &item, xa_limit_32b,
+		    GFP_KERNEL) == 0 && id == n);
+	}
+	start = kb_nsecs() - start;
+	kb_check(ok, "xa_alloc_100k", "unexpected ID");
+	kb_report_ops("xa_alloc_100k", 1, KB_IDS, start);
+
+	for (n = 0; n < KB_IDS; n += 2)
+		xa_erase(&xa, n);
+
+	ok = 1;
+	start = kb_nsecs();
+	for (n = 0; n < KB_IDS; n += 2) {
+		ok &= (xa_alloc(&xa, &id, &item, xa_limit_32b,
+		    GFP_KERNEL) == 0 && id == n);
+	}
+	start = kb_nsecs() - start;
+	kb_check(ok, "xa_alloc_holes_100k", "unexpected ID");
+	kb_report_ops("xa_alloc_holes_100k", 1, KB_IDS / 2, start);
+
+	xa_destroy(&xa);
+	xa_init_flags(&xa, XA_FLAGS_ALLOC);
+
+	/* the cyclic allocator skips the IDs freed behind it */
+	ok = 1;
+	next = 0;
+	start = kb_nsecs();
+	for (n = 0; n != KB_IDS; n++) {
+		ok &= (xa_alloc_cyclic(&xa, &id, &item, xa_limit_32b,
+		    &next, GFP_KERNEL) >= 0 && id == n);
+		if (n != 0)
+			xa_erase(&xa, n - 1);
+	}
+	start = kb_nsecs() - start;
+	kb_check(ok, "xa_alloc_cyclic_100k", "unexpected ID");
+	kb_report_ops("xa_alloc_cyclic_100k", 1, KB_IDS, start);
+
+	xa_destroy(&xa);
+
+	INIT_RADIX_TREE(&root, GFP_KERNEL);
+	for (n = 0; n != KB_IDS; n++) {
+		if (n % 2)
+			radix_tree_insert(&root, n, &item);
+	}
+
+	ok = 1;
+	start = kb_nsecs();
+	for (n = 0; n < KB_IDS; n += 2) {
+		index = 0;
+		ok &= (radix_tree_find_free(&root, &index, ULONG_MAX) == 0 &&
+		    index == n);
+		ok &= (radix_tree_insert(&root, index, &item) == 0);
+	}
+	start = kb_nsecs() - start;
+	kb_check(ok, "radix_find_free_100k", "unexpected index");
+	kb_report_ops("radix_find_free_100k", 1, KB_IDS / 2, start);
+
+	for (n = 0; n != KB_IDS; n++)
+		radix_tree_delete(&root, n);
+	kb_check(root.rnode == NULL, "radix_find_free_100k", "tree not empty");
+}
+
+#define	KB_BITS 65536
+
+static void
+kb_bench_bitops(void)
+{
+	static unsigned long map[BITS_TO_LONGS(KB_BITS)];
+	uint64_t start;
+	unsigned long bit;
+	unsigned n;
+	unsigned x;
+
+	start = kb_nsecs();
+	for (n = 0; n != kb_iterations; n++)
+		set_bit(n % KB_BITS, map);
+	start = kb_nsecs() - start;
+	kb_report_ops("set_bit", 1, kb_iterations, start);
+
+	x = 0;
+	start = kb_nsecs();
+	for (n = 0; n != kb_iterations; n++)
+		x += test_bit(n % KB_BITS, map);
+	start = kb_nsecs() - start;
+	kb_check(x == kb_iterations, "test_bit", "wrong bit value");
+	kb_report_ops("test_bit", 1, kb_iterations, start);
+
+	start = kb_nsecs();
+	for (n = 0; n != kb_iterations; n++)
+		clear_bit(n % KB_BITS, map);
+	start = kb_nsecs() - start;
+	kb_check(bitmap_empty(map, KB_BITS), "clear_bit", "bitmap not empty");
+	kb_report_ops("clear_bit", 1, kb_iterations, start);
+
+	/* sparse bitmap, one bit set in every 64 */
+	for (bit = 0; bit < KB_BITS; bit += 64)
+		set_bit(bit + (bit / 64) % 64, map);
+
+	x = 0;
+	start = kb_nsecs();
+	for (n = 0; n < kb_iterations; n += KB_BITS / 64) {
+		for (bit = find_next_bit(map, KB_BITS, 0); bit < KB_BITS;
+		    bit = find_next_bit(map, KB_BITS, bit + 1))
+			x++;
+	}
+	start = kb_nsecs() - start;
+	kb_check(x == n, "find_next_bit", "wrong number of bits");
+	kb_report_ops("find_next_bit", 1, n, start);
+
+	bitmap_zero(map, KB_BITS);
+}
+
+static uint32_t kb_random_state = 1;
+static volatile uint32_t kb_sink;	/* keeps results alive */
+
+static uint32_t
+kb_random(void)
+{
+	uint32_t x = kb_random_state;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	kb_random_state = x;
+	return (x);
+}
+
+/*
+ * Property test of the bitmap helpers against a bit by bit reference.
+ * Each case uses a random bitmap size, with the word boundary sizes
+ * tried first, and random contents. The bits above the bitmap size
+ * in the last word are random too, and must be ignored. A guard word
+ * after each bitmap catches writes past its end.
+ */
+#define	KB_BITMAP_MAX 520
+#define	KB_BITMAP_WORDS (BITS_TO_LONGS(KB_BITMAP_MAX) + 1)
+#define	KB_BITMAP_GUARD 0x5A5A5A5AUL
+
+static const unsigned kb_bitmap_sizes[] = {
+	1, 2, 31, 32, 33, 63, 64, 65, 95, 96, 97, 127, 128, 129,
+	191, 192, 193, 255, 256, 257, 511, 512, 513,
+};
+
+static int
+kb_bit(const unsigned long *map, unsigned bit)
+{
+	return ((map[bit / BITS_PER_LONG] >> (bit % BITS_PER_LONG)) & 1);
+}
+
+static void
+kb_bit_set(unsigned long *map, unsigned bit, int value)
+{
+	if (value)
+		map[bit / BITS_PER_LONG] |= 1UL << (bit % BITS_PER_LONG);
+	else
+		map[bit / BITS_PER_LONG] &= ~(1UL << (bit % BITS_PER_LONG));
+}
+
+static void
+kb_bitmap_random(unsigned long *map)
+{
+	unsigned density = kb_random() % 4;
+	unsigned n;
+	unsigned x;
+
+	for (n = 0; n != KB_BITMAP_WORDS - 1; n++) {
+		map[n] = 0;
+		for (x = 0; x != BITS_PER_LONG; x++) {
+			/* empty, sparse, dense or full */
+			if (density != 0 && (density == 3 ||
+			    (kb_random() % 8) < (density == 1 ? 1 : 7)))
+				map[n] |= 1UL << x;
+		}
+	}
+	map[n] = KB_BITMAP_GUARD;
+}
+
+static int
+kb_bitmap_same(const unsigned long *pa, const unsigned long *pb,
+    unsigned nbits)
+{
+	unsigned n;
+
+	for (n = 0; n != nbits; n++) {
+		if (kb_bit(pa, n) != kb_bit(pb, n))
+			return (0);
+	}
+	return (1);
+}
+
+static int
+kb_bitmap_case(unsigned nbits)
+{
+	const unsigned words = BITS_TO_LONGS(nbits);
+	unsigned long a[KB_BITMAP_WORDS];
+	unsigned long b[KB_BITMAP_WORDS];
+	unsigned long d[KB_BITMAP_WORDS];
+	unsigned long r[KB_BITMAP_WORDS];
+	unsigned long ref;
+	unsigned shift;
+	unsigned start;
+	unsigned nr;
+	unsigned n;
+	int any;
+	int full;
+	int sub;
+	int ok = 1;
+
+	kb_bitmap_random(a);
+	kb_bitmap_random(b);
+
+	for (n = 0; n <= nbits + 1; n++) {
+		for (ref = n; ref < nbits && !kb_bit(a, ref); ref++)
+			;
+		ok &= (find_next_bit(a, nbits, n) == (n < nbits ? ref : nbits));
+		for (ref = n; ref < nbits && kb_bit(a, ref); ref++)
+			;
+		ok &= (find_next_zero_bit(a, nbits, n) ==
+		    (n < nbits ? ref : nbits));
+	}
+
+	for (ref = n = 0; n != nbits; n++)
+		ref += kb_bit(a, n);
+	ok &= (bitmap_weight(a, nbits) == (int)ref);
+	ok &= (bitmap_empty(a, nbits) == (ref == 0));
+
+	for (any = 0, full = sub = 1, n = 0; n != nbits; n++) {
+		any |= kb_bit(a, n) & kb_bit(b, n);
+		full &= kb_bit(a, n);
+		sub &= (!kb_bit(a, n)) | kb_bit(b, n);
+	}
+	ok &= (bitmap_intersects(a, b, nbits) == any);
+	ok &= (bitmap_full(a, nbits) == full);
+	ok &= (bitmap_subset(a, b, nbits) == sub);
+	ok &= (bitmap_equal(a, a, nbits) == 1);
+	memcpy(d, a, sizeof(d));
+	d[words - 1] ^= ~BITMAP_LAST_WORD_MASK(nbits);
+	ok &= (bitmap_equal(a, d, nbits) == 1);
+	kb_bit_set(d, nbits - 1, !kb_bit(a, nbits - 1));
+	ok &= (bitmap_equal(a, d, nbits) == 0);
+
+	memcpy(d, a, sizeof(d));
+	any = bitmap_and(d, a, b, nbits);
+	for (ref = 1, n = 0; n != nbits; n++)
+		ref &= (kb_bit(d, n) == (kb_bit(a, n) & kb_bit(b, n)));
+	ok &= ref && (any == bitmap_intersects(a, b, nbits));
+
+	any = bitmap_andnot(d, a, b, nbits);
+	for (full = 0, ref = 1, n = 0; n != nbits; n++) {
+		ref &= (kb_bit(d, n) == (kb_bit(a, n) & !kb_bit(b, n)));
+		full |= kb_bit(a, n) & !kb_bit(b, n);
+	}
+	ok &= ref && (any == full);
+
+	bitmap_or(d, a, b, nbits);
+	for (ref = 1, n = 0; n != nbits; n++)
+		ref &= (kb_bit(d, n) == (kb_bit(a, n) | kb_bit(b, n)));
+	ok &= ref;
+
+	bitmap_xor(d, a, b, nbits);
+	for (ref = 1, n = 0; n != nbits; n++)
+		ref &= (kb_bit(d, n) == (kb_bit(a, n) ^ kb_bit(b, n)));
+	ok &= ref;
+
+	/* also clear ranges starting at a word boundary */
+	start = kb_random() % nbits;
+	if (kb_random() % 2)
+		start &= ~(BITS_PER_LONG - 1);
+	nr = kb_random() % (nbits - start + 1);
+	memcpy(d, a, sizeof(d));
+	memcpy(r, a, sizeof(r));
+	bitmap_clear(d, start, nr);
+	for (n = start; n != start + nr; n++)
+		kb_bit_set(r, n, 0);
+	ok &= kb_bitmap_same(d, r, nbits);
+
+	/* also shift by the whole size and more */
+	shift = kb_random() % (nbits + BITS_PER_LONG + 1);
+	memset(d, 0, sizeof(d));
+	d[words] = KB_BITMAP_GUARD;
+	bitmap_shift_right(d, a, shift, nbits);
+	ok &= (d[words] == KB_BITMAP_GUARD);
+	for (ref = 1, n = 0; n != nbits; n++)
+		ref &= (kb_bit(d, n) == (n + shift < nbits ? kb_bit(a, n + shift) : 0));
+	ok &= ref;
+
+	memset(d, 0, sizeof(d));
+	d[words] = KB_BITMAP_GUARD;
+	bitmap_shift_left(d, a, shift, nbits);
+	ok &= (d[words] == KB_BITMAP_GUARD);
+	for (ref = 1, n = 0; n != nbits; n++)
+		ref &= (kb_bit(d, n) == (n >= shift ? kb_bit(a, n - shift) : 0));
+	ok &= ref;
+
+	/* in place, like the drivers do */
+	memcpy(d, a, sizeof(d));
+	bitmap_shift_right(d, d, shift, nbits);
+	for (ref = 1, n = 0; n != nbits; n++)
+		ref &= (kb_bit(d, n) == (n + shift < nbits ? kb_bit(a, n + shift) : 0));
+	ok &= ref;
+
+	ok &= (a[KB_BITMAP_WORDS - 1] == KB_BITMAP_GUARD);
+	return (ok);
+}
+
+static int
+kb_bitops_case(void)
+{
+	uint32_t w = kb_random();
+	uint64_t q = ((uint64_t)kb_random() << 32) | kb_random();
+	uint8_t buf[19];
+	unsigned ref;
+	unsigned n;
+	int ok = 1;
+
+	if (kb_random() % 4 == 0)
+		w >>= kb_random() % 32;
+
+	for (ref = n = 0; n != 32; n++)
+		ref += (w >> n) & 1;
+	ok &= (hweight32(w) == ref);
+	ok &= (hweight16(w) == (unsigned)__builtin_popcount(w & 0xFFFF));
+	ok &= (hweight8(w) == (unsigned)__builtin_popcount(w & 0xFF));
+	for (ref = n = 0; n != 64; n++)
+		ref += (q >> n) & 1;
+	ok &= (hweight64(q) == ref);
+
+	for (n = 0; n != 32 && !((w >> n) & 1); n++)
+		;
+	ok &= (__ffs(w) == (n == 32 ? 0 : (int)n));
+	for (n = 0; n != 32 && ((w >> n) & 1); n++)
+		;
+	ok &= (__ffz(w) == (n == 32 ? 0 : (int)n));
+	for (n = 32; n != 0 && !((w >> (n - 1)) & 1); n--)
+		;
+	ok &= (fls(w) == (int)n);
+
+	for (ref = n = 0; n != sizeof(buf); n++) {
+		buf[n] = kb_random();
+		ref += __builtin_popcount(buf[n]);
+	}
+	ok &= (memweight(buf, sizeof(buf)) == ref);
+	return (ok);
+}
+
+static void
+kb_bench_bitmap(void)
+{
+	const unsigned cases = kb_iterations / 20;
+	uint64_t start;
+	unsigned nbits;
+	unsigned n;
+	int ok;
+
+	ok = 1;
+	start = kb_nsecs();
+	for (n = 0; n != cases; n++) {
+		if (n < ARRAY_SIZE(kb_bitmap_sizes))
+			nbits = kb_bitmap_sizes[n];
+		else
+			nbits = 1 + kb_random() % (KB_BITMAP_MAX - 1);
+		ok &= kb_bitmap_case(nbits);
+		ok &= kb_bitops_case();
+	}
+	start = kb_nsecs() - start;
+	kb_check(ok, "bitmap_check", "mismatch against bitwise reference");
+	kb_report_ops("bitmap_check", 1, cases, start);
+}
+
+/*
+ * Check crc32_le() and crc32_be() against a bitwise reference for
+ * random lengths, alignments and seeds, and measure their throughput.
+ * Both the slicing-by-8 path and the hardware accelerated path, if
+ * the CPU has one, are covered. The throughput is reported per byte.
+ */
+#define	KB_CRC_BYTES 65536
+
+static uint32_t
+kb_crc32_le_ref(uint32_t crc, const uint8_t *p, size_t len)
+{
+	unsigned i;
+
+	while (len--) {
+		crc ^= *p++;
+		for (i = 0; i != 8; i++)
+			crc = (crc >> 1) ^ ((crc & 1) ? CRCPOLY_LE : 0);
+	}
+	return (crc);
+}
+
+static uint32_t
+kb_crc32_be_ref(uint32_t crc, const uint8_t *p, size_t len)
+{
+	unsigned i;
+
+	while (len--) {
+		crc ^= (uint32_t)*p++ << 24;
+		for (i = 0; i != 8; i++)
+			crc = (crc << 1) ^ ((crc & 0x80000000U) ? CRCPOLY_BE : 0);
+	}
+	return (crc);
+}
+
+static void
+kb_crc32_check(const char *name, const uint8_t *buf,
+    uint32_t (*func) (uint32_t, const uint8_t *, size_t),
+    uint32_t (*ref) (uint32_t, const uint8_t *, size_t))
+{
+	const unsigned cases = kb_iterations / 50;
+	char check[64];
+	uint64_t start;
+	uint32_t seed;
+	size_t off;
+	size_t len;
+	unsigned n;
+	int ok;
+
+	snprintf(check, sizeof(check), "%s_check", name);
+
+	ok = 1;
+	start = kb_nsecs();
+	for (n = 0; n != cases; n++) {
+		off = kb_random() % 16;
+		/* mostly short buffers, some longer than the folding block */
+		len = (n % 8) ? (kb_random() % 256) : (kb_random() % 4096);
+		seed = (n % 3) ? kb_random() : ~0U;
+		ok &= (func(seed, buf + off, len) == ref(seed, buf + off, len));
+	}
+	start = kb_nsecs() - start;
+	kb_check(ok, check, "mismatch against bitwise reference");
+	kb_report_ops(check, 1, cases, start);
+}
+
+static void
+kb_crc32_speed(const char *name, const uint8_t *buf, unsigned rounds,
+    uint32_t (*func) (uint32_t, const uint8_t *, size_t))
+{
+	uint64_t start;
+	uint32_t crc;
+	unsigned n;
+
+	crc = ~0U;
+	start = kb_nsecs();
+	for (n = 0; n != rounds; n++)
+		crc = func(crc, buf, KB_CRC_BYTES);
+	start = kb_nsecs() - start;
+
+	kb_sink ^= crc;
+	kb_report_ops(name, 1, (uint64_t)rounds * KB_CRC_BYTES, start);
+}
+
+static uint32_t
+kb_crc32_le(uint32_t crc, const uint8_t *p, size_t len)
+{
+	return (crc32_le(crc, p, len));
+}
+
+static uint32_t
+kb_crc32_be(uint32_t crc, const uint8_t *p, size_t len)
+{
+	return (crc32_be(crc, p, len));
+}
+
+static void
+kb_bench_crc32(void)
+{
+	const unsigned rounds = (kb_iterations / 1000) ? (kb_iterations / 1000) : 1;
+	uint8_t *buf;
+	unsigned n;
+
+	buf = malloc(KB_CRC_BYTES + 16);
+	if (buf == NULL)
+		kb_fatal("Cannot allocate CRC buffer");
+	for (n = 0; n != KB_CRC_BYTES + 16; n++)
+		buf[n] = kb_random();
+
+	if (crc32_le_hw_select(1)) {
+		kb_crc32_check("crc32_le_hw", buf, &kb_crc32_le, &kb_crc32_le_ref);
+		kb_crc32_speed("crc32_le_hw", buf, rounds, &kb_crc32_le);
+	}
+	crc32_le_hw_select(0);
+	kb_crc32_check("crc32_le_table", buf, &kb_crc32_le, &kb_crc32_le_ref);
+	kb_crc32_speed("crc32_le_table", buf, rounds, &kb_crc32_le);
+	crc32_le_hw_select(1);
+
+	kb_crc32_check("crc32_be_table", buf, &kb_crc32_be, &kb_crc32_be_ref);
+	kb_crc32_speed("crc32_be_table", buf, rounds, &kb_crc32_be);
+
+	kb_crc32_speed("crc32_le_bitwise", buf, (rounds + 9) / 10,
+	    &kb_crc32_le_ref);
+
+	free(buf);
+}
+
+/*
+ * Compare sort() against qsort() on the same input. The 4 and 8 byte
+ * elements take the inlined swap paths, the 12 byte elements the
+ * generic path, with and without a swap callback. The payload of a
+ * record is derived from its key, so that the unstable orders of both
+ * sorts still compare equal.
+ */
+#define	KB_SORT_GUARD 0xA5
+
+enum {
+	KB_SORT_RANDOM,
+	KB_SORT_SORTED,
+	KB_SORT_REVERSED,
+	KB_SORT_ORGAN,
+	KB_SORT_FEW,
+	KB_SORT_MAX,
+};
+
+static const char *const kb_sort_pattern[KB_SORT_MAX] = {
+	"random", "sorted", "reversed", "organ", "few",
+};
+
+typedef int (kb_sort_cmp_t)(const void *, const void *);
+typedef void (kb_sort_swap_t)(void *, void *, int);
+
+struct kb_sort_rec {
+	uint32_t key;
+	uint32_t hash;
+	uint32_t inv;
+};
+
+static int
+kb_sort_cmp_u32(const void *pa, const void *pb)
+{
+	const uint32_t a = *(const uint32_t *)pa;
+	const uint32_t b = *(const uint32_t *)pb;
+
+	return ((a > b) - (a < b));
+}
+
+static int
+kb_sort_cmp_u64(const void *pa, const void *pb)
+{
+	const uint64_t a = *(const uint64_t *)pa;
+	const uint64_t b = *(const uint64_t *)pb;
+
+	return ((a > b) - (a < b));
+}
+
+static int
+kb_sort_cmp_rec(const void *pa, const void *pb)
+{
+	return (kb_sort_cmp_u32(&((const struct kb_sort_rec *)pa)->key,
+	    &((const struct kb_sort_rec *)pb)->key));
+}
+
+static void
+kb_sort_swap_rec(void *pa, void *pb, int size)
+{
+	struct kb_sort_rec t;
+
+	memcpy(&t, pa, sizeof(t));
+	memcpy(pa, pb, sizeof(t));
+	memcpy(pb, &t, sizeof(t));
+}
+
+static uint32_t
+kb_sort_key(unsigned pattern, size_t n, size_t num)
+{
+	switch (pattern) {
+	case KB_SORT_SORTED:
+		return (n);
+	case KB_SORT_REVERSED:
+		return (num - n);
+	case KB_SORT_ORGAN:
+		return (n < num / 2 ? n : num - n);
+	case KB_SORT_FEW:
+		return (kb_random() % 4);
+	default:
+		return (kb_random());
+	}
+}
+
+static void
+kb_sort_fill(void *base, size_t num, size_t size, unsigned pattern)
+{
+	struct kb_sort_rec *rec = base;
+	uint64_t *q = base;
+	uint32_t *w = base;
+	uint32_t key;
+	size_t n;
+
+	for (n = 0; n != num; n++) {
+		key = kb_sort_key(pattern, n, num);
+		switch (size) {
+		case 4:
+			w[n] = key;
+			break;
+		case 8:
+			q[n] = ((uint64_t)key << 32) | (key * 0x9E3779B9U);
+			break;
+		default:
+			rec[n].key = key;
+			rec[n].hash = key * 0x9E3779B9U;
+			rec[n].inv = ~key;
+			break;
+		}
+	}
+	memset((char *)base + num * size, KB_SORT_GUARD, size);
+}
+
+static kb_sort_cmp_t *
+kb_sort_cmp(size_t size)
+{
+	switch (size) {
+	case 4:
+		return (&kb_sort_cmp_u32);
+	case 8:
+		return (&kb_sort_cmp_u64);
+	default:
+		return (&kb_sort_cmp_rec);
+	}
+}
+
+/*
+ * Sort a copy of "src" with both sorts and check the results are
+ * equal and that nothing was written past the end.
+ */
+static int
+kb_sort_same(const void *src, void *pa, void *pb, size_t num, size_t size,
+    kb_sort_swap_t *swap_fn)
+{
+	const uint8_t *guard;
+	size_t n;
+
+	memcpy(pa, src, (num + 1) * size);
+	memcpy(pb, src, (num + 1) * size);
+	sort(pa, num, size, kb_sort_cmp(size), swap_fn);
+	qsort(pb, num, size, kb_sort_cmp(size));
+
+	guard = (const uint8_t *)pa + num * size;
+	for (n = 0; n != size; n++) {
+		if (guard[n] != KB_SORT_GUARD)
+			return (0);
+	}
+	return (memcmp(pa, pb, (num + 1) * size) == 0);
+}
+
+static void
+kb_sort_check(void *src, void *pa, void *pb, size_t max)
+{
+	static const size_t sizes[] = {4, 8, sizeof(struct kb_sort_rec)};
+	const unsigned cases = kb_iterations / 100;
+	uint64_t start;
+	unsigned pattern;
+	unsigned n;
+	size_t num;
+	size_t x;
+	int ok;
+
+	ok = 1;
+	start = kb_nsecs();
+	for (n = 0; n != cases; n++) {
+		pattern = n % KB_SORT_MAX;
+		/* all the small sizes around the insertion sort limit first */
+		if (n < 64 * KB_SORT_MAX)
+			num = n / KB_SORT_MAX;
+		else
+			num = kb_random() % (max < 4096 ? max : 4096);
+
+		for (x = 0; x != ARRAY_SIZE(sizes); x++) {
+			kb_sort_fill(src, num, sizes[x], pattern);
+			ok &= kb_sort_same(src, pa, pb, num, sizes[x], NULL);
+		}
+		ok &= kb_sort_same(src, pa, pb, num, sizes[x - 1],
+		    &kb_sort_swap_rec);
+	}
+	start = kb_nsecs() - start;
+	kb_check(ok, "sort_check", "mismatch against qsort");
+	kb_report_ops("sort_check", 1, cases, start);
+}
+
+static void
+kb_sort_speed(const char *type, void *src, void *pa, void *pb, size_t num,
+    size_t size, unsigned pattern, kb_sort_swap_t *swap_fn)
+{
+	char name[64];
+	uint64_t start;
+
+	kb_sort_fill(src, num, size, pattern);
+
+	memcpy(pa, src, (num + 1) * size);
+	start = kb_nsecs();
+	sort(pa, num, size, kb_sort_cmp(size), swap_fn);
+	start = kb_nsecs() - start;
+	snprintf(name, sizeof(name), "sort_%s_%s", type, kb_sort_pattern[pattern]);
+	kb_report_ops(name, 1, num, start);
+
+	memcpy(pb, src, (num + 1) * size);
+	start = kb_nsecs();
+	qsort(pb, num, size, kb_sort_cmp(size));
+	start = kb_nsecs() - start;
+	snprintf(name, sizeof(name), "qsort_%s_%s", type, kb_sort_pattern[pattern]);
+	kb_report_ops(name, 1, num, start);
+
+	kb_check(memcmp(pa, pb, (num + 1) * size) == 0, name,
+	    "sort and qsort results differ");
+}
+
+static void
+kb_bench_sort(void)
+{
+	const size_t num = kb_iterations;
+	const size_t bytes = (num + 1) * sizeof(struct kb_sort_rec);
+	unsigned pattern;
+	void *src;
+	void *pa;
+	void *pb;
+
+	src = malloc(bytes);
+	pa = malloc(bytes);
+	pb = malloc(bytes);
+	if (src == NULL || pa == NULL || pb == NULL)
+		kb_fatal("Cannot allocate sort buffers");
+
+	kb_sort_check(src, pa, pb, num);
+
+	for (pattern = 0; pattern != KB_SORT_MAX; pattern++)
+		kb_sort_speed("u32", src, pa, pb, num, 4, pattern, NULL);
+	kb_sort_speed("u64", src, pa, pb, num, 8, KB_SORT_RANDOM, NULL);
+	kb_sort_speed("rec", src, pa, pb, num, sizeof(struct kb_sort_rec),
+	    KB_SORT_RANDOM, NULL);
+	kb_sort_speed("rec_swap", src, pa, pb, num, sizeof(struct kb_sort_rec),
+	    KB_SORT_RANDOM, &kb_sort_swap_rec);
+
+	free(src);
+	free(pa);
+	free(pb);
+}
+
+/*
+ * Time request_firmware() of the same image stored uncompressed and
+ * in each compressed format enabled at build time. The image mixes
+ * random and repeated blocks, so that it compresses about as well
+ * as typical firmware. flush_firmware_requests() is called after
+ * every release, so that each load maps and decodes the file again.
+ * The cached variants release without flushing, and hit the cache.
+ */
+#define	KB_FW_BYTES (1024 * 1024)
+#define	KB_FW_BLOCK 64
+
+static char kb_fw_dir[64];
+
+static void
+kb_fw_image(uint8_t *buf)
+{
+	size_t n;
+	size_t from;
+	unsigned x;
+
+	for (n = 0; n != KB_FW_BYTES; n += KB_FW_BLOCK) {
+		if (n != 0 && kb_random() % 3 != 0) {
+			from = (kb_random() % (n / KB_FW_BLOCK)) * KB_FW_BLOCK;
+			memcpy(buf + n, buf + from, KB_FW_BLOCK);
+		} else {
+			for (x = 0; x != KB_FW_BLOCK; x++)
+				buf[n + x] = kb_random();
+		}
+	}
+}
+
+static void
+kb_fw_write(const char *name, const void *data, size_t len)
+{
+	char path[256];
+	int f;
+
+	snprintf(path, sizeof(path), "%s/%s", kb_fw_dir, name);
+	f = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (f < 0 || write(f, data, len) != (ssize_t)len)
+		kb_fatal("Cannot write firmware file");
+	close(f);
+}
+
+static void
+kb_fw_remove(const char *name)
+{
+	char path[256];
+
+	snprintf(path, sizeof(path), "%s/%s", kb_fw_dir, name);
+	unlink(path);
+}
+
+/*
+ * The firmware loader reports every load on standard output, which
+ * carries the results. Send it elsewhere while loading.
+ */
+static int
+kb_quiet(int fd)
+{
+	int null;
+
+	fflush(stdout);
+	if (fd < 0) {
+		fd = dup(STDOUT_FILENO);
+		null = open("/dev/null", O_WRONLY);
+		if (fd < 0 || null < 0)
+			kb_fatal("Cannot redirect standard output");
+		dup2(null, STDOUT_FILENO);
+		close(null);
+	} else {
+		dup2(fd, STDOUT_FILENO);
+		close(fd);
+		fd = -1;
+	}
+	return (fd);
+}
+
+static void
+kb_fw_load(const char *name, const char *file, const uint8_t *image)
+{
+	const unsigned rounds = (kb_iterations / 5000) ? (kb_iterations / 5000) : 1;
+	const struct firmware *fw;
+	char bench[64];
+	uint64_t start;
+	unsigned n;
+	int ok;
+	int fd;
+
+	ok = 1;
+	fd = kb_quiet(-1);
+	start = kb_nsecs();
+	for (n = 0; n != rounds; n++) {
+		if (request_firmware(&fw, file, NULL) != 0) {
+			ok = 0;
+			break;
+		}
+		if (n == 0) {
+			ok &= (fw->size == KB_FW_BYTES &&
+			    memcmp(fw->data, image, KB_FW_BYTES) == 0);
+		}
+		release_firmware(fw);
+		flush_firmware_requests();
+	}
+	start = kb_nsecs() - start;
+	kb_quiet(fd);
+
+	snprintf(bench, sizeof(bench), "firmware_%s", name);
+	kb_check(ok, bench, "firmware image differs from the original");
+	kb_report_ops(bench, 1, n, start);
+
+	/* released images stay cached until the requests are flushed */
+	fd = kb_quiet(-1);
+	if (request_firmware(&fw, file, NULL) == 0)
+		release_firmware(fw);
+	start = kb_nsecs();
+	for (n = 0; n != kb_iterations; n++) {
+		if (request_firmware(&fw, file, NULL) != 0) {
+			ok = 0;
+			break;
+		}
+		release_firmware(fw);
+	}
+	start = kb_nsecs() - start;
+	flush_firmware_requests();
+	kb_quiet(fd);
+
+	snprintf(bench, sizeof(bench), "firmware_%s_cached", name);
+	kb_check(ok, bench, "cached firmware load failed");
+	kb_report_ops(bench, 1, n, start);
+}
+
+static void
+kb_bench_firmware(void)
+{
+	uint8_t *image;
+	uint8_t *buf;
+
+	strlcpy(kb_fw_dir, "/tmp/kernel_bench.XXXXXX", sizeof(kb_fw_dir));
+	if (mkdtemp(kb_fw_dir) == NULL)
+		kb_fatal("Cannot create firmware directory");
+	strlcpy(global_fw_prefix, kb_fw_dir, sizeof(global_fw_prefix));
+
+	image = malloc(KB_FW_BYTES);
+	buf = malloc(2 * KB_FW_BYTES);
+	if (image == NULL || buf == NULL)
+		kb_fatal("Cannot allocate firmware image");
+	kb_fw_image(image);
+
+	kb_fw_write("kb_raw.bin", image, KB_FW_BYTES);
+	kb_fw_load("raw", "kb_raw.bin", image);
+	kb_fw_remove("kb_raw.bin");
+
+#ifdef HAVE_FIRMWARE_GZ
+	{
+		char path[256];
+		gzFile gz;
+
+		snprintf(path, sizeof(path), "%s/kb_gz.bin.gz", kb_fw_dir);
+		gz = gzopen(path, "wb9");
+		if (gz == NULL || gzwrite(gz, image, KB_FW_BYTES) != KB_FW_BYTES ||
+		    gzclose(gz) != Z_OK)
+			kb_fatal("Cannot write gzip firmware file");
+		kb_fw_load("gz", "kb_gz.bin", image);
+		kb_fw_remove("kb_gz.bin.gz");
+	}
+#endif
+#ifdef HAVE_FIRMWARE_XZ
+	{
+		size_t len = 0;
+
+		if (lzma_easy_buffer_encode(6, LZMA_CHECK_CRC64, NULL, image,
+		    KB_FW_BYTES, buf, &len, 2 * KB_FW_BYTES) != LZMA_OK)
+			kb_fatal("Cannot compress xz firmware image");
+		kb_fw_write("kb_xz.bin.xz", buf, len);
+		kb_fw_load("xz", "kb_xz.bin", image);
+		kb_fw_remove("kb_xz.bin.xz");
+	}
+#endif
+#ifdef HAVE_FIRMWARE_ZSTD
+	{
+		size_t len;
+
+		len = ZSTD_compress(buf, 2 * KB_FW_BYTES, image, KB_FW_BYTES, 19);
+		if (ZSTD_isError(len))
+			kb_fatal("Cannot compress zstd firmware image");
+		kb_fw_write("kb_zst.bin.zst", buf, len);
+		kb_fw_load("zst", "kb_zst.bin", image);
+		kb_fw_remove("kb_zst.bin.zst");
+	}
+#endif
+	rmdir(kb_fw_dir);
+	free(image);
+	free(buf);
+}
+
+/*
+ * Fake I2C slave with 256 byte wide registers and an auto-incrementing
+ * register pointer, behind an adapter that also implements the byte
+ * data SMBus commands natively. Every bus transfer costs about one
+ * microsecond, to stand in for the start and stop conditions.
+ */
+#define	KB_I2C_ADDR 0x50
+#define	KB_I2C_REGS 256
+#define	KB_I2C_STATUS 0xf0		/* first uncached register */
+#define	KB_I2C_RUN 16			/* bytes per coalesced write */
+
+static u8 kb_i2c_reg[KB_I2C_REGS];
+static u8 kb_i2c_ptr;
+static unsigned long kb_i2c_xfers;
+
+static void
+kb_i2c_delay(void)
+{
+	const uint64_t end = kb_nsecs() + 1000;
+
+	while (kb_nsecs() < end)
+		;
+	kb_i2c_xfers++;
+}
+
+static int
+kb_i2c_master_xfer(struct i2c_adapter *adap, struct i2c_msg *msgs, int num)
+{
+	int x;
+	u16 n;
+
+	kb_i2c_delay();
+	for (x = 0; x != num; x++) {
+		if (msgs[x].addr != KB_I2C_ADDR)
+			return (-ENXIO);
+		if (msgs[x].flags & I2C_M_RD) {
+			for (n = 0; n != msgs[x].len; n++)
+				msgs[x].buf[n] = kb_i2c_reg[kb_i2c_ptr++];
+		} else if (msgs[x].len != 0) {
+			kb_i2c_ptr = msgs[x].buf[0];
+			for (n = 1; n != msgs[x].len; n++)
+				kb_i2c_reg[kb_i2c_ptr++] = msgs[x].buf[n];
+		}
+	}
+	return (num);
+}
+
+static int
+kb_i2c_smbus_xfer(struct i2c_adapter *adap, u16 addr, unsigned short flags,
+    char read_write, u8 command, int size, union i2c_smbus_data *data)
+{
+	if (size != I2C_SMBUS_BYTE_DATA)
+		return (-EOPNOTSUPP);
+	if (addr != KB_I2C_ADDR)
+		return (-ENXIO);
+
+	kb_i2c_delay();
+	if (read_write == I2C_SMBUS_WRITE)
+		kb_i2c_reg[command] = data->byte;
+	else
+		data->byte = kb_i2c_reg[command];
+	return (0);
+}
+
+static const struct i2c_algorithm kb_i2c_algo = {
+	.master_xfer = &kb_i2c_master_xfer,
+	.smbus_xfer = &kb_i2c_smbus_xfer,
+};
+
+static int
+kb_i2c_write(struct i2c_adapter *adap, u8 reg, u8 value)
+{
+	u8 buf[2] = {reg, value};
+	struct i2c_msg msg = {
+		.addr = KB_I2C_ADDR,
+		.flags = 0,
+		.len = 2,
+		.buf = buf,
+	};
+
+	return (i2c_transfer(adap, &msg, 1) == 1 ? 0 : -EIO);
+}
+
+static int
+kb_i2c_read(struct i2c_adapter *adap, u8 reg)
+{
+	u8 value = 0;
+	struct i2c_msg msg[2] = {
+		{.addr = KB_I2C_ADDR, .flags = 0, .len = 1, .buf = &reg},
+		{.addr = KB_I2C_ADDR, .flags = I2C_M_RD, .len = 1, .buf = &value},
+	};
+
+	return (i2c_transfer(adap, msg, 2) == 2 ? value : -EIO);
+}
+
+static int
+kb_i2c_smbus_write(struct i2c_adapter *adap, u8 reg, u8 value)
+{
+	union i2c_smbus_data data;
+
+	data.byte = value;
+	return (i2c_smbus_xfer(adap, KB_I2C_ADDR, 0, I2C_SMBUS_WRITE, reg,
+	    I2C_SMBUS_BYTE_DATA, &data));
+}
+
+static void
+kb_i2c_adapter_init(struct i2c_adapter *adap)
+{
+	memset(adap, 0, sizeof(*adap));
+	adap->algo = &kb_i2c_algo;
+	adap->nr = -1;
+	if (i2c_add_numbered_adapter(adap) != 0)
+		kb_fatal("Cannot add I2C adapter");
+}
+
+static void
+kb_i2c_writes(struct i2c_adapter *adap, const char *name, unsigned rounds)
+{
+	uint64_t start;
+	unsigned n;
+	int ok = 1;
+
+	start = kb_nsecs();
+	for (n = 0; n != rounds; n++) {
+		ok &= (kb_i2c_write(adap, n % (KB_I2C_RUN * 4),
+		    n / (KB_I2C_RUN * 4)) == 0);
+	}
+	/* a status read flushes any pending write */
+	ok &= (kb_i2c_read(adap, KB_I2C_STATUS) >= 0);
+	start = kb_nsecs() - start;
+
+	for (n = rounds - ((rounds < KB_I2C_RUN * 4) ? rounds : KB_I2C_RUN * 4);
+	    n != rounds; n++)
+		ok &= (kb_i2c_reg[n % (KB_I2C_RUN * 4)] == (u8)(n / (KB_I2C_RUN * 4)));
+	kb_check(ok, name, "register contents differ from the writes");
+	kb_report_ops(name, 1, rounds, start);
+}
+
+static void
+kb_i2c_reads(struct i2c_adapter *adap, const char *name, unsigned rounds)
+{
+	uint64_t start;
+	unsigned n;
+	int ok = 1;
+
+	start = kb_nsecs();
+	for (n = 0; n != rounds; n++) {
+		ok &= (kb_i2c_read(adap, n % (KB_I2C_RUN * 4)) ==
+		    kb_i2c_reg[n % (KB_I2C_RUN * 4)]);
+	}
+	start = kb_nsecs() - start;
+
+	kb_check(ok, name, "register read returned a wrong value");
+	kb_report_ops(name, 1, rounds, start);
+}
+
+static void
+kb_bench_i2c(void)
+{
+	const unsigned rounds = (kb_iterations / 10) ? (kb_iterations / 10) : 1;
+	struct i2c_adapter plain;
+	struct i2c_adapter adap;
+	unsigned long xfers;
+	unsigned n;
+	int ok;
+
+	kb_i2c_adapter_init(&plain);
+	kb_i2c_adapter_init(&adap);
+
+	ok = (i2c_coalesce_enable(&adap, KB_I2C_ADDR, 1, 1 + KB_I2C_RUN) == 0 &&
+	    i2c_regcache_enable(&adap, KB_I2C_ADDR, 1, KB_I2C_REGS) == 0);
+	i2c_regcache_uncached(&adap, KB_I2C_ADDR, KB_I2C_STATUS, KB_I2C_REGS - 1);
+	kb_check(ok, "i2c", "cannot enable coalescing and the register cache");
+
+	/* consecutive writes are merged into one transfer */
+	xfers = kb_i2c_xfers;
+	ok = 1;
+	for (n = 0; n != KB_I2C_RUN; n++)
+		ok &= (kb_i2c_write(&adap, n, 0x40 + n) == 0);
+	ok &= (kb_i2c_read(&adap, KB_I2C_STATUS) >= 0);
+	ok &= (kb_i2c_xfers - xfers == 2);
+	for (n = 0; n != KB_I2C_RUN; n++)
+		ok &= (kb_i2c_reg[n] == 0x40 + n);
+	kb_check(ok, "i2c", "consecutive register writes were not merged");
+
+	/* written registers are read from the cache */
+	xfers = kb_i2c_xfers;
+	ok = 1;
+	for (n = 0; n != KB_I2C_RUN; n++)
+		ok &= (kb_i2c_read(&adap, n) == 0x40 + n);
+	ok &= (kb_i2c_xfers == xfers);
+	kb_check(ok, "i2c", "cached register reads accessed the bus");
+
+	/* a native SMBus write must not leave stale registers behind */
+	ok = (kb_i2c_smbus_write(&adap, 5, 0xaa) == 0 &&
+	    kb_i2c_read(&adap, 5) == 0xaa);
+	kb_check(ok, "i2c", "register read after SMBus write returned stale data");
+
+	/* uncached registers always access the bus */
+	kb_i2c_reg[KB_I2C_STATUS] = 0x12;
+	ok = (kb_i2c_read(&adap, KB_I2C_STATUS) == 0x12);
+	kb_i2c_reg[KB_I2C_STATUS] = 0x34;
+	ok &= (kb_i2c_read(&adap, KB_I2C_STATUS) == 0x34);
+	kb_check(ok, "i2c", "uncached register was read from the cache");
+
+	kb_i2c_writes(&plain, "i2c_write", rounds);
+	kb_i2c_writes(&adap, "i2c_write_coalesced", rounds);
+	kb_i2c_reads(&plain, "i2c_read", rounds);
+	kb_i2c_reads(&adap, "i2c_read_cached", rounds);
+
+	i2c_del_adapter(&adap);
+	i2c_del_adapter(&plain);
+}
+
+/*
+ * Runtime module parameter updates, as done by the "set" request on
+ * the control socket.
+ */
+static int kb_mp_int;
+static int kb_mp_ro;
+static unsigned short kb_mp_ushort;
+static bool kb_mp_bool;
+static char kb_mp_string[8];
+static unsigned kb_mp_notified;
+
+static struct mod_param kb_mp_param[] = {
+	{.name = "kernel_bench.int", .type = "int",
+	    .ptr = &kb_mp_int, .perm = 0644},
+	{.name = "kernel_bench.ro", .type = "int",
+	    .ptr = &kb_mp_ro, .perm = 0444},
+	{.name = "kernel_bench.ushort", .type = "ushort",
+	    .ptr = &kb_mp_ushort, .perm = 0644},
+	{.name = "kernel_bench.bool", .type = "bool",
+	    .ptr = &kb_mp_bool, .perm = 0644},
+	{.name = "kernel_bench.string", .type = "string",
+	    .ptr = kb_mp_string, .size = sizeof(kb_mp_string), .perm = 0644},
+};
+
+static void
+kb_mp_notify(struct mod_param *p)
+{
+	kb_mp_notified++;
+}
+
+static int
+kb_mp_set(const char *name, const char *value, int error)
+{
+	return (mod_set_param_runtime(name, value) == error);
+}
+
+static void
+kb_bench_mod_param(void)
+{
+	static int registered;
+	char value[16];
+	uint64_t start;
+	unsigned n;
+	int ok;
+
+	if (registered == 0) {
+		for (n = 0; n != ARRAY_SIZE(kb_mp_param); n++) {
+			mod_param_register(kb_mp_param + n);
+			mod_param_register_notify(kb_mp_param + n, &kb_mp_notify);
+		}
+		registered = 1;
+	}
+	kb_mp_int = 1;
+	kb_mp_ro = 1;
+	kb_mp_ushort = 1;
+	kb_mp_bool = 0;
+	kb_mp_notified = 0;
+
+	ok = kb_mp_set("kernel_bench.int", "-2147483648", 0) &&
+	    kb_mp_int == INT_MIN &&
+	    kb_mp_set("kernel_bench.int", "0x7fffffff", 0) &&
+	    kb_mp_int == INT_MAX &&
+	    kb_mp_set("kernel_bench.int", "2147483648", -EINVAL) &&
+	    kb_mp_set("kernel_bench.int", "12abc", -EINVAL) &&
+	    kb_mp_set("kernel_bench.int", "", -EINVAL) &&
+	    kb_mp_int == INT_MAX &&
+	    kb_mp_set("kernel_bench.ushort", "65535", 0) &&
+	    kb_mp_set("kernel_bench.ushort", "65536", -EINVAL) &&
+	    kb_mp_set("kernel_bench.ushort", "-1", -EINVAL) &&
+	    kb_mp_ushort == 65535 &&
+	    kb_mp_set("kernel_bench.bool", "1", 0) &&
+	    kb_mp_set("kernel_bench.bool", "2", -EINVAL) &&
+	    kb_mp_bool == 1 &&
+	    kb_mp_set("kernel_bench.string", "1234567", 0) &&
+	    kb_mp_set("kernel_bench.string", "12345678", -EINVAL) &&
+	    strcmp(kb_mp_string, "1234567") == 0;
+	kb_check(ok, "mod_param", "runtime value outside the type range was accepted");
+
+	ok = kb_mp_set("kernel_bench.ro", "2", -EPERM) && kb_mp_ro == 1 &&
+	    kb_mp_set("kernel_bench.none", "2", -ENOENT);
+	kb_check(ok, "mod_param", "read-only or unknown parameter was changed");
+
+	/* five successful updates above, and only those notify */
+	kb_check(kb_mp_notified == 5, "mod_param", "wrong number of notifications");
+
+	/* the command line stays lenient */
+	ok = mod_set_param("kernel_bench.int", "12abc") == 0 && kb_mp_int == 12 &&
+	    mod_set_param("kernel_bench.ro", "3") == 0 && kb_mp_ro == 3;
+	kb_check(ok, "mod_param", "command line parameter was rejected");
+
+	ok = 1;
+	start = kb_nsecs();
+	for (n = 0; n != kb_iterations; n++) {
+		snprintf(value, sizeof(value), "%u", n);
+		ok &= (mod_set_param_runtime("kernel_bench.int", value) == 0);
+	}
+	start = kb_nsecs() - start;
+	kb_check(ok && kb_mp_int == (int)(n - 1), "mod_param_set",
+	    "runtime update failed");
+	kb_report_ops("mod_param_set", 1, n, start);
+}
+
+static const struct {
+	const char *name;
+	void    (*func) (void);
+}	kb_bench_table[] = {
+	{"mutex", &kb_bench_mutex},
+	{"atomic_lock", &kb_bench_atomic},
+	{"kmalloc", &kb_bench_kmalloc},
+	{"sema", &kb_bench_sema},
+	{"completion", &kb_bench_completion},
+	{"waitqueue", &kb_bench_waitqueue},
+	{"timer", &kb_bench_timer},
+	{"work", &kb_bench_work},
+	{"idr", &kb_bench_idr},
+	{"ida", &kb_bench_ida},
+	{"radix", &kb_bench_radix},
+	{"xarray", &kb_bench_xarray},
+	{"ids", &kb_bench_ids},
+	{"concurrent", &kb_bench_concurrent},
+	{"bitops", &kb_bench_bitops},
+	{"bitmap", &kb_bench_bitmap},
+	{"crc32", &kb_bench_crc32},
+	{"sort", &kb_bench_sort},
+	{"firmware", &kb_bench_firmware},
+	{"i2c", &kb_bench_i2c},
+	{"mod_param", &kb_bench_mod_param},
+};
+
+static void
+usage(void)
+{
+	fprintf(stderr,
+	    "usage: kernel_bench [-n <iterations>] [-t <threads>] "
+	    "[-f <filter>] [-l] [-h]\n"
+	    "	-n Set number of iterations per scenario (default 100000)\n"
+	    "	-t Set maximum number of threads for contention (default 8)\n"
+	    "	-f Only run scenarios whose name contains the given string\n"
+	    "	-l List scenarios and exit\n"
+	    "	-h Show usage\n");
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct utsname un;
+	unsigned n;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:t:f:lh")) != -1) {
+		switch (opt) {
+		case 'n':
+			kb_iterations = strtoul(optarg, NULL, 0);
+			if (kb_iterations < 100)
+				kb_iterations = 100;
+			break;
+		case 't':
+			kb_threads = strtoul(optarg, NULL, 0);
+			if (kb_threads < 1)
+				kb_threads = 1;
+			break;
+		case 'f':
+			kb_filter = optarg;
+			break;
+		case 'l':
+			for (n = 0; n != ARRAY_SIZE(kb_bench_table); n++)
+				printf("%s\n", kb_bench_table[n].name);
+			return (0);
+		default:
+			usage();
+			break;
+		}
+	}
+
+	/* setup proper PAGE_SIZE */
+	PAGE_SIZE = getpagesize();
+
+	/* setup proper PAGE_MASK (not the same like in FreeBSD) */
+	PAGE_MASK = ~(PAGE_SIZE - 1);
+
+	/* setup proper PAGE_SHIFT */
+	for (PAGE_SHIFT = 0; (1UL << PAGE_SHIFT) != PAGE_SIZE; PAGE_SHIFT++)
+		;
+
+	kb_samples = calloc(KB_SAMPLES_MAX, sizeof(kb_samples[0]));
+	if (kb_samples == NULL)
+		kb_fatal("Cannot allocate samples");
+
+	thread_init();
+	idr_init_cache();
+	linux_init();
+	crc32_init();
+
+	if (uname(&un) != 0)
+		memset(&un, 0, sizeof(un));
+
+	printf("{\"kernel_bench\":{\"sysname\":");
+	json_print_string(stdout, un.sysname);
+	printf(",\"release\":");
+	json_print_string(stdout, un.release);
+	printf(",\"machine\":");
+	json_print_string(stdout, un.machine);
+	printf(",\"ncpu\":%ld,\"iterations\":%u,\"threads\":%u}}\n",
+	    sysconf(_SC_NPROCESSORS_ONLN), kb_iterations, kb_threads);
+
+	for (n = 0; n != ARRAY_SIZE(kb_bench_table); n++) {
+		if (kb_filter != NULL &&
+		    strstr(kb_bench_table[n].name, kb_filter) == NULL)
+			continue;
+		kb_bench_table[n].func();
+	}
+	return (kb_failed);
+}
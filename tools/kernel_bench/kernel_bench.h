@@ -0,0 +1,126 @@
+/*-
+ * Copyright (c) 2026 Hans Petter Selasky. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _KERNEL_BENCH_H_
+#define	_KERNEL_BENCH_H_
+
+/*
+ * This file replaces webcamd_global.h when building the kernel
+ * emulation layer standalone, without libusb20, cuse or the media
+ * tree.
+ */
+#include <sys/types.h>
+#include <sys/queue.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <poll.h>
+#include <string.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <syslog.h>
+
+#ifdef __linux__
+#ifndef CLOCK_REALTIME_FAST
+#define	CLOCK_REALTIME_FAST CLOCK_REALTIME_COARSE
+#endif
+#ifndef __predict_true
+#define	__predict_true(x) __builtin_expect((x), 1)
+#endif
+#ifndef __predict_false
+#define	__predict_false(x) __builtin_expect((x), 0)
+#endif
+#ifndef __aligned
+#define	__aligned(x) __attribute__((__aligned__(x)))
+#endif
+#ifndef CTASSERT
+#define	CTASSERT(x) _Static_assert(x, "compile time assertion failed")
+#endif
+size_t	strlcpy(char *, const char *, size_t);
+
+/* these are redefined by the kernel emulation layer */
+#undef EMEDIUMTYPE
+#undef ENODATA
+#undef EBADR
+#undef ETIME
+#undef ENOSR
+#undef EREMOTEIO
+#undef EBADRQC
+#undef POLL_ERR
+#undef CLOCK_BOOTTIME
+#undef __attribute_const__
+#undef S_IRWXG
+#undef S_IRWXU
+#undef S_IRUSR
+#undef S_IWUSR
+#undef S_IXUSR
+#undef S_IRGRP
+#undef S_IWGRP
+#undef S_IXGRP
+#undef S_IROTH
+#undef S_IWOTH
+#undef S_IXOTH
+#endif
+
+#undef PAGE_SIZE
+#define	PAGE_SIZE PAGE_SIZE
+
+#undef PAGE_MASK
+#define	PAGE_MASK PAGE_MASK
+
+#undef PAGE_SHIFT
+#define	PAGE_SHIFT PAGE_SHIFT
+
+extern unsigned long PAGE_SIZE;
+extern unsigned long PAGE_MASK;
+extern unsigned char PAGE_SHIFT;
+
+#include <kernel/linux_defs.h>
+#include <kernel/linux_section.h>
+#include <kernel/linux_struct.h>
+#include <kernel/linux_file.h>
+#include <kernel/linux_func.h>
+#include <kernel/linux_list.h>
+#include <kernel/linux_timer.h>
+#include <kernel/linux_task.h>
+#include <kernel/linux_thread.h>
+#include <kernel/linux_trace.h>
+#include <kernel/linux_firmware.h>
+#include <kernel/linux_mod_param.h>
+#include <kernel/linux_radix.h>
+#include <kernel/linux_xarray.h>
+
+#endif					/* _KERNEL_BENCH_H_ */
@@ -45,6 +45,17 @@
 
 #define	NMSG ((struct vtuner_message *)0)
 
+struct vtuner_stats vtuner_stats;
+
+void
+vtuner_stats_json(FILE *fp)
+{
+	fprintf(fp, "{\"rx_bytes\":%ju,\"tx_bytes\":%ju,"
+	    "\"rx_errors\":%ju,\"tx_errors\":%ju}",
+	    (uintmax_t)vtuner_stats.rx_bytes, (uintmax_t)vtuner_stats.tx_bytes,
+	    (uintmax_t)vtuner_stats.rx_errors, (uintmax_t)vtuner_stats.tx_errors);
+}
+
 void
 vtuner_data_hdr_byteswap(u32 * ptr)
 {
@@ -28,9 +28,22 @@
 
 struct vtuner_message;
 
+struct vtuner_stats {
+	uint64_t rx_bytes;
+	uint64_t tx_bytes;
+	uint64_t rx_errors;
+	uint64_t tx_errors;
+};
+
+extern struct vtuner_stats vtuner_stats;
+
+#define	vtuner_stats_add(field, n) \
+	__atomic_fetch_add(&vtuner_stats.field, (n), __ATOMIC_RELAXED)
+
 int	vtuner_struct_size(int);
 void	vtuner_data_hdr_byteswap(u32 *);
 void	vtuner_hdr_byteswap(struct vtuner_message *);
 void	vtuner_body_byteswap(struct vtuner_message *, u32);
+void	vtuner_stats_json(FILE *);
 
 #endif					/* _VTUNER_COMMON_H_ */
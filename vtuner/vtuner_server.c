@@ -402,10 +402,13 @@ vtuners_read(int fd, u8 * ptr, int len)
 		err = read(fd, ptr + off, len - off);
 		if (err <= 0) {
 			DPRINTF("Read error %d\n", err);
+			vtuner_stats_add(rx_errors, 1);
 			return (err);
 		}
 		off += err;
 	}
+	vtuner_stats_add(rx_bytes, off);
+	linux_trace_event(LINUX_TRACE_VTUNER_RECV, fd, off);
 	return (off);
 }
 
@@ -421,10 +424,13 @@ vtuners_write(int fd, const u8 * ptr, int len)
 		err = write(fd, ptr + off, len - off);
 		if (err <= 0) {
 			DPRINTF("Write error %d\n", err);
+			vtuner_stats_add(tx_errors, 1);
 			return (err);
 		}
 		off += err;
 	}
+	vtuner_stats_add(tx_bytes, off);
+	linux_trace_event(LINUX_TRACE_VTUNER_SEND, fd, off);
 	return (off);
 }
 
@@ -27,8 +27,11 @@
 #include <sys/types.h>
 #include <sys/param.h>
 #include <sys/rtprio.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/filio.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #include <fcntl.h>
 #include <unistd.h>
@@ -45,6 +48,10 @@
 
 #include <linux/idr.h>
 
+#ifdef CONFIG_WEBCAMD_VT
+#include <vtuner/vtuner_common.h>
+#endif
+
 static cuse_open_t v4b_open;
 static cuse_close_t v4b_close;
 static cuse_read_t v4b_read;
@@ -110,7 +117,12 @@ static int gid_found;
 static int uid_found;
 static int vtuner_client;
 static int vtuner_server;
+static const char *ctrl_path;
+static int ctrl_fd = -1;
+static unsigned int t_start;
 static void v4b_exit(void);
+static void v4b_frame_stats_text(FILE *);
+static void free_vm_owner(struct cdev_handle *);
 
 #define	CHR_MODE 0660
 
@@ -134,6 +146,52 @@ v4b_work_sig(int dummy)
 	_exit(0);
 }
 
+static void *
+v4b_info(void *arg)
+{
+	sigset_t set;
+	FILE *fp;
+	char *buf;
+	char *line;
+	char *next;
+	size_t len;
+	int sig;
+
+	thread_stats_register("info");
+
+	sigemptyset(&set);
+	sigaddset(&set, SIGINFO);
+#ifdef HAVE_TRACE
+	sigaddset(&set, SIGUSR2);
+#endif
+
+	while (sigwait(&set, &sig) == 0) {
+#ifdef HAVE_TRACE
+		if (sig == SIGUSR2) {
+			linux_trace_dump();
+			continue;
+		}
+#endif
+		fp = open_memstream(&buf, &len);
+		if (fp == NULL)
+			continue;
+		kmalloc_stats(fp);
+		malloc_vm_stats(fp);
+		i2c_stats(fp);
+		usb_linux_stats(fp);
+		v4b_frame_stats_text(fp);
+		fclose(fp);
+
+		for (line = buf; (next = strchr(line, '\n')) != NULL;
+		    line = next + 1) {
+			*next = 0;
+			syslog(LOG_INFO, "%s\n", line);
+		}
+		free(buf);
+	}
+	return (NULL);
+}
+
 static void *
 v4b_work(void *arg)
 {
@@ -141,6 +199,8 @@ v4b_work(void *arg)
 	signal(SIGINT, v4b_work_sig);
 	signal(SIGTERM, v4b_work_sig);
 
+	thread_stats_register("cuse");
+
 	while (1) {
 		if (cuse_wait_and_process() != 0)
 			break;
@@ -231,6 +291,9 @@ v4b_close(struct cuse_dev *cdev, int fflags)
 
 	cuse_dev_set_per_file_handle(cdev, NULL);
 
+	/* release pooled video buffers of this handle */
+	free_vm_owner(handle);
+
 	/* close device */
 	error = linux_close(handle);
 
@@ -281,6 +344,251 @@ unsigned short webcamd_vendor;
 unsigned short webcamd_product;
 unsigned int webcamd_speed;
 
+/*
+ * Per video device frame statistics, collected when VIDIOC_DQBUF
+ * returns. The latency of each frame is split into the time the last
+ * isochronous USB transfer before the buffer timestamp spent on the
+ * bus, the time until the driver timestamped the buffer, and the time
+ * until the buffer was dequeued. The isochronous endpoint is the one
+ * last started by an ioctl on the video device, so that the audio
+ * endpoints of a composite device are not used. The total is only
+ * sampled when that split is available. The percentiles are computed
+ * over the last V4B_FRAME_SAMPLES frames.
+ */
+#define	V4B_FRAME_SAMPLES 256
+
+enum {
+	V4B_FRAME_USB,
+	V4B_FRAME_DRIVER,
+	V4B_FRAME_QUEUED,
+	V4B_FRAME_RETURN,
+	V4B_FRAME_TOTAL,
+	V4B_FRAME_MAX,
+};
+
+static const char *v4b_frame_names[V4B_FRAME_MAX] = {
+	[V4B_FRAME_USB] = "usb_us",
+	[V4B_FRAME_DRIVER] = "driver_us",
+	[V4B_FRAME_QUEUED] = "queued_us",
+	[V4B_FRAME_RETURN] = "return_us",
+	[V4B_FRAME_TOTAL] = "total_us",
+};
+
+struct v4b_frame_stats {
+	uint64_t frames;
+	uint64_t errors;
+	uint64_t gaps;
+	uint64_t dropped;
+	uint32_t sequence;
+	int	isoc_ep;
+	uint32_t count[V4B_FRAME_MAX];
+	uint32_t sample[V4B_FRAME_MAX][V4B_FRAME_SAMPLES];
+};
+
+static struct v4b_frame_stats v4b_frame_stats[F_V4B_SUBDEV_MAX];
+
+static uint64_t
+v4b_usecs(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+
+	return ((uint64_t)ts.tv_sec * 1000000ULL + (ts.tv_nsec / 1000U));
+}
+
+static void
+v4b_frame_sample(struct v4b_frame_stats *pfs, unsigned what, uint64_t usecs)
+{
+	if (usecs > UINT32_MAX)
+		usecs = UINT32_MAX;
+	pfs->sample[what][pfs->count[what]++ % V4B_FRAME_SAMPLES] = usecs;
+}
+
+static struct v4b_frame_stats *
+v4b_frame_stats_get(int f_v4b)
+{
+	unsigned unit;
+
+	unit = f_v4b - (F_V4B_VIDEO * F_V4B_SUBDEV_MAX * F_V4B_SUBSUBDEV_MAX);
+	if (unit >= F_V4B_SUBDEV_MAX)
+		return (NULL);
+	return (v4b_frame_stats + unit);
+}
+
+/*
+ * Remember the isochronous endpoint started by an ioctl on the given
+ * video device, if any.
+ */
+static void
+v4b_frame_endpoint(int f_v4b)
+{
+	struct v4b_frame_stats *pfs;
+	int ep;
+
+	ep = usb_linux_isoc_submitted();
+	pfs = v4b_frame_stats_get(f_v4b);
+	if (ep == 0 || pfs == NULL)
+		return;
+
+	atomic_lock();
+	pfs->isoc_ep = ep;
+	atomic_unlock();
+}
+
+static void
+v4b_frame_done(int f_v4b, uint32_t sequence, uint32_t flags,
+    uint64_t stamp, uint64_t entry)
+{
+	struct v4b_frame_stats *pfs;
+	uint64_t real;
+	uint64_t now;
+	uint64_t done;
+	uint64_t start;
+	uint32_t xfer;
+
+	pfs = v4b_frame_stats_get(f_v4b);
+	if (pfs == NULL)
+		return;
+
+	/*
+	 * The drivers timestamp the buffers using ktime_get(), which
+	 * reads the realtime clock. Translate the timestamp into
+	 * monotonic time.
+	 */
+	now = v4b_usecs(CLOCK_MONOTONIC);
+	real = v4b_usecs(CLOCK_REALTIME);
+	if (stamp == 0 || stamp > real)
+		done = now;
+	else if (real - stamp < now)
+		done = now - (real - stamp);
+	else
+		done = 0;
+
+	atomic_lock();
+	pfs->frames++;
+	if (flags & V4L2_BUF_FLAG_ERROR)
+		pfs->errors++;
+	if (pfs->frames != 1 && sequence > pfs->sequence + 1) {
+		pfs->gaps++;
+		pfs->dropped += sequence - pfs->sequence - 1;
+	}
+	pfs->sequence = sequence;
+
+	if (done != 0) {
+		v4b_frame_sample(pfs, V4B_FRAME_QUEUED, now - done);
+		v4b_frame_sample(pfs, V4B_FRAME_RETURN,
+		    now - ((done > entry) ? done : entry));
+
+		if (usb_linux_isoc_lookup(pfs->isoc_ep, done,
+		    &start, &xfer) == 0) {
+			v4b_frame_sample(pfs, V4B_FRAME_USB, xfer);
+			v4b_frame_sample(pfs, V4B_FRAME_DRIVER, done - start);
+			v4b_frame_sample(pfs, V4B_FRAME_TOTAL,
+			    now - start + xfer);
+		}
+	}
+	atomic_unlock();
+}
+
+static int
+v4b_frame_compare(const void *a, const void *b)
+{
+	const uint32_t x = *(const uint32_t *)a;
+	const uint32_t y = *(const uint32_t *)b;
+
+	return ((x > y) - (x < y));
+}
+
+/*
+ * Compute the 50th, 90th and 99th percentile and the maximum of the
+ * collected samples. Returns the number of samples used.
+ */
+static unsigned
+v4b_frame_percentiles(const struct v4b_frame_stats *pfs, unsigned what,
+    uint32_t *pp)
+{
+	uint32_t buf[V4B_FRAME_SAMPLES];
+	unsigned n;
+
+	n = pfs->count[what];
+	if (n > V4B_FRAME_SAMPLES)
+		n = V4B_FRAME_SAMPLES;
+	if (n == 0)
+		return (0);
+
+	memcpy(buf, pfs->sample[what], n * sizeof(buf[0]));
+	qsort(buf, n, sizeof(buf[0]), &v4b_frame_compare);
+
+	pp[0] = buf[(n * 50) / 100];
+	pp[1] = buf[(n * 90) / 100];
+	pp[2] = buf[(n * 99) / 100];
+	pp[3] = buf[n - 1];
+	return (n);
+}
+
+static void
+v4b_frame_stats_text(FILE *fp)
+{
+	const struct v4b_frame_stats *pfs;
+	uint32_t p[4];
+	unsigned unit;
+
+	atomic_lock();
+	for (unit = 0; unit != F_V4B_SUBDEV_MAX; unit++) {
+		pfs = v4b_frame_stats + unit;
+		if (pfs->frames == 0)
+			continue;
+		fprintf(fp, "video%u: %ju frames, %ju errors, "
+		    "%ju sequence gaps, %ju frames dropped\n", unit,
+		    (uintmax_t)pfs->frames, (uintmax_t)pfs->errors,
+		    (uintmax_t)pfs->gaps, (uintmax_t)pfs->dropped);
+		if (v4b_frame_percentiles(pfs, V4B_FRAME_TOTAL, p) != 0) {
+			fprintf(fp, "video%u: frame latency p50 %uus, "
+			    "p90 %uus, p99 %uus, max %uus\n", unit,
+			    p[0], p[1], p[2], p[3]);
+		} else if (v4b_frame_percentiles(pfs, V4B_FRAME_QUEUED, p) != 0) {
+			fprintf(fp, "video%u: frame queue latency p50 %uus, "
+			    "p90 %uus, p99 %uus, max %uus\n", unit,
+			    p[0], p[1], p[2], p[3]);
+		}
+	}
+	atomic_unlock();
+}
+
+static void
+v4b_frame_stats_json(FILE *fp)
+{
+	const struct v4b_frame_stats *pfs;
+	const char *sep = "";
+	uint32_t p[4];
+	unsigned unit;
+	unsigned x;
+
+	fprintf(fp, "[");
+	atomic_lock();
+	for (unit = 0; unit != F_V4B_SUBDEV_MAX; unit++) {
+		pfs = v4b_frame_stats + unit;
+		if (pfs->frames == 0)
+			continue;
+		fprintf(fp, "%s{\"unit\":%u,\"frames\":%ju,\"errors\":%ju,"
+		    "\"gaps\":%ju,\"dropped\":%ju", sep, unit,
+		    (uintmax_t)pfs->frames, (uintmax_t)pfs->errors,
+		    (uintmax_t)pfs->gaps, (uintmax_t)pfs->dropped);
+		for (x = 0; x != V4B_FRAME_MAX; x++) {
+			if (v4b_frame_percentiles(pfs, x, p) == 0)
+				continue;
+			fprintf(fp, ",\"%s\":{\"p50\":%u,\"p90\":%u,"
+			    "\"p99\":%u,\"max\":%u}", v4b_frame_names[x],
+			    p[0], p[1], p[2], p[3]);
+		}
+		fprintf(fp, "}");
+		sep = ",";
+	}
+	atomic_unlock();
+	fprintf(fp, "]");
+}
+
 static int
 v4b_ioctl(struct cuse_dev *cdev, int fflags,
     unsigned long cmd, void *peer_data)
@@ -288,6 +596,7 @@ v4b_ioctl(struct cuse_dev *cdev, int fflags,
 	struct v4l2_buffer buf;
 	struct v4l2_buffer_compat32 buf32;
 	struct cdev_handle *handle;
+	uint64_t entry;
 	void *ptr;
 	int error;
 
@@ -297,10 +606,17 @@ v4b_ioctl(struct cuse_dev *cdev, int fflags,
 	if (cmd == FIONBIO || cmd == FIOASYNC)
 		return (0);
 
+	entry = v4b_usecs(CLOCK_MONOTONIC);
+
+	linux_trace_begin(LINUX_TRACE_IOCTL, cmd, 0);
+
 	/* execute ioctl */
+	usb_linux_isoc_submitted();
 	error = linux_ioctl(handle,
 	    fflags & (CUSE_FFLAG_NONBLOCK | CUSE_FFLAG_COMPAT32),
 	    cmd, peer_data);
+	if (handle != NULL)
+		v4b_frame_endpoint(handle->f_v4b);
 
 	if ((cmd == VIDIOC_QUERYBUF) && (error >= 0)) {
 		if (copy_from_user(&buf, peer_data, sizeof(buf)) != 0) {
@@ -340,6 +656,18 @@ v4b_ioctl(struct cuse_dev *cdev, int fflags,
 			error = -EFAULT;
 			goto done;
 		}
+	} else if ((cmd == VIDIOC_DQBUF) && (error >= 0) && (handle != NULL)) {
+		if (copy_from_user(&buf, peer_data, sizeof(buf)) == 0) {
+			v4b_frame_done(handle->f_v4b, buf.sequence, buf.flags,
+			    (uint64_t)buf.timestamp.tv_sec * 1000000ULL +
+			    buf.timestamp.tv_usec, entry);
+		}
+	} else if ((cmd == _VIDIOC_DQBUF32) && (error >= 0) && (handle != NULL)) {
+		if (copy_from_user(&buf32, peer_data, sizeof(buf32)) == 0) {
+			v4b_frame_done(handle->f_v4b, buf32.sequence, buf32.flags,
+			    (uint64_t)buf32.timestamp.tv_sec * 1000000ULL +
+			    buf32.timestamp.tv_usec, entry);
+		}
 	} else if ((cmd == WEBCAMD_IOCTL_GET_USB_VENDOR_ID) && (error < 0)) {
 		if (copy_to_user(peer_data, &webcamd_vendor,
 		    sizeof(webcamd_vendor)) != 0) {
@@ -363,6 +691,7 @@ v4b_ioctl(struct cuse_dev *cdev, int fflags,
 		error = 0;
 	}
 done:
+	linux_trace_end(LINUX_TRACE_IOCTL, cmd, (error < 0) ? -error : 0);
 	return (v4b_convert_error(error));
 }
 
@@ -393,78 +722,172 @@ v4b_poll(struct cuse_dev *cdev, int fflags, int events)
 	return (revents);
 }
 
+static unsigned int
+v4b_msecs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((ts.tv_sec * 1000U) + (ts.tv_nsec / 1000000U));
+}
+
+struct v4b_node {
+	pthread_t thread;
+	struct cuse_dev *pdev;
+	unsigned int n;
+	unsigned int q;
+	int	id;
+	int	unit;
+	int    *punit;			/* unit number table entry */
+	uint8_t	retry;
+	uint8_t	threaded;
+	uint8_t	done;
+};
+
+static void *
+v4b_create_node(void *arg)
+{
+	struct v4b_node *pn = arg;
+	const char *dname;
+
+	dname = webcamd_devnames[pn->n / (F_V4B_SUBSUBDEV_MAX *
+	    F_V4B_SUBDEV_MAX)];
+again:
+	pn->pdev = cuse_dev_create(&v4b_methods, (void *)(long)pn->n,
+	    0, uid, gid, CHR_MODE, dname + 1, pn->unit, pn->q);
+
+	/*
+	 * Resolve device naming conflict with new
+	 * kernel evdev module:
+	 */
+	if (pn->pdev == NULL && pn->retry != 0 &&
+	    cuse_alloc_unit_number_by_id(&pn->unit, CUSE_ID_WEBCAMD(pn->id)) == 0) {
+		*pn->punit = pn->unit;
+		goto again;
+	}
+	pn->done = 1;
+	return (NULL);
+}
+
 static void
 v4b_create(int unit)
 {
-	struct cdev_handle *handle;
+	struct v4b_node *pnode;
 	pthread_t dummy;
 	unsigned int n;
 	unsigned int p;
-	unsigned int q;
+	unsigned int x;
+	unsigned int num;
+	unsigned int t[4];
 	int id;
 	char buf[128];
 	int unit_num[UNIT_MAX][F_V4B_SUBDEV_MAX];
 	const char *dname;
-	struct cuse_dev *pdev;
+
+	t[0] = v4b_msecs();
+
+	/* Firmware loading is ASYNC and may register devices: */
+	flush_firmware_requests();
 
 	/* The DVB V2 API is ASYNC and we need to wait for it: */
 	flush_scheduled_work();
 
+	t[1] = v4b_msecs();
+
 	for (n = 0; n != UNIT_MAX; n++) {
 		for (p = 0; p != F_V4B_SUBDEV_MAX; p++) {
 			unit_num[n][p] = (unit < 0) ? -1 : (unit + p);
 		}
 	}
 
-	for (n = 0; n != (F_V4B_MAX * F_V4B_SUBDEV_MAX *
+	pnode = calloc(F_V4B_MAX * F_V4B_SUBDEV_MAX *
+	    F_V4B_SUBSUBDEV_MAX, sizeof(*pnode));
+	if (pnode == NULL)
+		v4b_errx(1, "Cannot allocate memory");
+
+	/* Enumerate the registered character devices only: */
+	for (num = n = 0; n != (F_V4B_MAX * F_V4B_SUBDEV_MAX *
 	    F_V4B_SUBSUBDEV_MAX); n++) {
 
-		handle = linux_open(n, O_RDONLY);
+		if (cdev_is_present(n) == 0)
+			continue;
+
+		dname = webcamd_devnames[n / (F_V4B_SUBSUBDEV_MAX *
+		    F_V4B_SUBDEV_MAX)];
+		id = dname[0] - 'A';
+		p = (n % F_V4B_SUBDEV_MAX);
+
+		if (unit_num[id][p] < 0) {
+			if (cuse_alloc_unit_number_by_id(
+			    &unit_num[id][p],
+			    CUSE_ID_WEBCAMD(id)) != 0) {
+				v4b_errx(1, "Cannot allocate "
+				    "uniq unit number");
+			}
+		}
+		pnode[num].n = n;
+		pnode[num].q = ((n / F_V4B_SUBDEV_MAX) % F_V4B_SUBSUBDEV_MAX);
+		pnode[num].id = id;
+		pnode[num].unit = unit_num[id][p];
+		pnode[num].punit = &unit_num[id][p];
+
+		/*
+		 * Resolve device naming conflict with new kernel
+		 * evdev module. A new unit number is shared by the
+		 * following evdev devices, so these are created one
+		 * by one, in order:
+		 */
+		if (unit < 0 && (n / (F_V4B_SUBDEV_MAX *
+		    F_V4B_SUBSUBDEV_MAX)) == F_V4B_EVDEV) {
+			pnode[num].retry = 1;
+			v4b_create_node(pnode + num);
+		}
+		num++;
+	}
+
+	t[2] = v4b_msecs();
 
-		if (handle != NULL) {
+	/* Create the remaining character devices in parallel: */
+	for (x = 0; x != num; x++) {
+		if (pnode[x].done != 0)
+			continue;
+		if (pthread_create(&pnode[x].thread, NULL,
+		    v4b_create_node, pnode + x) == 0)
+			pnode[x].threaded = 1;
+		else
+			v4b_create_node(pnode + x);
+	}
+	for (x = 0; x != num; x++) {
+		if (pnode[x].threaded != 0)
+			pthread_join(pnode[x].thread, NULL);
+	}
 
-			linux_close(handle);
+	t[3] = v4b_msecs();
 
-			dname = webcamd_devnames[n / (F_V4B_SUBSUBDEV_MAX *
-			    F_V4B_SUBDEV_MAX)];
-			id = dname[0] - 'A';
-			p = (n % F_V4B_SUBDEV_MAX);
-			q = ((n / F_V4B_SUBDEV_MAX) % F_V4B_SUBSUBDEV_MAX);
+	for (x = 0; x != num; x++) {
+		dname = webcamd_devnames[pnode[x].n / (F_V4B_SUBSUBDEV_MAX *
+		    F_V4B_SUBDEV_MAX)];
 
-			if (unit_num[id][p] < 0) {
-				if (cuse_alloc_unit_number_by_id(
-				    &unit_num[id][p],
-				    CUSE_ID_WEBCAMD(id)) != 0) {
-					v4b_errx(1, "Cannot allocate "
-					    "uniq unit number");
-				}
-			}
-again:
-			pdev = cuse_dev_create(&v4b_methods, (void *)(long)n,
-			    0, uid, gid, CHR_MODE, dname + 1,
-			    unit_num[id][p], q);
-
-			/*
-			 * Resolve device naming conflict with new
-			 * kernel evdev module:
-			 */
-			if (pdev == NULL && unit < 0 &&
-			    (n / (F_V4B_SUBDEV_MAX * F_V4B_SUBSUBDEV_MAX)) == F_V4B_EVDEV &&
-			    cuse_alloc_unit_number_by_id(&unit_num[id][p], CUSE_ID_WEBCAMD(id)) == 0)
-				goto again;
-
-			snprintf(buf, sizeof(buf), dname + 1,
-			    unit_num[id][p], q);
+		snprintf(buf, sizeof(buf), dname + 1,
+		    pnode[x].unit, pnode[x].q);
 
+		if (pnode[x].pdev == NULL)
+			syslog(LOG_ERR, "Cannot create /dev/%s\n", buf);
+		else
 			syslog(LOG_INFO, "Creating /dev/%s\n", buf);
 
-			for (p = 0; p != 4; p++) {
-				if (pthread_create(&dummy, NULL, v4b_work, NULL)) {
-					v4b_errx(1, "Failed creating Cuse process");
-				}
+		for (p = 0; p != 4; p++) {
+			if (pthread_create(&dummy, NULL, v4b_work, NULL)) {
+				v4b_errx(1, "Failed creating Cuse process");
 			}
 		}
 	}
+	free(pnode);
+
+	syslog(LOG_INFO, "Created %u device(s) in %u ms "
+	    "(flush %u ms, enumerate %u ms, create %u ms)\n",
+	    num, t[3] - t[0], t[1] - t[0], t[2] - t[1], t[3] - t[2]);
 }
 
 uid_t
@@ -501,7 +924,8 @@ usage(void)
 	    "	-M <match index> for use with -S and -N options\n"
 	    "	-v <video device number>\n"
 	    "	-B Run in background\n"
-	    "	-f <firmware path> [%s]\n"
+	    "	-C <path> Serve statistics on a UNIX domain socket\n"
+	    "	-f <firmware path[:path ...]> [%s]\n"
 	    "	-r Do not set realtime priority\n"
 	    "	-U <user> Set user for character devices\n"
 	    "	-G <group> Set group for character devices\n"
@@ -595,10 +1019,204 @@ free_match(struct find_match **ppfirst)
 	}
 }
 
+/*
+ * Reading the serial number requires opening the USB device and
+ * doing a control request, which is slow and may disturb a device
+ * which is in use by another daemon. Therefore the serial numbers are
+ * cached across runs. The cache key includes the creation time of
+ * the device node, which changes when a device is re-plugged and
+ * reuses a USB address.
+ */
+#define	WEBCAMD_SERIAL_CACHE "/var/run/webcamd.serial"
+#define	WEBCAMD_SERIAL_CACHE_MAX 64
+
+struct serial_cache {
+	struct serial_cache *next;
+	char	key[64];
+	char	ser[128];
+};
+
+static struct serial_cache *serial_cache_head;
+static uint8_t serial_cache_loaded;
+static uint8_t serial_cache_dirty;
+
+static int
+serial_cache_key(struct libusb20_device *pdev, char *key, size_t size)
+{
+	struct LIBUSB20_DEVICE_DESC_DECODED *pddesc;
+	struct stat st;
+	char path[32];
+
+	pddesc = libusb20_dev_get_device_desc(pdev);
+	if (pddesc == NULL)
+		return (-1);
+
+	snprintf(path, sizeof(path), "/dev/ugen%u.%u",
+	    libusb20_dev_get_bus_number(pdev),
+	    libusb20_dev_get_address(pdev));
+
+	if (stat(path, &st) != 0)
+		return (-1);
+
+	snprintf(key, size, "ugen%u.%u:%04x:%04x:%jd.%09ld",
+	    libusb20_dev_get_bus_number(pdev),
+	    libusb20_dev_get_address(pdev),
+	    pddesc->idVendor, pddesc->idProduct,
+	    (intmax_t)st.st_ctim.tv_sec, (long)st.st_ctim.tv_nsec);
+	return (0);
+}
+
+static struct serial_cache *
+serial_cache_add(const char *key, const char *ser)
+{
+	struct serial_cache *ptr;
+
+	ptr = malloc(sizeof(*ptr));
+	if (ptr == NULL)
+		return (NULL);
+	strlcpy(ptr->key, key, sizeof(ptr->key));
+	strlcpy(ptr->ser, ser, sizeof(ptr->ser));
+	ptr->next = serial_cache_head;
+	serial_cache_head = ptr;
+	return (ptr);
+}
+
 static void
-find_devices(void)
+serial_cache_load(void)
+{
+	struct serial_cache **pptail;
+	struct serial_cache *ptr;
+	char line[256];
+	char *ser;
+	FILE *fp;
+
+	serial_cache_loaded = 1;
+
+	fp = fopen(WEBCAMD_SERIAL_CACHE, "r");
+	if (fp == NULL)
+		return;
+
+	/* keep the order of the file */
+	pptail = &serial_cache_head;
+	while (*pptail != NULL)
+		pptail = &(*pptail)->next;
+
+	/*
+	 * Each line is the key and the serial number, separated by the
+	 * first space. The serial number may be empty.
+	 */
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		line[strcspn(line, "\n")] = 0;
+		ser = strchr(line, ' ');
+		if (ser == NULL || ser == line)
+			continue;
+		*ser++ = 0;
+
+		ptr = malloc(sizeof(*ptr));
+		if (ptr == NULL)
+			break;
+		strlcpy(ptr->key, line, sizeof(ptr->key));
+		strlcpy(ptr->ser, ser, sizeof(ptr->ser));
+		ptr->next = NULL;
+		*pptail = ptr;
+		pptail = &ptr->next;
+	}
+	fclose(fp);
+}
+
+static void
+serial_cache_store(void)
+{
+	struct serial_cache *ptr;
+	char path[sizeof(WEBCAMD_SERIAL_CACHE) + 8];
+	unsigned int n;
+	FILE *fp;
+	int f;
+
+	if (serial_cache_dirty == 0)
+		return;
+
+	serial_cache_dirty = 0;
+
+	snprintf(path, sizeof(path), "%s.XXXXXX", WEBCAMD_SERIAL_CACHE);
+
+	f = mkstemp(path);
+	if (f < 0)
+		return;
+	fchmod(f, 0644);
+
+	fp = fdopen(f, "w");
+	if (fp == NULL) {
+		close(f);
+		unlink(path);
+		return;
+	}
+	/* most recently added entries first */
+	for (n = 0, ptr = serial_cache_head; ptr != NULL &&
+	    n != WEBCAMD_SERIAL_CACHE_MAX; ptr = ptr->next, n++)
+		fprintf(fp, "%s %s\n", ptr->key, ptr->ser);
+
+	if (fclose(fp) != 0 || rename(path, WEBCAMD_SERIAL_CACHE) != 0)
+		unlink(path);
+}
+
+static void
+serial_cache_free(void)
+{
+	struct serial_cache *ptr;
+
+	serial_cache_store();
+
+	while ((ptr = serial_cache_head) != NULL) {
+		serial_cache_head = ptr->next;
+		free(ptr);
+	}
+	serial_cache_loaded = 0;
+}
+
+static void
+find_serial(struct libusb20_device *pdev, char *ser, size_t size)
 {
 	struct LIBUSB20_DEVICE_DESC_DECODED *pddesc;
+	struct serial_cache *ptr;
+	char key[64];
+	int error;
+
+	pddesc = libusb20_dev_get_device_desc(pdev);
+	if (pddesc == NULL || pddesc->iSerialNumber == 0) {
+		strlcpy(ser, string_unknown, size);
+		return;
+	}
+	if (serial_cache_loaded == 0)
+		serial_cache_load();
+
+	error = serial_cache_key(pdev, key, sizeof(key));
+	if (error == 0) {
+		for (ptr = serial_cache_head; ptr != NULL; ptr = ptr->next) {
+			if (strcmp(ptr->key, key) == 0) {
+				strlcpy(ser, ptr->ser, size);
+				return;
+			}
+		}
+	}
+	if (libusb20_dev_open(pdev, 0) != 0 ||
+	    libusb20_dev_req_string_simple_sync(pdev,
+	    pddesc->iSerialNumber, ser, size) != 0) {
+		libusb20_dev_close(pdev);
+		strlcpy(ser, string_unknown, size);
+		return;
+	}
+	libusb20_dev_close(pdev);
+
+	string_filter(ser);
+
+	if (error == 0 && serial_cache_add(key, ser) != NULL)
+		serial_cache_dirty = 1;
+}
+
+static void
+find_devices(void)
+{
 	struct libusb20_backend *pbe;
 	struct libusb20_device *pdev;
 	const char *ptr;
@@ -606,7 +1224,6 @@ find_devices(void)
 	char txt[128];
 	char *sub;
 	int found = 0;
-	int match_number = 0;
 	struct find_match *first_match = NULL;
 	struct find_match *curr_match = NULL;
 
@@ -622,6 +1239,12 @@ find_devices(void)
 		if (libusb20_dev_get_mode(pdev) != LIBUSB20_MODE_HOST)
 			continue;
 
+		/* check the cheap criteria first */
+		if (do_list == 0 && u_addr != 0 &&
+		    (libusb20_dev_get_address(pdev) != u_addr ||
+		    libusb20_dev_get_bus_number(pdev) != u_unit))
+			continue;
+
 		ptr = libusb20_dev_get_desc(pdev);
 		if (ptr != NULL) {
 			sub = strchr(ptr, '<');
@@ -636,18 +1259,18 @@ find_devices(void)
 			strcpy(txt, string_unknown);
 		}
 
-		pddesc = libusb20_dev_get_device_desc(pdev);
-		if (pddesc == NULL || pddesc->iSerialNumber == 0 ||
-		    libusb20_dev_open(pdev, 0) != 0 ||
-		    libusb20_dev_req_string_simple_sync(pdev,
-		    pddesc->iSerialNumber, ser, sizeof(ser)) != 0) {
-			strcpy(ser, string_unknown);
-		}
-		libusb20_dev_close(pdev);
-
-		string_filter(ser);
 		string_filter(txt);
 
+		if (do_list == 0 && u_devicename != NULL &&
+		    strcmp(txt, u_devicename) != 0)
+			continue;
+
+		/* only read the serial number when it is needed */
+		if (do_list != 0 || u_serialname != NULL)
+			find_serial(pdev, ser, sizeof(ser));
+		else
+			strcpy(ser, string_unknown);
+
 		if (do_list) {
 			curr_match = new_match(&first_match, ser, txt);
 
@@ -656,22 +1279,21 @@ find_devices(void)
 			    libusb20_dev_get_address(pdev),
 			    txt, ser, curr_match->match_num);
 
-		} else if ((u_devicename == NULL || strcmp(txt, u_devicename) == 0) &&
-			    (u_serialname == NULL || strcmp(ser, u_serialname) == 0) &&
-			    (u_addr == 0 || (libusb20_dev_get_address(pdev) == u_addr &&
-		    libusb20_dev_get_bus_number(pdev) == u_unit))) {
+		} else if (u_serialname == NULL || strcmp(ser, u_serialname) == 0) {
 
 			if (found++ == u_match_index) {
 				u_unit = libusb20_dev_get_bus_number(pdev);
 				u_addr = libusb20_dev_get_address(pdev);
 				libusb20_be_free(pbe);
 				free_match(&first_match);
+				serial_cache_free();
 				return;
 			}
 		}
 	}
 	libusb20_be_free(pbe);
 	free_match(&first_match);
+	serial_cache_free();
 
 	if (do_list != 0) {
 		printf("Show webcamd usage:\n"
@@ -689,9 +1311,194 @@ v4b_exit(void)
 		pidfile_remove(local_pid);
 		local_pid = NULL;
 	}
+	if (ctrl_fd > -1) {
+		close(ctrl_fd);
+		unlink(ctrl_path);
+		ctrl_fd = -1;
+	}
 	closelog();
 }
 
+static void
+v4b_ctrl_snapshot(FILE *fp)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+
+	fprintf(fp, "{\"version\":1,\"uptime_ms\":%u,"
+	    "\"process\":{\"utime_us\":%ju,\"stime_us\":%ju,"
+	    "\"maxrss_kb\":%ld}", v4b_msecs() - t_start,
+	    (uintmax_t)ru.ru_utime.tv_sec * 1000000 + ru.ru_utime.tv_usec,
+	    (uintmax_t)ru.ru_stime.tv_sec * 1000000 + ru.ru_stime.tv_usec,
+	    ru.ru_maxrss);
+	fprintf(fp, ",\"threads\":");
+	thread_stats_json(fp);
+	fprintf(fp, ",\"params\":");
+	mod_show_params_json(fp);
+	fprintf(fp, ",\"files\":");
+	linux_file_stats_json(fp);
+	fprintf(fp, ",\"cuse\":");
+	linux_file_totals_json(fp);
+	fprintf(fp, ",\"timer\":");
+	timer_stats_json(fp);
+	fprintf(fp, ",\"work\":");
+	work_stats_json(fp);
+	fprintf(fp, ",\"usb\":");
+	usb_linux_stats_json(fp);
+	fprintf(fp, ",\"frames\":");
+	v4b_frame_stats_json(fp);
+#ifdef CONFIG_WEBCAMD_VT
+	fprintf(fp, ",\"vtuner\":");
+	vtuner_stats_json(fp);
+#endif
+	fprintf(fp, "}\n");
+}
+
+/*
+ * Handle a single control socket request. "stats", or an empty
+ * request, returns the statistics snapshot. "get <name>" returns a
+ * module parameter and "set <name>=<value>" changes a writable module
+ * parameter of the running instance.
+ */
+static void
+v4b_ctrl_request(FILE *fp, char *req)
+{
+	char *value;
+	int error;
+
+	req[strcspn(req, "\r\n")] = 0;
+
+	if (strncmp(req, "get ", 4) == 0) {
+		if (mod_get_param_json(fp, req + 4) != 0)
+			fprintf(fp, "{\"error\":\"no such parameter\"}");
+		fprintf(fp, "\n");
+	} else if (strncmp(req, "set ", 4) == 0) {
+		req += 4;
+		value = strchr(req, '=');
+		if (value == NULL) {
+			fprintf(fp, "{\"error\":\"missing value\"}\n");
+			return;
+		}
+		*value++ = 0;
+		error = mod_set_param_runtime(req, value);
+		if (error == 0) {
+			syslog(LOG_NOTICE, "Parameter '%s' set to '%s'\n",
+			    req, value);
+			mod_get_param_json(fp, req);
+		} else if (error == -ENOENT) {
+			fprintf(fp, "{\"error\":\"no such parameter\"}");
+		} else if (error == -EPERM) {
+			fprintf(fp, "{\"error\":\"parameter is read-only\"}");
+		} else {
+			fprintf(fp, "{\"error\":\"invalid value\"}");
+		}
+		fprintf(fp, "\n");
+	} else if (strcmp(req, "stats") == 0 || req[0] == 0) {
+		v4b_ctrl_snapshot(fp);
+	} else {
+		fprintf(fp, "{\"error\":\"unknown request\"}\n");
+	}
+}
+
+static void *
+v4b_ctrl(void *arg)
+{
+	struct timeval tv = {.tv_sec = 1};
+	char req[256];
+	FILE *fp;
+	char *buf;
+	size_t len;
+	size_t off;
+	ssize_t n;
+	int fd;
+
+	thread_stats_register("control");
+
+	while (1) {
+		fd = accept(ctrl_fd, NULL, NULL);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			break;
+		}
+		/* don't let a stuck client block the next one */
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+		/*
+		 * Read the request line. End of file also terminates
+		 * the request, so that a client which only shuts down
+		 * its sending side gets the snapshot right away.
+		 */
+		for (off = 0; off < sizeof(req) - 1; off += n) {
+			n = recv(fd, req + off, sizeof(req) - 1 - off, 0);
+			if (n <= 0)
+				break;
+			if (memchr(req + off, '\n', n) != NULL) {
+				off += n;
+				break;
+			}
+		}
+		if (n < 0) {
+			/* no complete request in time */
+			close(fd);
+			continue;
+		}
+		req[off] = 0;
+
+		fp = open_memstream(&buf, &len);
+		if (fp != NULL) {
+			v4b_ctrl_request(fp, req);
+			fclose(fp);
+
+			for (off = 0; off < len; off += n) {
+				n = send(fd, buf + off, len - off, MSG_NOSIGNAL);
+				if (n <= 0)
+					break;
+			}
+			free(buf);
+		}
+		close(fd);
+	}
+	thread_stats_unregister();
+	return (NULL);
+}
+
+static void
+v4b_ctrl_init(void)
+{
+	struct sockaddr_un addr;
+	struct stat st;
+	pthread_t dummy;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlcpy(addr.sun_path, ctrl_path, sizeof(addr.sun_path)) >=
+	    sizeof(addr.sun_path))
+		v4b_errx(EX_USAGE, "Control socket path is too long");
+
+	/* remove stale socket, if any */
+	if (lstat(ctrl_path, &st) == 0 && S_ISSOCK(st.st_mode))
+		unlink(ctrl_path);
+
+	ctrl_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (ctrl_fd < 0)
+		v4b_errx(EX_OSERR, "Cannot create control socket");
+
+	if (bind(ctrl_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+	    listen(ctrl_fd, 4) != 0) {
+		close(ctrl_fd);
+		ctrl_fd = -1;
+		v4b_errx(EX_USAGE, "Cannot bind control socket '%s'", ctrl_path);
+	}
+	if (chown(ctrl_path, uid, gid) != 0 || chmod(ctrl_path, CHR_MODE) != 0)
+		syslog(LOG_WARNING, "Cannot set permissions of '%s'\n", ctrl_path);
+
+	if (pthread_create(&dummy, NULL, v4b_ctrl, NULL) != 0)
+		syslog(LOG_WARNING, "Cannot create control socket thread\n");
+}
+
 int
 pidfile_create(int bus, int addr, int index)
 {
@@ -763,8 +1570,11 @@ unsigned char PAGE_SHIFT;
 int
 main(int argc, char **argv)
 {
-	const char *params = "N:Bd:f:i:M:m:S:sv:hHrU:G:D:lL:c:";
+	const char *params = "N:BC:d:f:i:M:m:S:sv:hHrU:G:D:lL:c:";
+	pthread_t info_thread;
+	sigset_t set;
 	char *ptr;
+	unsigned int t_init;
 	int opt;
 	int opt_valid = 0;
 
@@ -844,6 +1654,10 @@ main(int argc, char **argv)
 			do_fork = 1;
 			break;
 
+		case 'C':
+			ctrl_path = optarg;
+			break;
+
 		case 'f':
 			strlcpy(global_fw_prefix, optarg,
 			    sizeof(global_fw_prefix));
@@ -1023,8 +1837,21 @@ main(int argc, char **argv)
 
 	/* system init */
 
+	t_init = t_start = v4b_msecs();
+
+	/* report statistics on SIGINFO, before any other threads exist */
+	sigemptyset(&set);
+	sigaddset(&set, SIGINFO);
+#ifdef HAVE_TRACE
+	sigaddset(&set, SIGUSR2);
+#endif
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+	if (pthread_create(&info_thread, NULL, v4b_info, NULL) != 0)
+		syslog(LOG_WARNING, "Cannot create statistics thread\n");
+
 	thread_init();
 	idr_init_cache();
+	crc32_init();
 
 	/* run rest of Linux init code */
 
@@ -1035,6 +1862,12 @@ main(int argc, char **argv)
 		if (usb_linux_probe_p(&u_unit, &u_addr, &u_index, &d_desc) < 0)
 			v4b_errx(EX_USAGE, "Cannot find USB device");
 	}
+	if (ctrl_path != NULL)
+		v4b_ctrl_init();
+
+	syslog(LOG_INFO, "Initialized and probed in %u ms\n",
+	    v4b_msecs() - t_init);
+
 	if (vtuner_server == 0) {
 		v4b_create(u_videodev);
 
@@ -1113,23 +1946,260 @@ is_vmalloc_addr(void *addr)
 	return (cuse_is_vmalloc_addr(addr));
 }
 
-void   *
-malloc_vm(size_t size)
+/*
+ * Released cuse mappings are kept in a small pool, because video
+ * buffers are typically freed and allocated again with the same
+ * size on every VIDIOC_REQBUFS. A client may keep a mapping after
+ * the buffer has been freed, so a pooled mapping is only handed out
+ * again to the same character device handle which allocated it, and
+ * is released when that handle is closed. Fresh mappings are zero
+ * filled by the cuse driver, so only recycled mappings need to be
+ * cleared.
+ */
+#define	VM_POOL_MAX 16			/* mappings */
+#define	VM_POOL_BYTES (128UL << 20)	/* bytes */
+#define	VM_LIVE_HASH 64			/* buckets, must be power of two */
+
+struct vm_alloc {
+	TAILQ_ENTRY(vm_alloc) entry;	/* on the pool */
+	LIST_ENTRY(vm_alloc) hash_entry;	/* while in use */
+	void   *ptr;
+	size_t	size;
+	struct cdev_handle *owner;
+};
+
+TAILQ_HEAD(vm_alloc_head, vm_alloc);
+LIST_HEAD(vm_alloc_list, vm_alloc);
+
+static struct vm_alloc_list vm_live[VM_LIVE_HASH];
+static struct vm_alloc_head vm_pool = TAILQ_HEAD_INITIALIZER(vm_pool);
+static size_t vm_pool_bytes;
+static unsigned vm_pool_count;
+static unsigned long vm_stat_hits;
+static unsigned long vm_stat_misses;
+static unsigned long vm_stat_evicts;
+static unsigned long vm_stat_zeroed;
+
+static struct vm_alloc_list *
+vm_live_head(const void *ptr)
 {
+	return (&vm_live[((uintptr_t)ptr / PAGE_SIZE) & (VM_LIVE_HASH - 1)]);
+}
+
+/*
+ * The following function frees the given mappings. It must be called
+ * without the atomic lock held, because cuse_vmfree() blocks.
+ */
+static void
+vm_pool_free(struct vm_alloc_head *phead)
+{
+	struct vm_alloc *pva;
+
+	while ((pva = TAILQ_FIRST(phead)) != NULL) {
+		TAILQ_REMOVE(phead, pva, entry);
+		cuse_vmfree(pva->ptr);
+		free(pva);
+	}
+}
+
+/*
+ * The following function moves the pooled mappings of the given
+ * owner, or all pooled mappings if "owner" is NULL, to "phead". Must
+ * be called with the atomic lock held.
+ */
+static void
+vm_pool_collect(struct vm_alloc_head *phead, struct cdev_handle *owner)
+{
+	struct vm_alloc *pva;
+	struct vm_alloc *next;
+
+	TAILQ_FOREACH_SAFE(pva, &vm_pool, entry, next) {
+		if (owner != NULL && pva->owner != owner)
+			continue;
+		TAILQ_REMOVE(&vm_pool, pva, entry);
+		TAILQ_INSERT_TAIL(phead, pva, entry);
+		vm_pool_bytes -= pva->size;
+		vm_pool_count--;
+	}
+}
+
+static void *
+malloc_vm_sub(size_t size, int zero)
+{
+	struct vm_alloc_head head = TAILQ_HEAD_INITIALIZER(head);
+	struct cdev_handle *owner;
+	struct vm_alloc *pva;
+	struct vm_alloc *best;
+
 	if (size == 0)
 		return (zero_alloc);
 	else if (size > 0x7FFFFFFFUL)
 		return (NULL);	/* too big */
-	return (cuse_vmalloc(size));
+
+	size = PAGE_ALIGN(size);
+	owner = get_current_cdev_handle();
+
+	atomic_lock();
+	/* use the smallest pooled mapping not wasting more than 1/8 */
+	best = NULL;
+	TAILQ_FOREACH(pva, &vm_pool, entry) {
+		if (owner == NULL || pva->owner != owner)
+			continue;
+		if (pva->size < size || pva->size > size + (size / 8))
+			continue;
+		if (best == NULL || pva->size < best->size)
+			best = pva;
+		if (pva->size == size)
+			break;
+	}
+	if (best != NULL) {
+		TAILQ_REMOVE(&vm_pool, best, entry);
+		LIST_INSERT_HEAD(vm_live_head(best->ptr), best, hash_entry);
+		vm_pool_bytes -= best->size;
+		vm_pool_count--;
+		vm_stat_hits++;
+		if (zero)
+			vm_stat_zeroed += size;
+		atomic_unlock();
+
+		if (zero)
+			memset(best->ptr, 0, size);
+		return (best->ptr);
+	}
+	vm_stat_misses++;
+	atomic_unlock();
+
+	pva = malloc(sizeof(*pva));
+	if (pva == NULL)
+		return (NULL);
+
+	pva->size = size;
+	pva->owner = owner;
+	pva->ptr = cuse_vmalloc(size);
+	if (pva->ptr == NULL) {
+		/* the pooled mappings might be what is missing */
+		atomic_lock();
+		vm_pool_collect(&head, NULL);
+		atomic_unlock();
+		vm_pool_free(&head);
+
+		pva->ptr = cuse_vmalloc(size);
+		if (pva->ptr == NULL) {
+			free(pva);
+			return (NULL);
+		}
+	}
+	atomic_lock();
+	LIST_INSERT_HEAD(vm_live_head(pva->ptr), pva, hash_entry);
+	atomic_unlock();
+
+	return (pva->ptr);
+}
+
+void   *
+malloc_vm(size_t size)
+{
+	return (malloc_vm_sub(size, 0));
+}
+
+void   *
+malloc_vm_zero(size_t size)
+{
+	return (malloc_vm_sub(size, 1));
 }
 
 void
 free_vm(void *ptr)
 {
-	if (ptr == zero_alloc)
+	struct vm_alloc_head head = TAILQ_HEAD_INITIALIZER(head);
+	struct vm_alloc *pva;
+
+	if (ptr == zero_alloc || ptr == NULL)
 		return;
 
-	cuse_vmfree(ptr);
+	atomic_lock();
+	LIST_FOREACH(pva, vm_live_head(ptr), hash_entry) {
+		if (pva->ptr == ptr)
+			break;
+	}
+	if (pva == NULL) {
+		atomic_unlock();
+		cuse_vmfree(ptr);
+		return;
+	}
+	LIST_REMOVE(pva, hash_entry);
+
+	/*
+	 * Mappings allocated outside the context of a character
+	 * device handle might be mapped by any client and are not
+	 * pooled.
+	 */
+	if (pva->owner == NULL || pva->size > VM_POOL_BYTES) {
+		atomic_unlock();
+		cuse_vmfree(ptr);
+		free(pva);
+		return;
+	}
+	TAILQ_INSERT_HEAD(&vm_pool, pva, entry);
+	vm_pool_bytes += pva->size;
+	vm_pool_count++;
+
+	/* evict the least recently released mappings */
+	while (vm_pool_count > VM_POOL_MAX || vm_pool_bytes > VM_POOL_BYTES) {
+		pva = TAILQ_LAST(&vm_pool, vm_alloc_head);
+		TAILQ_REMOVE(&vm_pool, pva, entry);
+		TAILQ_INSERT_TAIL(&head, pva, entry);
+		vm_pool_bytes -= pva->size;
+		vm_pool_count--;
+		vm_stat_evicts++;
+	}
+	atomic_unlock();
+
+	vm_pool_free(&head);
+}
+
+/*
+ * The following function is called when a character device handle
+ * is closed. Its pooled mappings are released, and mappings it
+ * allocated which are still in use are not pooled when freed.
+ */
+static void
+free_vm_owner(struct cdev_handle *owner)
+{
+	struct vm_alloc_head head = TAILQ_HEAD_INITIALIZER(head);
+	struct vm_alloc *pva;
+	unsigned x;
+
+	if (owner == NULL)
+		return;
+
+	atomic_lock();
+	vm_pool_collect(&head, owner);
+	for (x = 0; x != VM_LIVE_HASH; x++) {
+		LIST_FOREACH(pva, &vm_live[x], hash_entry) {
+			if (pva->owner == owner)
+				pva->owner = NULL;
+		}
+	}
+	atomic_unlock();
+
+	vm_pool_free(&head);
+}
+
+void
+malloc_vm_stats(FILE *fp)
+{
+	unsigned long total;
+
+	atomic_lock();
+	total = vm_stat_hits + vm_stat_misses;
+	fprintf(fp, "vmalloc: %lu allocations, %lu pool hits (%lu%%), "
+	    "%lu evictions, %lu bytes cleared\n", total, vm_stat_hits,
+	    total ? (vm_stat_hits * 100) / total : 0, vm_stat_evicts,
+	    vm_stat_zeroed);
+	fprintf(fp, "vmalloc: %u mappings holding %zu bytes pooled\n",
+	    vm_pool_count, vm_pool_bytes);
+	atomic_unlock();
 }
 
 int
@@ -80,6 +80,7 @@ extern unsigned char PAGE_SHIFT;
 #include <kernel/linux_timer.h>
 #include <kernel/linux_task.h>
 #include <kernel/linux_thread.h>
+#include <kernel/linux_trace.h>
 #include <kernel/linux_usb.h>
 #include <kernel/linux_firmware.h>
 #include <kernel/linux_mod_param.h>
@@ -135,5 +136,6 @@ struct v4l2_buffer_compat32 {
 };
 
 #define	_VIDIOC_QUERYBUF32 _IOWR('V',  9, struct v4l2_buffer_compat32)
+#define	_VIDIOC_DQBUF32 _IOWR('V', 17, struct v4l2_buffer_compat32)
 
 #endif					/* _WEBCAMD_GLOBAL_H_ */